@@ -35,6 +35,7 @@ HEADERS += src/App.h \
            src/Raytracing/AABB.h \
            src/Raytracing/Camera.h \
            src/Raytracing/Intersection.h \
+           src/Raytracing/LightBVH.h \
            src/Raytracing/Lights.h \
            src/Raytracing/Material.h \
            src/Raytracing/Ray.h \
@@ -56,6 +57,7 @@ HEADERS += src/App.h \
            src/Utils/ModelLoader.h \
            src/Utils/PerlinNoise.h \
            src/Utils/PoissonDisc.h \
+           src/Utils/ScratchBuffer.h \
            src/Utils/StringUtils.h \
            src/Utils/SysUtils.h \
            src/Utils/Timer.h \
@@ -72,6 +74,7 @@ HEADERS += src/App.h \
            src/Raytracing/Primitives/Sphere.h \
            src/Raytracing/Primitives/Torus.h \
            src/Raytracing/Primitives/Triangle.h \
+           src/Raytracing/Primitives/TriangleMesh.h \
            src/Raytracing/Textures/AtmosphereTexture.h \
            src/Raytracing/Textures/CellNoiseTexture.h \
            src/Raytracing/Textures/CheckerTexture.h \
@@ -87,6 +90,7 @@ HEADERS += src/App.h \
            src/Raytracing/Textures/WoodTexture.h \
            src/Raytracing/Tracers/PathTracer.h \
            src/Raytracing/Tracers/Raytracer.h \
+           src/Raytracing/Tracers/TileScheduler.h \
            src/Raytracing/Tracers/Tracer.h \
            src/Raytracing/Tracers/TracerState.h \
            src/Rendering/Filters/BellFilter.h \
@@ -132,6 +136,7 @@ SOURCES += src/App.cpp \
            src/OpenCL/CLTracer.cpp \
            src/Raytracing/AABB.cpp \
            src/Raytracing/Camera.cpp \
+           src/Raytracing/LightBVH.cpp \
            src/Raytracing/Ray.cpp \
            src/Raytracing/Scene.cpp \
            src/Rendering/Film.cpp \
@@ -142,17 +147,26 @@ SOURCES += src/App.cpp \
            src/Runners/ConsoleRunner.cpp \
            src/Runners/NetworkRunner.cpp \
            src/Runners/WindowRunner.cpp \
+           src/Tests/BlinnBlobTest.cpp \
            src/Tests/ColorGradientTest.cpp \
+           src/Tests/CSGTest.cpp \
            src/Tests/EulerAngleTest.cpp \
            src/Tests/FilterTest.cpp \
+           src/Tests/FlatBVHTest.cpp \
            src/Tests/ImageTest.cpp \
+           src/Tests/InstanceTest.cpp \
+           src/Tests/LightBVHTest.cpp \
            src/Tests/MathUtilsTest.cpp \
            src/Tests/Matrix4x4Test.cpp \
            src/Tests/ModelLoaderTest.cpp \
+           src/Tests/PathTracerTest.cpp \
            src/Tests/PolynomialTest.cpp \
            src/Tests/SamplerTest.cpp \
+           src/Tests/ScratchBufferTest.cpp \
            src/Tests/SolverTest.cpp \
            src/Tests/TestScenesTest.cpp \
+           src/Tests/TileSchedulerTest.cpp \
+           src/Tests/TorusTest.cpp \
            src/Tests/Vector3Test.cpp \
            src/TestScenes/TestScene1.cpp \
            src/TestScenes/TestScene10.cpp \
@@ -194,10 +208,12 @@ SOURCES += src/App.cpp \
            src/Raytracing/Primitives/FlatBVH.cpp \
            src/Raytracing/Primitives/Instance.cpp \
            src/Raytracing/Primitives/Plane.cpp \
+           src/Raytracing/Primitives/Primitive.cpp \
            src/Raytracing/Primitives/PrimitiveGroup.cpp \
            src/Raytracing/Primitives/Sphere.cpp \
            src/Raytracing/Primitives/Torus.cpp \
            src/Raytracing/Primitives/Triangle.cpp \
+           src/Raytracing/Primitives/TriangleMesh.cpp \
            src/Raytracing/Textures/AtmosphereTexture.cpp \
            src/Raytracing/Textures/CellNoiseTexture.cpp \
            src/Raytracing/Textures/CheckerTexture.cpp \
@@ -212,6 +228,7 @@ SOURCES += src/App.cpp \
            src/Raytracing/Textures/WoodTexture.cpp \
            src/Raytracing/Tracers/PathTracer.cpp \
            src/Raytracing/Tracers/Raytracer.cpp \
+           src/Raytracing/Tracers/TileScheduler.cpp \
            src/Raytracing/Tracers/Tracer.cpp \
            src/Rendering/Filters/BellFilter.cpp \
            src/Rendering/Filters/BoxFilter.cpp \
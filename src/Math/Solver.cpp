@@ -4,9 +4,23 @@
 #include "stdafx.h"
 
 #include "Math/Solver.h"
+#include "Math/Polynomial.h"
 
 using namespace Raycer;
 
+namespace
+{
+	// insertion sort for the few roots
+	void sortRoots(double* roots, uint64_t count)
+	{
+		for (uint64_t i = 1; i < count; ++i)
+		{
+			for (uint64_t j = i; j > 0 && roots[j - 1] > roots[j]; --j)
+				std::swap(roots[j - 1], roots[j]);
+		}
+	}
+}
+
 // numerically stable quadratic formula
 QuadraticResult Solver::findQuadraticRoots(double a, double b, double c)
 {
@@ -30,6 +44,167 @@ QuadraticResult Solver::findQuadraticRoots(double a, double b, double c)
 	return result;
 }
 
+// real roots only, in ascending order
+// http://numerical.recipes/book/book.html (5.6)
+CubicResult Solver::findCubicRoots(double a, double b, double c, double d)
+{
+	CubicResult result;
+
+	if (a == 0.0)
+	{
+		QuadraticResult quadraticResult = findQuadraticRoots(b, c, d);
+
+		result.rootCount = quadraticResult.rootCount;
+		result.roots[0] = quadraticResult.roots[0];
+		result.roots[1] = quadraticResult.roots[1];
+
+		return result;
+	}
+
+	double A = b / a;
+	double B = c / a;
+	double C = d / a;
+
+	double Q = (A * A - 3.0 * B) / 9.0;
+	double R = (2.0 * A * A * A - 9.0 * A * B + 27.0 * C) / 54.0;
+	double Q3 = Q * Q * Q;
+
+	if (R * R < Q3)
+	{
+		double theta = acos(R / sqrt(Q3));
+		double scale = -2.0 * sqrt(Q);
+
+		result.rootCount = 3;
+		result.roots[0] = scale * cos(theta / 3.0) - A / 3.0;
+		result.roots[1] = scale * cos((theta + 2.0 * M_PI) / 3.0) - A / 3.0;
+		result.roots[2] = scale * cos((theta - 2.0 * M_PI) / 3.0) - A / 3.0;
+
+		sortRoots(result.roots, 3);
+	}
+	else
+	{
+		double S = -copysign(1.0, R) * cbrt(std::abs(R) + sqrt(R * R - Q3));
+		double T = (S != 0.0) ? (Q / S) : 0.0;
+
+		result.rootCount = 1;
+		result.roots[0] = (S + T) - A / 3.0;
+	}
+
+	return result;
+}
+
+// Ferrari's method through the resolvent cubic, real roots only, in ascending order
+// the roots are polished with Newton's method, a breakdown of the closed form falls back to the iterative polynomial solver
+// https://en.wikipedia.org/wiki/Quartic_function#Ferrari.27s_solution
+QuarticResult Solver::findQuarticRoots(double a, double b, double c, double d, double e)
+{
+	QuarticResult result;
+
+	if (a == 0.0)
+	{
+		CubicResult cubicResult = findCubicRoots(b, c, d, e);
+
+		result.rootCount = cubicResult.rootCount;
+
+		for (uint64_t i = 0; i < cubicResult.rootCount; ++i)
+			result.roots[i] = cubicResult.roots[i];
+
+		return result;
+	}
+
+	double A = b / a;
+	double B = c / a;
+	double C = d / a;
+	double D = e / a;
+
+	// depressed quartic y^4 + p * y^2 + q * y + r, x = y - A / 4
+	double A2 = A * A;
+	double p = B - 3.0 * A2 / 8.0;
+	double q = C - A * B / 2.0 + A2 * A / 8.0;
+	double r = D - A * C / 4.0 + A2 * B / 16.0 - 3.0 * A2 * A2 / 256.0;
+
+	// the largest root of 8m^3 + 8pm^2 + (2p^2 - 8r)m - q^2 is positive unless q is zero
+	CubicResult resolventResult = findCubicRoots(8.0, 8.0 * p, 2.0 * p * p - 8.0 * r, -q * q);
+	double m = resolventResult.roots[resolventResult.rootCount - 1];
+
+	auto addRoots = [&](const QuadraticResult& quadraticResult)
+	{
+		for (uint64_t i = 0; i < quadraticResult.rootCount; ++i)
+			result.roots[result.rootCount++] = quadraticResult.roots[i] - A / 4.0;
+	};
+
+	if (m <= std::numeric_limits<double>::epsilon() * std::max(1.0, std::abs(p)))
+	{
+		// biquadratic y^4 + p * y^2 + r
+		QuadraticResult quadraticResult = findQuadraticRoots(1.0, p, r);
+
+		for (uint64_t i = 0; i < quadraticResult.rootCount; ++i)
+		{
+			if (quadraticResult.roots[i] < 0.0)
+				continue;
+
+			double y = sqrt(quadraticResult.roots[i]);
+
+			result.roots[result.rootCount++] = -y - A / 4.0;
+			result.roots[result.rootCount++] = y - A / 4.0;
+		}
+	}
+	else
+	{
+		// (y^2 + p / 2 + m)^2 - (sy - q / 2s)^2 with s = sqrt(2m)
+		double s = sqrt(2.0 * m);
+
+		addRoots(findQuadraticRoots(1.0, -s, p / 2.0 + m + q / (2.0 * s)));
+		addRoots(findQuadraticRoots(1.0, s, p / 2.0 + m - q / (2.0 * s)));
+	}
+
+	bool isValid = true;
+
+	for (uint64_t i = 0; i < result.rootCount; ++i)
+	{
+		double x = result.roots[i];
+
+		for (uint64_t j = 0; j < 2; ++j)
+		{
+			double value = (((x + A) * x + B) * x + C) * x + D;
+			double derivative = ((4.0 * x + 3.0 * A) * x + 2.0 * B) * x + C;
+
+			if (derivative == 0.0)
+				break;
+
+			double newX = x - value / derivative;
+			double newValue = (((newX + A) * newX + B) * newX + C) * newX + D;
+
+			if (!(std::abs(newValue) < std::abs(value)))
+				break;
+
+			x = newX;
+		}
+
+		result.roots[i] = x;
+		isValid = isValid && std::isfinite(x);
+	}
+
+	if (!isValid)
+	{
+		double coefficients[5] = { 1.0, A, B, C, D };
+		Polynomial<5> polynomial(coefficients);
+		const std::complex<double>* roots = polynomial.findAllRoots(64, 1.0e-12);
+
+		result.rootCount = 0;
+
+		for (uint64_t i = 0; i < 4; ++i)
+		{
+			if (std::abs(roots[i].imag()) < 1.0e-6)
+				result.roots[result.rootCount++] = roots[i].real();
+		}
+	}
+
+	sortRoots(result.roots, result.rootCount);
+
+	return result;
+}
+
 // false position / regula falsi
 // https://en.wikipedia.org/wiki/False_position_method
 double Solver::findRoot(const std::function<double(double)>& f, double begin, double end, uint64_t iterations)
@@ -13,11 +13,25 @@ namespace Raycer
 		double roots[2];
 	};
 
+	struct CubicResult
+	{
+		uint64_t rootCount = 0;
+		double roots[3];
+	};
+
+	struct QuarticResult
+	{
+		uint64_t rootCount = 0;
+		double roots[4];
+	};
+
 	class Solver
 	{
 	public:
 
 		static QuadraticResult findQuadraticRoots(double a, double b, double c);
+		static CubicResult findCubicRoots(double a, double b, double c, double d);
+		static QuarticResult findQuarticRoots(double a, double b, double c, double d, double e);
 		static double findRoot(const std::function<double(double)>& f, double begin, double end, uint64_t iterations = 32);
 	};
 }
@@ -137,9 +137,9 @@ void Vector3::set(uint64_t index, double value)
 {
 	switch (index)
 	{
-		case 0: x = value;
-		case 1: y = value;
-		case 2: z = value;
+		case 0: x = value; break;
+		case 1: y = value; break;
+		case 2: z = value; break;
 		default: throw std::runtime_error("Invalid vector element index");
 	}
 }
@@ -90,6 +90,17 @@ void AABB::expand(const AABB& other)
 	max.z = std::max(max.z, other.max.z);
 }
 
+void AABB::expand(const Vector3& point)
+{
+	min.x = std::min(min.x, point.x);
+	min.y = std::min(min.y, point.y);
+	min.z = std::min(min.z, point.z);
+
+	max.x = std::max(max.x, point.x);
+	max.y = std::max(max.y, point.y);
+	max.z = std::max(max.z, point.z);
+}
+
 uint64_t AABB::getLargestAxis() const
 {
 	Vector3 extent = getExtent();
@@ -106,9 +117,21 @@ uint64_t AABB::getLargestAxis() const
 
 AABB AABB::transformed(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) const
 {
-	Vector3 corners[8], newMin, newMax;
 	Vector3 center = getCenter();
 
+	Matrix4x4 scaling = Matrix4x4::scale(scale);
+	Matrix4x4 rotation = Matrix4x4::rotateXYZ(rotate);
+	Matrix4x4 translation1 = Matrix4x4::translate(-center);
+	Matrix4x4 translation2 = Matrix4x4::translate(center + translate);
+	Matrix4x4 transformation = translation2 * rotation * scaling * translation1;
+
+	return transformed(transformation);
+}
+
+AABB AABB::transformed(const Matrix4x4& transformation) const
+{
+	Vector3 corners[8], newMin, newMax;
+
 	corners[0] = min;
 	corners[1] = Vector3(max.x, min.y, min.z);
 	corners[2] = Vector3(max.x, min.y, max.z);
@@ -121,12 +144,6 @@ AABB AABB::transformed(const Vector3& scale, const EulerAngle& rotate, const Vec
 	newMin.x = newMin.y = newMin.z = std::numeric_limits<double>::max();
 	newMax.x = newMax.y = newMax.z = std::numeric_limits<double>::lowest();
 
-	Matrix4x4 scaling = Matrix4x4::scale(scale);
-	Matrix4x4 rotation = Matrix4x4::rotateXYZ(rotate);
-	Matrix4x4 translation1 = Matrix4x4::translate(-center);
-	Matrix4x4 translation2 = Matrix4x4::translate(center + translate);
-	Matrix4x4 transformation = translation2 * rotation * scaling * translation1;
-
 	for (auto & corner : corners)
 	{
 		corner = transformation.transformPosition(corner);
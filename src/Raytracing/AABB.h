@@ -11,6 +11,7 @@ namespace Raycer
 {
 	class Ray;
 	class EulerAngle;
+	class Matrix4x4;
 
 	class AABB
 	{
@@ -24,8 +25,10 @@ namespace Raycer
 
 		bool intersects(const Ray& ray) const;
 		void expand(const AABB& other);
+		void expand(const Vector3& point);
 		uint64_t getLargestAxis() const;
 		AABB transformed(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) const;
+		AABB transformed(const Matrix4x4& transformation) const;
 
 		Vector3 getMin() const;
 		Vector3 getMax() const;
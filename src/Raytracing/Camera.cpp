@@ -58,6 +58,8 @@ void Camera::update(const Scene& scene, double timeStep)
 
 	// PRIMITIVE SELECTION AND MOVEMENT //
 
+	primitiveHasMoved = false;
+
 	if (windowRunner.mouseWasPressed(GLFW_MOUSE_BUTTON_RIGHT))
 	{
 		if (!isMovingPrimitive)
@@ -69,17 +71,10 @@ void Camera::update(const Scene& scene, double timeStep)
 			Ray ray;
 			bool isValid = getRay(pixelCoordinate, ray, 0.0);
 			Intersection intersection;
-			std::vector<Intersection> intersections;
 
 			if (isValid)
 			{
-				for (Primitive* primitive : scene.primitives.visible)
-				{
-					intersections.clear();
-					primitive->intersect(ray, intersection, intersections);
-				}
-
-				if (intersection.wasFound)
+				if (scene.intersect(ray, intersection))
 				{
 					isMovingPrimitive = true;
 					movingPrimitive = (intersection.instancePrimitive != nullptr) ? intersection.instancePrimitive : intersection.primitive;
@@ -117,6 +112,7 @@ void Camera::update(const Scene& scene, double timeStep)
 
 		scale *= (1.0 + windowRunner.getMouseWheelScroll() * 0.05);
 		movingPrimitive->transform(scale, rotate, translate);
+		primitiveHasMoved = true;
 	}
 
 	// LENS STUFF //
@@ -288,6 +284,11 @@ bool Camera::hasMoved() const
 	return cameraHasMoved;
 }
 
+bool Camera::hasMovedPrimitive() const
+{
+	return primitiveHasMoved;
+}
+
 CameraState Camera::getCameraState(double time) const
 {
 	if (!isTimeVariant)
@@ -40,6 +40,7 @@ namespace Raycer
 		void update(const Scene& scene, double timeStep);
 		void reset();
 		bool hasMoved() const;
+		bool hasMovedPrimitive() const;
 
 		CameraState getCameraState(double time) const;
 		bool getRay(const Vector2& pixelCoordinate, Ray& ray, double time) const;
@@ -77,6 +78,7 @@ namespace Raycer
 		bool cameraHasMoved = false;
 
 		bool isMovingPrimitive = false;
+		bool primitiveHasMoved = false;
 		Primitive* movingPrimitive = nullptr;
 
 		Vector3 originalPosition;
@@ -14,6 +14,7 @@ namespace Raycer
 {
 	class Primitive;
 
+	// intersect only records the hit, position, normal, onb and texcoord are filled by computeSurfaceData of surfacePrimitive
 	struct Intersection
 	{
 		bool wasFound = false;
@@ -25,5 +26,9 @@ namespace Raycer
 		CSGDirection direction = CSGDirection::IN;
 		Primitive* primitive = nullptr;
 		Primitive* instancePrimitive = nullptr;
+		Primitive* surfacePrimitive = nullptr;
+		Primitive* instancedSurfacePrimitive = nullptr; // surfacePrimitive of the instanced primitive, nullptr if already computed
+		Vector2 barycentric; // weights of the triangle vertices 1 and 2
+		uint64_t triangleIndex = 0; // triangle of a mesh
 	};
 }
@@ -0,0 +1,290 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#include "Raytracing/LightBVH.h"
+#include "Math/Vector3.h"
+
+using namespace Raycer;
+
+namespace
+{
+	const uint64_t MAX_LEAF_SIZE = 4;
+
+	double getAreaLightRadius(const PointLight& light)
+	{
+		return light.enableAreaLight ? light.areaLightRadius : 0.0;
+	}
+
+	double getPower(const PointLight& light)
+	{
+		return std::max(0.0, light.color.getLuminance() * light.intensity);
+	}
+
+	double getDistance(const AABB& aabb, const Vector3& position)
+	{
+		Vector3 min = aabb.getMin();
+		Vector3 max = aabb.getMax();
+
+		double dx = std::max(0.0, std::max(min.x - position.x, position.x - max.x));
+		double dy = std::max(0.0, std::max(min.y - position.y, position.y - max.y));
+		double dz = std::max(0.0, std::max(min.z - position.z, position.z - max.z));
+
+		return sqrt(dx * dx + dy * dy + dz * dz);
+	}
+
+	// same falloff as the shading, attenuated to zero at maxDistance
+	double getFalloff(double distance, double maxDistance, double attenuation)
+	{
+		if (distance >= maxDistance)
+			return 0.0;
+
+		return 1.0 - pow(distance / maxDistance, attenuation);
+	}
+}
+
+void LightBVH::build(const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+	lights.clear();
+	nodes.clear();
+
+	for (const PointLight& light : pointLights)
+		lights.push_back({ &light, false });
+
+	for (const SpotLight& light : spotLights)
+		lights.push_back({ &light, true });
+
+	if (!lights.empty())
+		buildNodes(0, lights.size());
+}
+
+void LightBVH::getLightsInRange(const Vector3& position, std::vector<LightBVHLight>& result) const
+{
+	result.clear();
+
+	if (nodes.empty())
+		return;
+
+	uint64_t stack[64];
+	uint64_t stackIndex = 0;
+
+	stack[stackIndex++] = 0;
+
+	while (stackIndex > 0)
+	{
+		uint64_t nodeIndex = stack[--stackIndex];
+		const LightBVHNode& node = nodes[nodeIndex];
+
+		if (getDistance(node.aabb, position) >= node.maxDistance)
+			continue;
+
+		if (node.rightOffset == 0)
+		{
+			for (uint64_t i = node.startOffset; i < node.startOffset + node.lightCount; ++i)
+			{
+				const PointLight& light = *lights[i].light;
+
+				if ((light.position - position).length() - getAreaLightRadius(light) < light.maxDistance)
+					result.push_back(lights[i]);
+			}
+
+			continue;
+		}
+
+		stack[stackIndex++] = nodeIndex + uint64_t(node.rightOffset);
+		stack[stackIndex++] = nodeIndex + 1;
+	}
+}
+
+bool LightBVH::sample(const Vector3& position, const Vector3& normal, std::mt19937& generator, LightBVHSample& result) const
+{
+	if (nodes.empty())
+		return false;
+
+	std::uniform_real_distribution<double> random(0.0, 1.0);
+
+	uint64_t nodeIndex = 0;
+	double probability = 1.0;
+
+	if (getImportance(nodes[0], position, normal) <= 0.0)
+		return false;
+
+	// the children are chosen in proportion to their importances
+	while (nodes[nodeIndex].rightOffset != 0)
+	{
+		uint64_t leftIndex = nodeIndex + 1;
+		uint64_t rightIndex = nodeIndex + uint64_t(nodes[nodeIndex].rightOffset);
+
+		double leftImportance = getImportance(nodes[leftIndex], position, normal);
+		double rightImportance = getImportance(nodes[rightIndex], position, normal);
+		double totalImportance = leftImportance + rightImportance;
+
+		if (totalImportance <= 0.0)
+			return false;
+
+		double leftProbability = leftImportance / totalImportance;
+
+		if (random(generator) < leftProbability)
+		{
+			nodeIndex = leftIndex;
+			probability *= leftProbability;
+		}
+		else
+		{
+			nodeIndex = rightIndex;
+			probability *= 1.0 - leftProbability;
+		}
+	}
+
+	const LightBVHNode& leaf = nodes[nodeIndex];
+
+	double importances[MAX_LEAF_SIZE];
+	double totalImportance = 0.0;
+
+	for (uint64_t i = 0; i < leaf.lightCount; ++i)
+	{
+		importances[i] = getImportance(lights[leaf.startOffset + i], position, normal);
+		totalImportance += importances[i];
+	}
+
+	if (totalImportance <= 0.0)
+		return false;
+
+	double threshold = random(generator) * totalImportance;
+	uint64_t selected = leaf.lightCount;
+
+	// the last light with a non-zero importance catches the rounding
+	for (uint64_t i = 0; i < leaf.lightCount; ++i)
+	{
+		if (importances[i] <= 0.0)
+			continue;
+
+		selected = i;
+
+		if (threshold < importances[i])
+			break;
+
+		threshold -= importances[i];
+	}
+
+	result.light = lights[leaf.startOffset + selected].light;
+	result.isSpotLight = lights[leaf.startOffset + selected].isSpotLight;
+	result.probability = probability * importances[selected] / totalImportance;
+
+	return true;
+}
+
+uint64_t LightBVH::getLightCount() const
+{
+	return lights.size();
+}
+
+uint64_t LightBVH::buildNodes(uint64_t start, uint64_t end)
+{
+	uint64_t nodeIndex = nodes.size();
+	nodes.push_back(LightBVHNode());
+
+	AABB nodeAABB;
+	AABB centroidAABB;
+	double power = 0.0;
+	double maxDistance = 0.0;
+	double attenuation = 0.0;
+
+	for (uint64_t i = start; i < end; ++i)
+	{
+		const PointLight& light = *lights[i].light;
+		double areaLightRadius = getAreaLightRadius(light);
+
+		nodeAABB.expand(AABB::createFromCenterExtent(light.position, Vector3(2.0, 2.0, 2.0) * areaLightRadius));
+		centroidAABB.expand(light.position);
+
+		power += getPower(light);
+		maxDistance = std::max(maxDistance, light.maxDistance);
+		attenuation = std::max(attenuation, light.attenuation);
+	}
+
+	nodes[nodeIndex].aabb = nodeAABB;
+	nodes[nodeIndex].power = power;
+	nodes[nodeIndex].maxDistance = maxDistance;
+	nodes[nodeIndex].attenuation = attenuation;
+	nodes[nodeIndex].rightOffset = 0;
+	nodes[nodeIndex].startOffset = start;
+	nodes[nodeIndex].lightCount = end - start;
+
+	if (end - start <= MAX_LEAF_SIZE)
+		return nodeIndex;
+
+	uint64_t axis = centroidAABB.getLargestAxis();
+	uint64_t middle = start + (end - start) / 2;
+
+	std::nth_element(lights.begin() + int64_t(start), lights.begin() + int64_t(middle), lights.begin() + int64_t(end), [axis](const LightBVHLight& l1, const LightBVHLight& l2)
+	{
+		return l1.light->position.get(axis) < l2.light->position.get(axis);
+	});
+
+	buildNodes(start, middle);
+	uint64_t rightIndex = buildNodes(middle, end);
+
+	nodes[nodeIndex].rightOffset = int64_t(rightIndex - nodeIndex);
+	nodes[nodeIndex].lightCount = 0;
+
+	return nodeIndex;
+}
+
+// the falloff is a bound over the whole node, and a node entirely behind the surface cannot light it
+double LightBVH::getImportance(const LightBVHNode& node, const Vector3& position, const Vector3& normal) const
+{
+	Vector3 min = node.aabb.getMin() - position;
+	Vector3 max = node.aabb.getMax() - position;
+
+	double maxCosineDistance = std::max(min.x * normal.x, max.x * normal.x) + std::max(min.y * normal.y, max.y * normal.y) + std::max(min.z * normal.z, max.z * normal.z);
+
+	if (maxCosineDistance <= 0.0)
+		return 0.0;
+
+	// the falloff at the nearest point keeps every reachable light possible, the one at the center follows the bulk of the lights
+	double nearestFalloff = getFalloff(getDistance(node.aabb, position), node.maxDistance, node.attenuation);
+	double centerFalloff = getFalloff((node.aabb.getCenter() - position).length(), node.maxDistance, node.attenuation);
+
+	return node.power * 0.5 * (nearestFalloff + centerFalloff);
+}
+
+double LightBVH::getImportance(const LightBVHLight& light, const Vector3& position, const Vector3& normal) const
+{
+	const PointLight& pointLight = *light.light;
+	double areaLightRadius = getAreaLightRadius(pointLight);
+	Vector3 positionToLight = pointLight.position - position;
+
+	if (positionToLight.dot(normal) <= -areaLightRadius)
+		return 0.0;
+
+	double sideAttenuation = 1.0;
+
+	// the area light jitter does not change the side attenuation, so it is the same as in the shading
+	if (light.isSpotLight)
+	{
+		const SpotLight& spotLight = static_cast<const SpotLight&>(pointLight);
+		sideAttenuation = spotLight.direction.dot(-positionToLight.normalized());
+
+		if (sideAttenuation <= 0.0)
+			return 0.0;
+
+		sideAttenuation = std::min(1.0, (1.0 - sideAttenuation) / (spotLight.angle / 180.0));
+		sideAttenuation = 1.0 - pow(sideAttenuation, spotLight.sideAttenuation);
+	}
+
+	double distanceToLight = positionToLight.length();
+	double cosine = 1.0;
+
+	// largest cosine over the sphere the area light positions are jittered in
+	if (distanceToLight > areaLightRadius)
+	{
+		double angle = acos(std::max(-1.0, std::min(1.0, positionToLight.dot(normal) / distanceToLight)));
+		cosine = cos(std::max(0.0, angle - asin(areaLightRadius / distanceToLight)));
+	}
+
+	double distance = std::max(0.0, distanceToLight - areaLightRadius);
+
+	return getPower(pointLight) * sideAttenuation * std::max(0.0, cosine) * getFalloff(distance, pointLight.maxDistance, pointLight.attenuation);
+}
@@ -0,0 +1,64 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "Raytracing/AABB.h"
+#include "Raytracing/Lights.h"
+
+namespace Raycer
+{
+	class Vector3;
+
+	struct LightBVHLight
+	{
+		const PointLight* light; // spot lights are point lights with a direction
+		bool isSpotLight;
+	};
+
+	struct LightBVHNode
+	{
+		AABB aabb; // positions of the lights, area lights included
+		double power; // sum of the light luminances
+		double maxDistance; // largest reach of the lights
+		double attenuation; // largest attenuation exponent, the falloff is bounded with it
+		int64_t rightOffset; // leaf if zero
+		uint64_t startOffset;
+		uint64_t lightCount;
+	};
+
+	struct LightBVHSample
+	{
+		const PointLight* light = nullptr;
+		bool isSpotLight = false;
+		double probability = 0.0;
+	};
+
+	// hierarchy of the point and spot lights, the lights can be culled by their reach or picked by their estimated contribution
+	class LightBVH
+	{
+	public:
+
+		void build(const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights);
+
+		// the lights whose maxDistance reaches the position, the others would be attenuated to zero anyway
+		void getLightsInRange(const Vector3& position, std::vector<LightBVHLight>& result) const;
+
+		// one light picked in proportion to a bound of its contribution, false if none of the lights can reach the point
+		bool sample(const Vector3& position, const Vector3& normal, std::mt19937& generator, LightBVHSample& result) const;
+
+		uint64_t getLightCount() const;
+
+	private:
+
+		uint64_t buildNodes(uint64_t start, uint64_t end);
+		double getImportance(const LightBVHNode& node, const Vector3& position, const Vector3& normal) const;
+		double getImportance(const LightBVHLight& light, const Vector3& position, const Vector3& normal) const;
+
+		std::vector<LightBVHLight> lights;
+		std::vector<LightBVHNode> nodes;
+	};
+}
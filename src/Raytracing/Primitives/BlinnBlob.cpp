@@ -11,18 +11,74 @@
 #include "Raytracing/Material.h"
 #include "Math/ONB.h"
 #include "Math/Solver.h"
+#include "Utils/ScratchBuffer.h"
 
 using namespace Raycer;
 
+const double BlinnBlob::INFLUENCE_THRESHOLD = 0.001;
+
+namespace
+{
+	// a blob whose influence overlaps the ray, the distance to the blob center is sqrt((t - closestDistance)^2 + rayDistance2)
+	struct BlinnBlobCandidate
+	{
+		double enterDistance;
+		double exitDistance;
+		double closestDistance;
+		double rayDistance2;
+		double falloff;
+		double blobbiness;
+		double sign;
+	};
+
+	struct BlinnBlobInterval
+	{
+		double begin;
+		double end;
+	};
+
+	const uint64_t MAX_INTERVAL_STACK_SIZE = 128;
+
+	bool isInside(const AABB& aabb, const Vector3& point)
+	{
+		Vector3 min = aabb.getMin();
+		Vector3 max = aabb.getMax();
+
+		return (point.x >= min.x && point.y >= min.y && point.z >= min.z && point.x <= max.x && point.y <= max.y && point.z <= max.z);
+	}
+}
+
 void Raycer::BlinnBlob::initialize(const Scene& scene)
 {
 	(void)scene;
 
+	influences.clear();
+	nodes.clear();
+	aabb = AABB();
+	minInfluenceRadius = std::numeric_limits<double>::max();
+
 	for (const BlinnBlobDescription& blob : blobs)
 	{
+		// exp(blobbiness * (1 - distance / radius)) drops to the threshold at the influence radius
+		double influenceRadius = blob.radius * (1.0 + log(1.0 / INFLUENCE_THRESHOLD) / blob.blobbiness);
+
+		BlinnBlobInfluence influence;
+		influence.position = blob.position;
+		influence.radius2 = influenceRadius * influenceRadius;
+		influence.falloff = blob.blobbiness / blob.radius;
+		influence.blobbiness = blob.blobbiness;
+		influence.sign = blob.isNegative ? -1.0 : 1.0;
+
+		influences.push_back(influence);
+		minInfluenceRadius = std::min(minInfluenceRadius, influenceRadius);
+
+		// overlapping blobs can reach past their radii, but not past the influence
 		if (!blob.isNegative)
-			aabb.expand(AABB::createFromCenterExtent(blob.position, Vector3(blob.radius * 2.0, blob.radius * 2.0, blob.radius * 2.0)));
+			aabb.expand(AABB::createFromCenterExtent(blob.position, Vector3(2.0, 2.0, 2.0) * influenceRadius));
 	}
+
+	if (!influences.empty())
+		buildNodes(0, influences.size());
 }
 
 bool BlinnBlob::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
@@ -35,65 +91,168 @@ bool BlinnBlob::intersect(const Ray& ray, Intersection& intersection, std::vecto
 	if (ray.fastOcclusion && intersection.wasFound)
 		return true;
 
-	// evaluate the effect of all blobs at the given point of the ray
-	auto evaluate = [&](double t)
+	if (nodes.empty())
+		return false;
+
+	double beginLimit = std::max(ray.minDistance, 0.0);
+	double endLimit = std::min(ray.maxDistance, intersection.distance);
+
+	ScratchBuffer<BlinnBlobCandidate> candidateBuffer;
+	std::vector<BlinnBlobCandidate>& candidates = candidateBuffer.get();
+
+	double candidatesBegin = std::numeric_limits<double>::max();
+	double candidatesEnd = std::numeric_limits<double>::lowest();
+
+	uint64_t stack[64];
+	uint64_t stackptr = 0;
+
+	stack[stackptr++] = 0;
+
+	// only the blobs whose influence overlaps the ray range take part in the root search
+	while (stackptr > 0)
 	{
-		Vector3 point = ray.origin + t * ray.direction;
+		uint64_t nodeIndex = stack[--stackptr];
+		const BlinnBlobNode& node = nodes[nodeIndex];
+
+		if (!node.aabb.intersects(ray))
+			continue;
 
+		if (node.rightOffset != 0)
+		{
+			stack[stackptr++] = nodeIndex + uint64_t(node.rightOffset);
+			stack[stackptr++] = nodeIndex + 1;
+
+			continue;
+		}
+
+		for (uint64_t i = node.startOffset; i < node.startOffset + node.influenceCount; ++i)
+		{
+			const BlinnBlobInfluence& influence = influences[i];
+
+			Vector3 originToBlob = influence.position - ray.origin;
+			double closestDistance = originToBlob.dot(ray.direction);
+			double rayDistance2 = originToBlob.lengthSquared() - closestDistance * closestDistance;
+
+			if (rayDistance2 >= influence.radius2)
+				continue;
+
+			double halfChord = sqrt(influence.radius2 - rayDistance2);
+
+			BlinnBlobCandidate candidate;
+			candidate.enterDistance = closestDistance - halfChord;
+			candidate.exitDistance = closestDistance + halfChord;
+
+			if (candidate.exitDistance < beginLimit || candidate.enterDistance > endLimit)
+				continue;
+
+			candidate.closestDistance = closestDistance;
+			candidate.rayDistance2 = rayDistance2;
+			candidate.falloff = influence.falloff;
+			candidate.blobbiness = influence.blobbiness;
+			candidate.sign = influence.sign;
+
+			candidates.push_back(candidate);
+
+			candidatesBegin = std::min(candidatesBegin, candidate.enterDistance);
+			candidatesEnd = std::max(candidatesEnd, candidate.exitDistance);
+		}
+	}
+
+	double searchBegin = std::max(beginLimit, candidatesBegin);
+	double searchEnd = std::min(endLimit, candidatesEnd);
+
+	if (candidates.empty() || searchBegin >= searchEnd)
+		return false;
+
+	// sum of the blobs at the given point of the ray, 1.0 is the threshold
+	auto evaluate = [&](double t)
+	{
 		double sum = 0.0;
 
-		for (const BlinnBlobDescription& blob : blobs)
+		for (const BlinnBlobCandidate& candidate : candidates)
 		{
-			double distance = (point - blob.position).length();
-			sum += exp(-blob.blobbiness / blob.radius * distance + blob.blobbiness) * (blob.isNegative ? -1.0 : 1.0);
+			if (t < candidate.enterDistance || t > candidate.exitDistance)
+				continue;
+
+			double offset = t - candidate.closestDistance;
+			double distance = sqrt(offset * offset + candidate.rayDistance2);
+
+			sum += candidate.sign * exp(candidate.blobbiness - candidate.falloff * distance);
 		}
 
-		// 1.0 is the threshold and is defined to be one
 		return sum - 1.0;
 	};
 
-	std::vector<double> distances;
-	distances.reserve(blobs.size() * 3);
-
-	// TODO: doesn't work for negative blobs (the whole premise of finding bracket positions with simple sphere intersection is probably flawed)
-	// find bracketing positions for the root search
-	for (const BlinnBlobDescription& blob : blobs)
+	// bounds of the sum over a ray interval, each blob is strongest at the point closest to its center and weakest at the farther end
+	auto evaluateBounds = [&](double begin, double end, double& lower, double& upper)
 	{
-		Vector3 oMinusC = ray.origin - blob.position;
-		double a = 1.0;
-		double b = 2.0 * ray.direction.dot(oMinusC);
-		double c = oMinusC.dot(oMinusC) - blob.radius * blob.radius;
-		QuadraticResult result = Solver::findQuadraticRoots(a, b, c);
-
-		// if ray intersects the sphere
-		if (result.rootCount == 2 && result.roots[0] > 0.0)
+		lower = -1.0;
+		upper = -1.0;
+
+		for (const BlinnBlobCandidate& candidate : candidates)
 		{
-			distances.push_back(result.roots[0]);
-			distances.push_back(result.roots[1]);
-		}
+			if (candidate.exitDistance < begin || candidate.enterDistance > end)
+				continue;
 
-		// project sphere center to ray
-		Vector3 originToBlob = (blob.position - ray.origin);
-		double distance = originToBlob.dot(ray.direction);
+			double nearOffset = std::max(begin, std::min(candidate.closestDistance, end)) - candidate.closestDistance;
+			double farOffset = std::max(std::abs(begin - candidate.closestDistance), std::abs(end - candidate.closestDistance));
+			double maxContribution = exp(candidate.blobbiness - candidate.falloff * sqrt(nearOffset * nearOffset + candidate.rayDistance2));
+			double minContribution = 0.0;
 
-		if (distance > 0.0)
-			distances.push_back(distance);
-	}
+			// the influence may end inside the interval
+			if (candidate.enterDistance <= begin && candidate.exitDistance >= end)
+				minContribution = exp(candidate.blobbiness - candidate.falloff * sqrt(farOffset * farOffset + candidate.rayDistance2));
 
-	if (distances.size() == 0)
-		return false;
+			if (candidate.sign > 0.0)
+			{
+				lower += minContribution;
+				upper += maxContribution;
+			}
+			else
+			{
+				lower -= maxContribution;
+				upper -= minContribution;
+			}
+		}
+	};
 
-	std::sort(distances.begin(), distances.end());
-	double t = std::numeric_limits<double>::max();
+	bool startsInside = (evaluate(searchBegin) > 0.0);
+	double tolerance = minInfluenceRadius * 1.0e-3;
+	double t = 0.0;
 	bool wasFound = false;
 
-	// find the position where the function becomes positive and then solve the exact root/distance
-	for (double distance : distances)
+	BlinnBlobInterval intervalStack[MAX_INTERVAL_STACK_SIZE];
+	uint64_t intervalStackptr = 0;
+
+	intervalStack[intervalStackptr++] = { searchBegin, searchEnd };
+
+	// subdivide the range front to back, skipping the intervals where the bounds show that the sign cannot change
+	while (intervalStackptr > 0)
 	{
-		if (evaluate(distance) > 0.0)
+		BlinnBlobInterval interval = intervalStack[--intervalStackptr];
+
+		double lower, upper;
+		evaluateBounds(interval.begin, interval.end, lower, upper);
+
+		if (startsInside ? (lower > 0.0) : (upper < 0.0))
+			continue;
+
+		if (interval.end - interval.begin > tolerance && intervalStackptr < MAX_INTERVAL_STACK_SIZE - 2)
 		{
-			t = Solver::findRoot(evaluate, 0.0, distance, solverIterations);
+			double middle = (interval.begin + interval.end) / 2.0;
+
+			intervalStack[intervalStackptr++] = { middle, interval.end };
+			intervalStack[intervalStackptr++] = { interval.begin, middle };
+
+			continue;
+		}
+
+		// the sign at the interval begin is known to be the starting one
+		if ((evaluate(interval.end) > 0.0) != startsInside)
+		{
+			t = Solver::findRoot(evaluate, interval.begin, interval.end, solverIterations);
 			wasFound = true;
+
 			break;
 		}
 	}
@@ -107,32 +266,62 @@ bool BlinnBlob::intersect(const Ray& ray, Intersection& intersection, std::vecto
 	if (t > intersection.distance)
 		return false;
 
-	Vector3 ip = ray.origin + (t * ray.direction);
+	intersection.wasFound = true;
+	intersection.distance = t;
+	intersection.primitive = this;
+	intersection.surfacePrimitive = this;
+
+	return true;
+}
+
+void BlinnBlob::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	Vector3 ip = ray.origin + (intersection.distance * ray.direction);
 	Vector3 normal;
 
-	// calculate normal from gradient
-	for (const BlinnBlobDescription& blob : blobs)
+	uint64_t stack[64];
+	uint64_t stackptr = 0;
+
+	if (!nodes.empty())
+		stack[stackptr++] = 0;
+
+	// calculate normal from the gradient of the blobs reaching the point
+	while (stackptr > 0)
 	{
-		double distance = (blob.position - ip).length();
-		double temp1 = -blob.blobbiness / (blob.radius * distance) * (blob.isNegative ? -1.0 : 1.0);
-		double temp2 = exp(-blob.blobbiness / blob.radius * distance + blob.blobbiness);
+		uint64_t nodeIndex = stack[--stackptr];
+		const BlinnBlobNode& node = nodes[nodeIndex];
+
+		if (!isInside(node.aabb, ip))
+			continue;
+
+		if (node.rightOffset != 0)
+		{
+			stack[stackptr++] = nodeIndex + uint64_t(node.rightOffset);
+			stack[stackptr++] = nodeIndex + 1;
 
-		normal.x += temp1 * (ip.x - blob.position.x) * temp2;
-		normal.y += temp1 * (ip.y - blob.position.y) * temp2;
-		normal.z += temp1 * (ip.z - blob.position.z) * temp2;
+			continue;
+		}
+
+		for (uint64_t i = node.startOffset; i < node.startOffset + node.influenceCount; ++i)
+		{
+			const BlinnBlobInfluence& influence = influences[i];
+
+			Vector3 blobToPoint = ip - influence.position;
+			double distance2 = blobToPoint.lengthSquared();
+
+			if (distance2 > influence.radius2 || distance2 == 0.0)
+				continue;
+
+			double distance = sqrt(distance2);
+			normal += blobToPoint * (influence.sign * influence.falloff / distance * exp(influence.blobbiness - influence.falloff * distance));
+		}
 	}
 
-	normal *= -1.0;
 	normal.normalize();
 
-	intersection.wasFound = true;
-	intersection.distance = t;
-	intersection.primitive = this;
 	intersection.position = ip;
 	intersection.normal = material->invertNormal ? -normal : normal;
 	intersection.onb = ONB::fromNormal(intersection.normal);
-
-	return true;
 }
 
 AABB BlinnBlob::getAABB() const
@@ -146,3 +335,45 @@ void BlinnBlob::transform(const Vector3& scale, const EulerAngle& rotate, const
 	(void)rotate;
 	(void)translate;
 }
+
+// median split of the blob centers along the largest axis, the nodes are stored in depth first order
+uint64_t BlinnBlob::buildNodes(uint64_t start, uint64_t end)
+{
+	uint64_t nodeIndex = nodes.size();
+	nodes.push_back(BlinnBlobNode());
+
+	AABB nodeAABB;
+	AABB centroidAABB;
+
+	for (uint64_t i = start; i < end; ++i)
+	{
+		double influenceRadius = sqrt(influences[i].radius2);
+
+		nodeAABB.expand(AABB::createFromCenterExtent(influences[i].position, Vector3(2.0, 2.0, 2.0) * influenceRadius));
+		centroidAABB.expand(influences[i].position);
+	}
+
+	nodes[nodeIndex].aabb = nodeAABB;
+	nodes[nodeIndex].rightOffset = 0;
+	nodes[nodeIndex].startOffset = start;
+	nodes[nodeIndex].influenceCount = end - start;
+
+	if (end - start <= 4)
+		return nodeIndex;
+
+	uint64_t axis = centroidAABB.getLargestAxis();
+	uint64_t middle = start + (end - start) / 2;
+
+	std::nth_element(influences.begin() + int64_t(start), influences.begin() + int64_t(middle), influences.begin() + int64_t(end), [axis](const BlinnBlobInfluence& i1, const BlinnBlobInfluence& i2)
+	{
+		return i1.position.get(axis) < i2.position.get(axis);
+	});
+
+	buildNodes(start, middle);
+	uint64_t rightIndex = buildNodes(middle, end);
+
+	nodes[nodeIndex].rightOffset = int64_t(rightIndex - nodeIndex);
+	nodes[nodeIndex].influenceCount = 0;
+
+	return nodeIndex;
+}
@@ -34,6 +34,24 @@ namespace Raycer
 		}
 	};
 
+	// the field of a blob is cut off where it drops below the influence threshold
+	struct BlinnBlobInfluence
+	{
+		Vector3 position;
+		double radius2;
+		double falloff;
+		double blobbiness;
+		double sign;
+	};
+
+	struct BlinnBlobNode
+	{
+		AABB aabb;
+		int64_t rightOffset; // leaf if zero
+		uint64_t startOffset;
+		uint64_t influenceCount;
+	};
+
 	class BlinnBlob : public Primitive
 	{
 	public:
@@ -45,12 +63,21 @@ namespace Raycer
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
 
 		std::vector<BlinnBlobDescription> blobs;
 		uint64_t solverIterations = 16;
 
+		static const double INFLUENCE_THRESHOLD;
+
 	private:
 
+		uint64_t buildNodes(uint64_t start, uint64_t end);
+
+		std::vector<BlinnBlobInfluence> influences;
+		std::vector<BlinnBlobNode> nodes;
+		double minInfluenceRadius = 0.0;
+
 		friend class cereal::access;
 
 		template <class Archive>
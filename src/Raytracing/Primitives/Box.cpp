@@ -88,13 +88,12 @@ bool Box::intersect(const Ray& ray, Intersection& intersection, std::vector<Inte
 		tempIntersection.wasFound = true;
 		tempIntersection.distance = t;
 		tempIntersection.primitive = this;
-		tempIntersection.position = ray.origin + (t * ray.direction);
-		tempIntersection.normal = (direction == CSGDirection::IN) ? normal : -normal;
-		tempIntersection.normal = material->invertNormal ? -tempIntersection.normal : tempIntersection.normal;
-		tempIntersection.onb = ONB::fromNormal(tempIntersection.normal);
+		tempIntersection.surfacePrimitive = this;
 		tempIntersection.direction = direction;
 
-		// TODO: texcoord calculation
+		// the face and the side are known only here
+		tempIntersection.normal = (direction == CSGDirection::IN) ? normal : -normal;
+		tempIntersection.normal = material->invertNormal ? -tempIntersection.normal : tempIntersection.normal;
 
 		return tempIntersection;
 	};
@@ -121,6 +120,14 @@ bool Box::intersect(const Ray& ray, Intersection& intersection, std::vector<Inte
 	return true;
 }
 
+void Box::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	intersection.position = ray.origin + (intersection.distance * ray.direction);
+	intersection.onb = ONB::fromNormal(intersection.normal);
+
+	// TODO: texcoord calculation
+}
+
 AABB Box::getAABB() const
 {
 	return aabb;
@@ -28,6 +28,7 @@ namespace Raycer
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
 
 		Vector3 position;
 		Vector3 extent;
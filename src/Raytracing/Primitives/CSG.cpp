@@ -9,25 +9,41 @@
 #include "Raytracing/Intersection.h"
 #include "Raytracing/AABB.h"
 #include "Raytracing/Material.h"
+#include "Utils/ScratchBuffer.h"
 
 using namespace Raycer;
 
 namespace
 {
-	struct CSGPoint
+	bool isInside(CSGOperation operation, bool leftIsInside, bool rightIsInside)
 	{
-		Intersection intersection;
-		CSGSide side;
-		CSGDirection direction;
-	};
+		switch (operation)
+		{
+			case CSGOperation::UNION: return leftIsInside || rightIsInside;
+			case CSGOperation::DIFFERENCE: return leftIsInside && !rightIsInside;
+			case CSGOperation::INTERSECTION: return leftIsInside && rightIsInside;
+			default: return false;
+		}
+	}
+
+	// the primitives and nested CSGs emit their points in order, this only guards against ones that do not
+	void ensureOrder(std::vector<Intersection>& intersections)
+	{
+		auto compare = [](const Intersection& i1, const Intersection& i2)
+		{
+			return i1.distance < i2.distance;
+		};
+
+		if (!std::is_sorted(intersections.begin(), intersections.end(), compare))
+			std::sort(intersections.begin(), intersections.end(), compare);
+	}
 }
 
 void Raycer::CSG::initialize(const Scene& scene)
 {
 	(void)scene;
 
-	aabb.expand(leftPrimitive->getAABB());
-	aabb.expand(rightPrimitive->getAABB());
+	updateAABB();
 }
 
 bool CSG::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
@@ -38,115 +54,94 @@ bool CSG::intersect(const Ray& ray, Intersection& intersection, std::vector<Inte
 	if (ray.fastOcclusion && intersection.wasFound)
 		return true;
 
+	// nothing behind the origin can change the state in front of it, so a missed box skips the whole tree
+	if (!aabb.intersects(ray))
+		return false;
+
 	Intersection leftIntersection;
 	Intersection rightIntersection;
 
-	std::vector<Intersection> leftIntersections;
-	std::vector<Intersection> rightIntersections;
-	std::vector<CSGPoint> csgPoints;
+	ScratchBuffer<Intersection> leftIntersectionBuffer;
+	ScratchBuffer<Intersection> rightIntersectionBuffer;
 
-	leftPrimitive->intersect(ray, leftIntersection, leftIntersections);
-	rightPrimitive->intersect(ray, rightIntersection, rightIntersections);
+	std::vector<Intersection>& leftIntersections = leftIntersectionBuffer.get();
+	std::vector<Intersection>& rightIntersections = rightIntersectionBuffer.get();
 
-	for (const Intersection& tempIntersection : leftIntersections)
-	{
-		CSGPoint csgPoint;
+	Ray csgRay = ray;
+	csgRay.collectAllIntersections = true;
 
-		csgPoint.intersection = tempIntersection;
-		csgPoint.side = CSGSide::LEFT;
-		csgPoint.direction = tempIntersection.direction;
+	leftPrimitive->intersect(csgRay, leftIntersection, leftIntersections);
 
-		csgPoints.push_back(csgPoint);
-	}
+	// only a union can be inside without the left side
+	if (leftIntersections.empty() && operation != CSGOperation::UNION)
+		return false;
 
-	for (const Intersection& tempIntersection : rightIntersections)
-	{
-		CSGPoint csgPoint;
+	rightPrimitive->intersect(csgRay, rightIntersection, rightIntersections);
 
-		csgPoint.intersection = tempIntersection;
-		csgPoint.side = CSGSide::RIGHT;
-		csgPoint.direction = tempIntersection.direction;
+	ensureOrder(leftIntersections);
+	ensureOrder(rightIntersections);
 
-		csgPoints.push_back(csgPoint);
-	}
+	uint64_t leftIndex = 0;
+	uint64_t rightIndex = 0;
+	uint64_t leftCount = leftIntersections.size();
+	uint64_t rightCount = rightIntersections.size();
 
-	std::sort(csgPoints.begin(), csgPoints.end(), [](const CSGPoint& p1, const CSGPoint& p2)
+	bool leftIsInside = false;
+	bool rightIsInside = false;
+	bool csgIsInside = false;
+	bool wasFound = false;
+
+	// merge the two ordered lists, only the points where the combined state changes are on the surface of the CSG
+	while (leftIndex < leftCount || rightIndex < rightCount)
 	{
-		return p1.intersection.distance < p2.intersection.distance;
-	});
+		bool isLeft = (rightIndex == rightCount) || (leftIndex < leftCount && leftIntersections[leftIndex].distance <= rightIntersections[rightIndex].distance);
+		const Intersection& point = isLeft ? leftIntersections[leftIndex++] : rightIntersections[rightIndex++];
 
-	CSGDirection leftDirection = CSGDirection::OUT;
-	CSGDirection rightDirection = CSGDirection::OUT;
+		if (isLeft)
+			leftIsInside = (point.direction == CSGDirection::IN);
+		else
+			rightIsInside = (point.direction == CSGDirection::IN);
 
-	for (const CSGPoint& csgPoint : csgPoints)
-	{
-		if (csgPoint.side == CSGSide::LEFT)
-			leftDirection = csgPoint.direction;
-		else if (csgPoint.side == CSGSide::RIGHT)
-			rightDirection = csgPoint.direction;
+		bool newIsInside = isInside(operation, leftIsInside, rightIsInside);
 
-		CSGDirection newDirection = CSGDirection::OUT;
+		if (newIsInside == csgIsInside)
+			continue;
 
-		if (operation == CSGOperation::UNION)
-		{
-			if (leftDirection == CSGDirection::IN && rightDirection == CSGDirection::IN)
-				newDirection = CSGDirection::IN;
-			else if (leftDirection == CSGDirection::IN && rightDirection == CSGDirection::OUT)
-				newDirection = CSGDirection::IN;
-			else if (leftDirection == CSGDirection::OUT && rightDirection == CSGDirection::IN)
-				newDirection = CSGDirection::IN;
-			else if (leftDirection == CSGDirection::OUT && rightDirection == CSGDirection::OUT)
-				newDirection = CSGDirection::OUT;
-		}
-		else if (operation == CSGOperation::DIFFERENCE)
-		{
-			if (leftDirection == CSGDirection::IN && rightDirection == CSGDirection::IN)
-				newDirection = CSGDirection::OUT;
-			else if (leftDirection == CSGDirection::IN && rightDirection == CSGDirection::OUT)
-				newDirection = CSGDirection::IN;
-			else if (leftDirection == CSGDirection::OUT && rightDirection == CSGDirection::IN)
-				newDirection = CSGDirection::OUT;
-			else if (leftDirection == CSGDirection::OUT && rightDirection == CSGDirection::OUT)
-				newDirection = CSGDirection::OUT;
-		}
-		else if (operation == CSGOperation::INTERSECTION)
+		csgIsInside = newIsInside;
+		CSGDirection direction = csgIsInside ? CSGDirection::IN : CSGDirection::OUT;
+
+		if (ray.collectAllIntersections)
 		{
-			if (leftDirection == CSGDirection::IN && rightDirection == CSGDirection::IN)
-				newDirection = CSGDirection::IN;
-			else if (leftDirection == CSGDirection::IN && rightDirection == CSGDirection::OUT)
-				newDirection = CSGDirection::OUT;
-			else if (leftDirection == CSGDirection::OUT && rightDirection == CSGDirection::IN)
-				newDirection = CSGDirection::OUT;
-			else if (leftDirection == CSGDirection::OUT && rightDirection == CSGDirection::OUT)
-				newDirection = CSGDirection::OUT;
+			intersections.push_back(point);
+			intersections.back().direction = direction;
 		}
 
-		Intersection tempIntersection = csgPoint.intersection;
-		tempIntersection.direction = newDirection;
-		intersections.push_back(tempIntersection);
-	}
+		if (wasFound)
+			continue;
 
-	for (const Intersection& tempIntersection : intersections)
-	{
-		if (tempIntersection.direction == CSGDirection::IN)
-		{
-			double t = tempIntersection.distance;
-
-			if (t < ray.minDistance || t > ray.maxDistance)
-				return false;
+		double t = point.distance;
 
-			if (t > intersection.distance)
-				return false;
+		if (t < ray.minDistance || t < 0.0)
+			continue;
 
-			if (t < 0.0)
-				return false;
+		// the rest are even farther
+		if (t > ray.maxDistance || t > intersection.distance)
+		{
+			if (ray.collectAllIntersections)
+				continue;
 
-			intersection = tempIntersection;
-			return true;
+			break;
 		}
+
+		intersection = point;
+		intersection.direction = direction;
+		wasFound = true;
+
+		if (!ray.collectAllIntersections)
+			break;
 	}
 
-	return false;
+	return wasFound;
 }
 
 AABB CSG::getAABB() const
@@ -159,7 +154,25 @@ void CSG::transform(const Vector3& scale, const EulerAngle& rotate, const Vector
 	leftPrimitive->transform(scale, rotate, translate);
 	rightPrimitive->transform(scale, rotate, translate);
 
-	aabb = AABB();
-	aabb.expand(leftPrimitive->getAABB());
-	aabb.expand(rightPrimitive->getAABB());
+	updateAABB();
+}
+
+void CSG::updateAABB()
+{
+	AABB leftAABB = leftPrimitive->getAABB();
+	AABB rightAABB = rightPrimitive->getAABB();
+
+	// a difference or an intersection cannot reach outside the left side
+	aabb = leftAABB;
+
+	if (operation == CSGOperation::UNION)
+		aabb.expand(rightAABB);
+	else if (operation == CSGOperation::INTERSECTION)
+	{
+		Vector3 min = Vector3(std::max(leftAABB.getMin().x, rightAABB.getMin().x), std::max(leftAABB.getMin().y, rightAABB.getMin().y), std::max(leftAABB.getMin().z, rightAABB.getMin().z));
+		Vector3 max = Vector3(std::min(leftAABB.getMax().x, rightAABB.getMax().x), std::min(leftAABB.getMax().y, rightAABB.getMax().y), std::min(leftAABB.getMax().z, rightAABB.getMax().z));
+
+		if (min.x <= max.x && min.y <= max.y && min.z <= max.z)
+			aabb = AABB::createFromMinMax(min, max);
+	}
 }
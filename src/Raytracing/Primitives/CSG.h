@@ -42,6 +42,8 @@ namespace Raycer
 
 	private:
 
+		void updateAABB();
+
 		Primitive* leftPrimitive = nullptr;
 		Primitive* rightPrimitive = nullptr;
 
@@ -51,6 +51,7 @@ bool Cylinder::intersect(const Ray& ray, Intersection& intersection, std::vector
 		if (ip.y < 0.0 || ip.y > height)
 			return tempIntersection;
 
+		// CSG can change the direction later, the side is resolved here
 		Vector3 normal = Vector3(ip.x, 0.0, ip.z).normalized();
 
 		if (direction == CSGDirection::OUT)
@@ -59,9 +60,8 @@ bool Cylinder::intersect(const Ray& ray, Intersection& intersection, std::vector
 		tempIntersection.wasFound = true;
 		tempIntersection.distance = t;
 		tempIntersection.primitive = this;
-		tempIntersection.position = ip;
+		tempIntersection.surfacePrimitive = this;
 		tempIntersection.normal = material->invertNormal ? -normal : normal;
-		tempIntersection.onb = ONB::fromNormal(tempIntersection.normal);
 		tempIntersection.direction = direction;
 
 		return tempIntersection;
@@ -112,6 +112,12 @@ bool Cylinder::intersect(const Ray& ray, Intersection& intersection, std::vector
 		return false;
 }
 
+void Cylinder::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	intersection.position = ray.origin + (intersection.distance * ray.direction);
+	intersection.onb = ONB::fromNormal(intersection.normal);
+}
+
 AABB Cylinder::getAABB() const
 {
 	return aabb;
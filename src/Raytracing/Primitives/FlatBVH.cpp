@@ -4,217 +4,2398 @@
 #include "stdafx.h"
 
 #include "Raytracing/Primitives/FlatBVH.h"
+#include "Raytracing/Primitives/Triangle.h"
+#include "Raytracing/Primitives/TriangleMesh.h"
 #include "Raytracing/Scene.h"
 #include "Raytracing/Ray.h"
 #include "Raytracing/Intersection.h"
 #include "App.h"
+#include "Settings.h"
 #include "Utils/Log.h"
 #include "Math/Vector3.h"
 #include "Math/EulerAngle.h"
+#include "Math/Matrix4x4.h"
 
 using namespace Raycer;
 
+namespace
+{
+	// smaller subtrees are built by a single task
+	const uint64_t PARALLEL_BUILD_MIN_PRIMITIVES = 4096;
+
+	// spatial splits are only tried if the object split children overlap more than this fraction of the root area
+	const double SPATIAL_SPLIT_MIN_OVERLAP = 1.0e-5;
+
+	// leafs of the subtrees optimized by the treelet restructuring
+	const uint64_t TREELET_SIZE = 7;
+
+	// primitivePackets value of the ordered primitives that are not the first triangle of a packet
+	const uint32_t NO_TRIANGLE_PACKET = std::numeric_limits<uint32_t>::max();
+
+	// qbvhFlatIndices value of the empty qbvh child slots
+	const uint32_t NO_QBVH_CHILD = std::numeric_limits<uint32_t>::max();
+
+	// nodes down to this depth are used for transformed bounds
+	const uint64_t TRANSFORMED_AABB_DEPTH = 3;
+
+	// increase when the cache file layout or the build algorithm changes
+	const uint64_t CACHE_FILE_MAGIC = 0x4856424352594152; // "RAYRCBVH"
+	const uint64_t CACHE_FILE_VERSION = 1;
+
+	struct FlatBVHCacheHeader
+	{
+		uint64_t magic;
+		uint64_t version;
+		uint64_t cacheKey;
+		uint64_t nodeSize;
+		uint64_t nodeCount;
+		uint64_t primitiveCount;
+	};
+
+	int32_t getBuildThreadCount()
+	{
+		Settings& settings = App::getSettings();
+		int32_t threadCount = (settings.general.bvhBuildThreadCount > 0) ? settings.general.bvhBuildThreadCount : omp_get_max_threads();
+
+		return std::max(1, threadCount);
+	}
+
+	// spatial splits can reference primitives more than once
+	uint64_t getReferenceCount(const std::vector<FlatBVHNode>& flatNodes)
+	{
+		uint64_t referenceCount = 0;
+
+		for (const FlatBVHNode& flatNode : flatNodes)
+		{
+			if (flatNode.rightOffset == 0)
+				referenceCount = std::max(referenceCount, flatNode.startOffset + flatNode.primitiveCount);
+		}
+
+		return referenceCount;
+	}
+
+	// FNV-1a
+	uint64_t hashBytes(uint64_t hash, const void* data, uint64_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+		for (uint64_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	template <typename T>
+	uint64_t hashValue(uint64_t hash, const T& value)
+	{
+		return hashBytes(hash, &value, sizeof(T));
+	}
+
+	// the tree depends on the build parameters, the primitive bounds and with spatial splits also on the triangle vertices
+	uint64_t calculateCacheKey(const std::vector<Primitive*>& primitives, const BVHBuildInfo& buildInfo)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+
+		hash = hashValue(hash, CACHE_FILE_VERSION);
+		hash = hashValue(hash, buildInfo.maxLeafSize);
+		hash = hashValue(hash, buildInfo.useSAH);
+		hash = hashValue(hash, buildInfo.useBinnedSAH);
+		hash = hashValue(hash, buildInfo.sahBinCount);
+		hash = hashValue(hash, buildInfo.regularSAHSplits);
+		hash = hashValue(hash, buildInfo.axisSelection);
+		hash = hashValue(hash, buildInfo.axisSplit);
+		hash = hashValue(hash, buildInfo.useSpatialSplits);
+		hash = hashValue(hash, buildInfo.spatialSplitBudget);
+		hash = hashValue(hash, buildInfo.useLinearBuild);
+		hash = hashValue(hash, buildInfo.treeletRestructurePasses);
+		hash = hashValue(hash, uint64_t(primitives.size()));
+
+		for (const Primitive* primitive : primitives)
+		{
+			AABB primitiveAABB = primitive->getAABB();
+			Vector3 min = primitiveAABB.getMin();
+			Vector3 max = primitiveAABB.getMax();
+
+			hash = hashValue(hash, primitive->id);
+			hash = hashValue(hash, min.x);
+			hash = hashValue(hash, min.y);
+			hash = hashValue(hash, min.z);
+			hash = hashValue(hash, max.x);
+			hash = hashValue(hash, max.y);
+			hash = hashValue(hash, max.z);
+
+			// spatial splits clip the triangles -> the same bounds can give a different tree
+			const Triangle* triangle = buildInfo.useSpatialSplits ? dynamic_cast<const Triangle*>(primitive) : nullptr;
+
+			if (triangle != nullptr)
+			{
+				for (const Vector3& vertex : triangle->vertices)
+				{
+					hash = hashValue(hash, vertex.x);
+					hash = hashValue(hash, vertex.y);
+					hash = hashValue(hash, vertex.z);
+				}
+			}
+		}
+
+		return hash;
+	}
+
+	// removes the least recently used cache files until the directory fits in the maximum size, loading a file marks it used
+	void trimCache(const boost::filesystem::path& cacheDirectory, const boost::filesystem::path& currentFile, uint64_t maxSize)
+	{
+		struct CacheFile
+		{
+			boost::filesystem::path path;
+			std::time_t lastWriteTime;
+			uint64_t size;
+		};
+
+		std::vector<CacheFile> cacheFiles;
+		uint64_t totalSize = 0;
+		boost::system::error_code error;
+
+		for (boost::filesystem::directory_iterator it(cacheDirectory, error), end; !error && it != end; it.increment(error))
+		{
+			boost::filesystem::path path = it->path();
+
+			if (path.extension() != ".bin" || path.filename().string().compare(0, 4, "bvh_") != 0 || !boost::filesystem::is_regular_file(path, error))
+				continue;
+
+			CacheFile cacheFile;
+			cacheFile.path = path;
+			cacheFile.lastWriteTime = boost::filesystem::last_write_time(path, error);
+			cacheFile.size = uint64_t(boost::filesystem::file_size(path, error));
+
+			if (error)
+				continue;
+
+			totalSize += cacheFile.size;
+
+			// the file just saved is always kept
+			if (!boost::filesystem::equivalent(path, currentFile, error))
+				cacheFiles.push_back(cacheFile);
+		}
+
+		std::sort(cacheFiles.begin(), cacheFiles.end(), [](const CacheFile& f1, const CacheFile& f2)
+		{
+			return f1.lastWriteTime < f2.lastWriteTime;
+		});
+
+		for (const CacheFile& cacheFile : cacheFiles)
+		{
+			if (totalSize <= maxSize)
+				break;
+
+			if (boost::filesystem::remove(cacheFile.path, error))
+				totalSize -= cacheFile.size;
+		}
+	}
+
+	bool isEmpty(const AABB& aabb)
+	{
+		Vector3 min = aabb.getMin();
+		Vector3 max = aabb.getMax();
+
+		return (min.x > max.x || min.y > max.y || min.z > max.z);
+	}
+
+	// empty bounds have a huge surface area otherwise
+	double getSurfaceArea(const AABB& aabb)
+	{
+		return isEmpty(aabb) ? 0.0 : aabb.getSurfaceArea();
+	}
+
+	AABB intersectAABBs(const AABB& aabb1, const AABB& aabb2)
+	{
+		Vector3 min1 = aabb1.getMin();
+		Vector3 max1 = aabb1.getMax();
+		Vector3 min2 = aabb2.getMin();
+		Vector3 max2 = aabb2.getMax();
+
+		Vector3 min(std::max(min1.x, min2.x), std::max(min1.y, min2.y), std::max(min1.z, min2.z));
+		Vector3 max(std::min(max1.x, max2.x), std::min(max1.y, max2.y), std::min(max1.z, max2.z));
+
+		return AABB::createFromMinMax(min, max);
+	}
+
+	AABB calculateAABB(const std::vector<FlatBVHReference>& references)
+	{
+		AABB aabb;
+
+		for (const FlatBVHReference& reference : references)
+			aabb.expand(reference.aabb);
+
+		return aabb;
+	}
+
+	// binary tree from the linear build, leafs have a single primitive
+	struct LinearBVHNode
+	{
+		AABB aabb;
+		int64_t left;
+		int64_t right;
+		uint64_t primitiveIndex;
+		uint64_t primitiveCount;
+		double cost;
+	};
+
+	uint64_t countLeadingZeros(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return 63 - uint64_t(index);
+#else
+		return uint64_t(__builtin_clzll(value));
+#endif
+	}
+
+	// spread the lowest 10 bits to every third bit
+	uint32_t expandMortonBits(uint32_t value)
+	{
+		value = (value * 0x00010001u) & 0xFF0000FFu;
+		value = (value * 0x00000101u) & 0x0F00F00Fu;
+		value = (value * 0x00000011u) & 0xC30C30C3u;
+		value = (value * 0x00000005u) & 0x49249249u;
+
+		return value;
+	}
+
+	// stable least significant digit sort of the upper 32 bits, one histogram per thread
+	void radixSort(std::vector<uint64_t>& keys, int32_t threadCount)
+	{
+		std::vector<uint64_t> sortedKeys(keys.size());
+		std::vector<uint64_t> offsets(uint64_t(threadCount) * 256);
+
+		for (uint64_t shift = 32; shift < 64; shift += 8)
+		{
+			#pragma omp parallel num_threads(threadCount)
+			{
+				uint64_t thread = uint64_t(omp_get_thread_num());
+				uint64_t threads = uint64_t(omp_get_num_threads());
+				uint64_t start = keys.size() * thread / threads;
+				uint64_t end = keys.size() * (thread + 1) / threads;
+				uint64_t* histogram = &offsets[thread * 256];
+
+				std::fill(histogram, histogram + 256, uint64_t(0));
+
+				for (uint64_t i = start; i < end; ++i)
+					histogram[(keys[i] >> shift) & 0xff]++;
+
+				#pragma omp barrier
+
+				#pragma omp single
+				{
+					uint64_t sum = 0;
+
+					for (uint64_t digit = 0; digit < 256; ++digit)
+					{
+						for (uint64_t i = 0; i < threads; ++i)
+						{
+							uint64_t count = offsets[i * 256 + digit];
+							offsets[i * 256 + digit] = sum;
+							sum += count;
+						}
+					}
+				}
+
+				for (uint64_t i = start; i < end; ++i)
+					sortedKeys[histogram[(keys[i] >> shift) & 0xff]++] = keys[i];
+			}
+
+			keys.swap(sortedKeys);
+		}
+	}
+
+	// rebuild the treelet topology from the optimal partitions, internal nodes are reused
+	uint64_t emitTreelet(std::vector<LinearBVHNode>& nodes, const uint64_t* treeletLeafs, const uint8_t* partitions, const uint64_t* treeletInternals, uint64_t& internalIndex, uint64_t subset)
+	{
+		uint64_t leafIndex = 0;
+
+		// single leaf
+		if ((subset & (subset - 1)) == 0)
+		{
+			while ((subset >> leafIndex) != 1)
+				leafIndex++;
+
+			return treeletLeafs[leafIndex];
+		}
+
+		uint64_t nodeIndex = treeletInternals[internalIndex++];
+		uint64_t leftIndex = emitTreelet(nodes, treeletLeafs, partitions, treeletInternals, internalIndex, partitions[subset]);
+		uint64_t rightIndex = emitTreelet(nodes, treeletLeafs, partitions, treeletInternals, internalIndex, subset ^ partitions[subset]);
+
+		LinearBVHNode& node = nodes[nodeIndex];
+		node.left = int64_t(leftIndex);
+		node.right = int64_t(rightIndex);
+		node.aabb = nodes[leftIndex].aabb;
+		node.aabb.expand(nodes[rightIndex].aabb);
+		node.primitiveCount = nodes[leftIndex].primitiveCount + nodes[rightIndex].primitiveCount;
+		node.cost = node.aabb.getSurfaceArea() + nodes[leftIndex].cost + nodes[rightIndex].cost;
+
+		return nodeIndex;
+	}
+
+	// Karras and Aila 2013, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies"
+	// finds the SAH optimal topology of the treelet below the node with dynamic programming over the leaf subsets
+	void restructureTreelet(std::vector<LinearBVHNode>& nodes, uint64_t rootIndex)
+	{
+		uint64_t treeletLeafs[TREELET_SIZE];
+		uint64_t treeletInternals[TREELET_SIZE - 1];
+		uint64_t leafCount = 2;
+		uint64_t internalCount = 1;
+
+		treeletLeafs[0] = uint64_t(nodes[rootIndex].left);
+		treeletLeafs[1] = uint64_t(nodes[rootIndex].right);
+		treeletInternals[0] = rootIndex;
+
+		// grow the treelet by expanding the largest inner node
+		while (leafCount < TREELET_SIZE)
+		{
+			uint64_t largestIndex = leafCount;
+			double largestArea = -1.0;
+
+			for (uint64_t i = 0; i < leafCount; ++i)
+			{
+				const LinearBVHNode& node = nodes[treeletLeafs[i]];
+
+				if (node.left >= 0 && node.aabb.getSurfaceArea() > largestArea)
+				{
+					largestIndex = i;
+					largestArea = node.aabb.getSurfaceArea();
+				}
+			}
+
+			if (largestIndex == leafCount)
+				break;
+
+			const LinearBVHNode& node = nodes[treeletLeafs[largestIndex]];
+			treeletInternals[internalCount++] = treeletLeafs[largestIndex];
+			treeletLeafs[largestIndex] = uint64_t(node.left);
+			treeletLeafs[leafCount++] = uint64_t(node.right);
+		}
+
+		// two leafs have only one topology
+		if (leafCount < 3)
+			return;
+
+		uint64_t subsetCount = uint64_t(1) << leafCount;
+		double costs[1 << TREELET_SIZE];
+		uint8_t partitions[1 << TREELET_SIZE];
+
+		// subsets are always processed after their own subsets
+		for (uint64_t subset = 1; subset < subsetCount; ++subset)
+		{
+			AABB subsetAABB;
+
+			for (uint64_t i = 0; i < leafCount; ++i)
+			{
+				if (subset & (uint64_t(1) << i))
+					subsetAABB.expand(nodes[treeletLeafs[i]].aabb);
+			}
+
+			if ((subset & (subset - 1)) == 0)
+			{
+				for (uint64_t i = 0; i < leafCount; ++i)
+				{
+					if (subset == (uint64_t(1) << i))
+						costs[subset] = nodes[treeletLeafs[i]].cost;
+				}
+
+				continue;
+			}
+
+			double lowestCost = std::numeric_limits<double>::max();
+
+			for (uint64_t partition = (subset - 1) & subset; partition > 0; partition = (partition - 1) & subset)
+			{
+				double cost = costs[partition] + costs[subset ^ partition];
+
+				if (cost < lowestCost)
+				{
+					lowestCost = cost;
+					partitions[subset] = uint8_t(partition);
+				}
+			}
+
+			costs[subset] = subsetAABB.getSurfaceArea() + lowestCost;
+		}
+
+		// ignore rounding differences of the same topology
+		if (costs[subsetCount - 1] >= nodes[rootIndex].cost * (1.0 - 1.0e-9))
+			return;
+
+		uint64_t internalIndex = 0;
+		emitTreelet(nodes, treeletLeafs, partitions, treeletInternals, internalIndex, subsetCount - 1);
+	}
+
+	float roundDown(double value)
+	{
+		float result = float(value);
+
+		if (double(result) > value)
+			result = std::nextafter(result, std::numeric_limits<float>::lowest());
+
+		return result;
+	}
+
+	float roundUp(double value)
+	{
+		float result = float(value);
+
+		if (double(result) < value)
+			result = std::nextafter(result, std::numeric_limits<float>::max());
+
+		return result;
+	}
+
+	void setCompactNodeBounds(FlatBVHCompactNode& compactNode, const AABB& aabb)
+	{
+		Vector3 min = aabb.getMin();
+		Vector3 max = aabb.getMax();
+
+		for (uint64_t axis = 0; axis < 3; ++axis)
+		{
+			compactNode.min[axis] = roundDown(min.get(axis));
+			compactNode.max[axis] = roundUp(max.get(axis));
+		}
+	}
+
+	void setQBVHChildBounds(FlatQBVHNode& qbvhNode, uint64_t child, const AABB& aabb)
+	{
+		Vector3 min = aabb.getMin();
+		Vector3 max = aabb.getMax();
+
+		for (uint64_t axis = 0; axis < 3; ++axis)
+		{
+			qbvhNode.bounds[axis][child] = roundDown(min.get(axis));
+			qbvhNode.bounds[axis + 3][child] = roundUp(max.get(axis));
+		}
+	}
+
+	// float copy of the ray for the node bounds tests
+	struct FlatBVHRay
+	{
+		explicit FlatBVHRay(const Ray& ray)
+		{
+			for (uint64_t axis = 0; axis < 3; ++axis)
+			{
+				float direction = float(ray.direction.get(axis));
+
+				// avoid infinities and NaNs in the slab test
+				if (std::abs(direction) < 1.0e-20f)
+					direction = std::copysign(1.0e-20f, direction);
+
+				origin[axis] = float(ray.origin.get(axis));
+				inverseDirection[axis] = 1.0f / direction;
+				isNegative[axis] = (inverseDirection[axis] < 0.0f);
+			}
+		}
+
+		float origin[3];
+		float inverseDirection[3];
+		bool isNegative[3];
+	};
+
+	// compensate for the float rounding of the ray so that no boxes are missed
+	const float FAR_DISTANCE_SCALE = 1.0f + 1.0e-5f;
+	const double NEAR_DISTANCE_SCALE = 1.0 - 1.0e-5;
+
+	bool intersects(const FlatBVHCompactNode& node, const FlatBVHRay& ray, float& tNear)
+	{
+		float tFar = std::numeric_limits<float>::max();
+		tNear = 0.0f;
+
+		for (uint64_t axis = 0; axis < 3; ++axis)
+		{
+			float near = ray.isNegative[axis] ? node.max[axis] : node.min[axis];
+			float far = ray.isNegative[axis] ? node.min[axis] : node.max[axis];
+
+			tNear = std::max(tNear, (near - ray.origin[axis]) * ray.inverseDirection[axis]);
+			tFar = std::min(tFar, (far - ray.origin[axis]) * ray.inverseDirection[axis]);
+		}
+
+		return tNear <= tFar * FAR_DISTANCE_SCALE;
+	}
+
+	// nodes starting beyond the closest intersection so far cannot contain a closer one
+	bool isBeyond(float tNear, const Ray& ray, const Intersection& intersection)
+	{
+		if (ray.collectAllIntersections)
+			return false;
+
+		return double(tNear) * NEAR_DISTANCE_SCALE > std::min(intersection.distance, ray.maxDistance);
+	}
+
+	// occlusion queries only have the ray range
+	bool isBeyond(float tNear, const Ray& ray)
+	{
+		return double(tNear) * NEAR_DISTANCE_SCALE > ray.maxDistance;
+	}
+
+	// broadcast copy of the ray for the four child boxes of a QBVH node
+	struct FlatQBVHRay
+	{
+		explicit FlatQBVHRay(const FlatBVHRay& flatRay)
+		{
+			// min and max slabs are swapped for negative directions
+			for (uint64_t axis = 0; axis < 3; ++axis)
+			{
+				nearBound[axis] = flatRay.isNegative[axis] ? axis + 3 : axis;
+				farBound[axis] = flatRay.isNegative[axis] ? axis : axis + 3;
+			}
+
+			originX = _mm_set1_ps(flatRay.origin[0]);
+			originY = _mm_set1_ps(flatRay.origin[1]);
+			originZ = _mm_set1_ps(flatRay.origin[2]);
+			inverseDirectionX = _mm_set1_ps(flatRay.inverseDirection[0]);
+			inverseDirectionY = _mm_set1_ps(flatRay.inverseDirection[1]);
+			inverseDirectionZ = _mm_set1_ps(flatRay.inverseDirection[2]);
+		}
+
+		uint64_t nearBound[3];
+		uint64_t farBound[3];
+		__m128 originX;
+		__m128 originY;
+		__m128 originZ;
+		__m128 inverseDirectionX;
+		__m128 inverseDirectionY;
+		__m128 inverseDirectionZ;
+	};
+
+	// returns the mask of the hit children, the entry distances are stored to tNear
+	int intersects(const FlatQBVHNode& node, const FlatQBVHRay& ray, float* tNear)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 farScale = _mm_set1_ps(FAR_DISTANCE_SCALE);
+
+		__m128 tNearX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.nearBound[0]]), ray.originX), ray.inverseDirectionX);
+		__m128 tNearY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.nearBound[1]]), ray.originY), ray.inverseDirectionY);
+		__m128 tNearZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.nearBound[2]]), ray.originZ), ray.inverseDirectionZ);
+		__m128 tFarX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.farBound[0]]), ray.originX), ray.inverseDirectionX);
+		__m128 tFarY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.farBound[1]]), ray.originY), ray.inverseDirectionY);
+		__m128 tFarZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.farBound[2]]), ray.originZ), ray.inverseDirectionZ);
+
+		__m128 nearDistance = _mm_max_ps(_mm_max_ps(tNearX, tNearY), _mm_max_ps(tNearZ, zero));
+		__m128 farDistance = _mm_mul_ps(_mm_min_ps(_mm_min_ps(tFarX, tFarY), tFarZ), farScale);
+
+		_mm_store_ps(tNear, nearDistance);
+
+		return _mm_movemask_ps(_mm_cmple_ps(nearDistance, farDistance));
+	}
+
+	// SSE version of the float part of Triangle::intersectVertices, the rounding is identical so that a lane is rejected only if the scalar test would reject it
+	// lanes with an exactly zero edge value are left to the double precision fallback of the scalar test
+	int intersectTrianglePacket(const FlatBVHTrianglePacket& packet, const Ray& ray, float* distances)
+	{
+		uint32_t axisX = ray.shearAxes[0];
+		uint32_t axisY = ray.shearAxes[1];
+		uint32_t axisZ = ray.shearAxes[2];
+
+		float origin[3] = { float(ray.origin.x), float(ray.origin.y), float(ray.origin.z) };
+
+		const __m128 originX = _mm_set1_ps(origin[axisX]);
+		const __m128 originY = _mm_set1_ps(origin[axisY]);
+		const __m128 originZ = _mm_set1_ps(origin[axisZ]);
+		const __m128 shearX = _mm_set1_ps(ray.shearFactors[0]);
+		const __m128 shearY = _mm_set1_ps(ray.shearFactors[1]);
+		const __m128 shearZ = _mm_set1_ps(ray.shearFactors[2]);
+		const __m128 zero = _mm_setzero_ps();
+
+		// vertices relative to the ray origin
+		__m128 az = _mm_sub_ps(_mm_load_ps(packet.vertices[0][axisZ]), originZ);
+		__m128 bz = _mm_sub_ps(_mm_load_ps(packet.vertices[1][axisZ]), originZ);
+		__m128 cz = _mm_sub_ps(_mm_load_ps(packet.vertices[2][axisZ]), originZ);
+
+		// shear so that the ray points along positive z
+		__m128 ax = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(packet.vertices[0][axisX]), originX), _mm_mul_ps(shearX, az));
+		__m128 ay = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(packet.vertices[0][axisY]), originY), _mm_mul_ps(shearY, az));
+		__m128 bx = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(packet.vertices[1][axisX]), originX), _mm_mul_ps(shearX, bz));
+		__m128 by = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(packet.vertices[1][axisY]), originY), _mm_mul_ps(shearY, bz));
+		__m128 cx = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(packet.vertices[2][axisX]), originX), _mm_mul_ps(shearX, cz));
+		__m128 cy = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(packet.vertices[2][axisY]), originY), _mm_mul_ps(shearY, cz));
+
+		__m128 edge0 = _mm_sub_ps(_mm_mul_ps(cx, by), _mm_mul_ps(cy, bx));
+		__m128 edge1 = _mm_sub_ps(_mm_mul_ps(ax, cy), _mm_mul_ps(ay, cx));
+		__m128 edge2 = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+
+		__m128 anyNegative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(edge0, zero), _mm_cmplt_ps(edge1, zero)), _mm_cmplt_ps(edge2, zero));
+		__m128 anyPositive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(edge0, zero), _mm_cmpgt_ps(edge1, zero)), _mm_cmpgt_ps(edge2, zero));
+		__m128 anyZero = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(edge0, zero), _mm_cmpeq_ps(edge1, zero)), _mm_cmpeq_ps(edge2, zero));
+
+		int outsideMask = _mm_movemask_ps(_mm_and_ps(anyNegative, anyPositive));
+		int zeroMask = _mm_movemask_ps(anyZero);
+		int laneMask = (1 << packet.triangleCount) - 1;
+
+		// distances are only used for the candidate order
+		__m128 determinant = _mm_add_ps(_mm_add_ps(edge0, edge1), edge2);
+		__m128 scaledDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge0, _mm_mul_ps(shearZ, az)), _mm_mul_ps(edge1, _mm_mul_ps(shearZ, bz))), _mm_mul_ps(edge2, _mm_mul_ps(shearZ, cz)));
+		_mm_store_ps(distances, _mm_div_ps(scaledDistance, determinant));
+
+		return (~outsideMask | zeroMask) & laneMask;
+	}
+}
+
+// fixed seed so that the random split modes build the same tree every time
+FlatBVHBuildThreadData::FlatBVHBuildThreadData(const BVHBuildInfo& buildInfo) : generator(5489)
+{
+	bins.resize(std::max(uint64_t(2), buildInfo.sahBinCount));
+}
+
 void Raycer::FlatBVH::initialize(const Scene& scene)
 {
 	(void)scene;
 }
 
-bool FlatBVH::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+bool FlatBVH::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	return traverse(*this, ray, intersection, intersections);
+}
+
+bool FlatBVH::occluded(const Ray& ray)
+{
+	return traverseOcclusion(*this, ray);
+}
+
+bool FlatBVH::intersectPrimitive(uint64_t index, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	return orderedPrimitives[index]->intersect(ray, intersection, intersections);
+}
+
+bool FlatBVH::occludedPrimitive(uint64_t index, const Ray& ray)
+{
+	return orderedPrimitives[index]->occluded(ray);
+}
+
+template <typename T>
+bool FlatBVH::traverse(T& leafPrimitives, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	if (ray.fastOcclusion && intersection.wasFound)
+		return true;
+
+	if (!qbvhNodes.empty())
+		return traverseQBVH(leafPrimitives, ray, intersection, intersections);
+
+	if (compactNodes.empty())
+		return false;
+
+	FlatBVHRay flatRay(ray);
+	uint64_t stack[128];
+	float stackDistance[128];
+	uint64_t stackptr = 0;
+	bool wasFound = false;
+
+	// push to stack
+	stack[stackptr] = 0;
+	stackDistance[stackptr] = 0.0f;
+	stackptr++;
+
+	while (stackptr > 0)
+	{
+		// pop from stack
+		stackptr--;
+
+		// a closer intersection was found after pushing
+		if (isBeyond(stackDistance[stackptr], ray, intersection))
+			continue;
+
+		uint64_t index = stack[stackptr];
+		const FlatBVHCompactNode& compactNode = compactNodes[index];
+
+		// leaf node -> intersect with all its primitives
+		if (compactNode.primitiveCount > 0)
+		{
+			if (intersectLeaf(leafPrimitives, compactNode.offset, compactNode.primitiveCount, ray, intersection, intersections))
+			{
+				if (ray.fastOcclusion)
+					return true;
+
+				wasFound = true;
+			}
+		}
+		else // travel down the tree
+		{
+			uint64_t leftIndex = index + 1;
+			uint64_t rightIndex = index + compactNode.offset;
+			float leftDistance;
+			float rightDistance;
+
+			bool leftWasHit = intersects(compactNodes[leftIndex], flatRay, leftDistance) && !isBeyond(leftDistance, ray, intersection);
+			bool rightWasHit = intersects(compactNodes[rightIndex], flatRay, rightDistance) && !isBeyond(rightDistance, ray, intersection);
+
+			// nearer child is pushed last so that it is visited first
+			if (leftWasHit && rightWasHit && rightDistance < leftDistance)
+			{
+				std::swap(leftIndex, rightIndex);
+				std::swap(leftDistance, rightDistance);
+			}
+
+			if (rightWasHit)
+			{
+				stack[stackptr] = rightIndex;
+				stackDistance[stackptr] = rightDistance;
+				stackptr++;
+			}
+
+			if (leftWasHit)
+			{
+				stack[stackptr] = leftIndex;
+				stackDistance[stackptr] = leftDistance;
+				stackptr++;
+			}
+		}
+	}
+
+	return wasFound;
+}
+
+AABB FlatBVH::getAABB() const
+{
+	return aabb;
+}
+
+void FlatBVH::transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate)
+{
+	// spatial splits can reference primitives more than once
+	std::vector<Primitive*> uniquePrimitives = orderedPrimitives;
+	std::sort(uniquePrimitives.begin(), uniquePrimitives.end());
+	uniquePrimitives.erase(std::unique(uniquePrimitives.begin(), uniquePrimitives.end()), uniquePrimitives.end());
+
+	for (Primitive* primitive : uniquePrimitives)
+		primitive->transform(scale, rotate, translate);
+
+	refit();
+}
+
+void FlatBVH::build(const std::vector<Primitive*>& primitives, const BVHBuildInfo& buildInfo)
+{
+	Log& log = App::getLog();
+	Settings& settings = App::getSettings();
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	uint64_t cacheKey = 0;
+	std::string cacheFileName;
+
+	if (settings.general.bvhCacheEnabled)
+	{
+		cacheKey = calculateCacheKey(primitives, buildInfo);
+		cacheFileName = tfm::format("%s/bvh_%016x.bin", settings.general.bvhCacheDirectory, cacheKey);
+
+		if (loadFromCache(cacheFileName, primitives, cacheKey))
+		{
+			initializeTraversal(buildInfo);
+
+			auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+			auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsedTime).count();
+
+			log.logInfo("BVH loaded from cache (file: %s, time: %d ms, nodes: %d)", cacheFileName, milliseconds, flatNodes.size());
+			return;
+		}
+	}
+
+	// spatial splits clip the triangles of the build input
+	orderedPrimitives = primitives;
+	primitiveAABBs.resize(primitives.size());
+
+	// avoid virtual getAABB calls during the subdivision
+	#pragma omp parallel for num_threads(getBuildThreadCount())
+	for (int64_t i = 0; i < int64_t(primitives.size()); ++i)
+		primitiveAABBs[i] = primitives[i]->getAABB();
+
+	buildHierarchy(buildInfo);
+
+	orderedPrimitives.resize(primitiveIndices.size());
+
+	for (uint64_t i = 0; i < primitiveIndices.size(); ++i)
+		orderedPrimitives[i] = primitives[primitiveIndices[i]];
+
+	std::vector<uint64_t>().swap(primitiveIndices);
+
+	orderedPrimitiveIds.clear();
+
+	for (const Primitive* primitive : orderedPrimitives)
+		orderedPrimitiveIds.push_back(primitive->id);
+
+	initializeTraversal(buildInfo);
+
+	if (settings.general.bvhCacheEnabled)
+	{
+		saveToCache(cacheFileName, primitives, cacheKey);
+		trimCache(settings.general.bvhCacheDirectory, cacheFileName, settings.general.bvhCacheMaxSize * 1024 * 1024);
+	}
+
+	logBuildFinished(startTime);
+}
+
+void FlatBVH::build(std::vector<AABB> aabbs, const BVHBuildInfo& buildInfo, std::vector<uint64_t>& orderedIndices)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	orderedPrimitives.clear();
+	orderedPrimitiveIds.clear();
+	primitiveAABBs.swap(aabbs);
+
+	buildHierarchy(buildInfo);
+
+	orderedIndices.swap(primitiveIndices);
+	std::vector<uint64_t>().swap(primitiveIndices);
+
+	initializeTraversal(buildInfo);
+	logBuildFinished(startTime);
+}
+
+void FlatBVH::buildHierarchy(const BVHBuildInfo& buildInfo)
+{
+	Log& log = App::getLog();
+
+	int32_t threadCount = getBuildThreadCount();
+	uint64_t primitiveCount = primitiveAABBs.size();
+
+	std::string splitName = buildInfo.useSAH ? (buildInfo.useBinnedSAH ? "binned SAH" : "SAH") : "regular";
+
+	if (buildInfo.useLinearBuild)
+		splitName = "linear";
+	else if (buildInfo.useSpatialSplits)
+		splitName = "spatial SAH";
+
+	log.logInfo("Building BVH (primitives: %d, split: %s, threads: %d)", primitiveCount, splitName, (buildInfo.useSpatialSplits && !buildInfo.useLinearBuild) ? 1 : threadCount);
+
+	flatNodes.clear();
+
+	// the builders only reorder the indices to the build input
+	primitiveCenters.resize(primitiveCount);
+	primitiveIndices.resize(primitiveCount);
+
+	#pragma omp parallel for num_threads(threadCount)
+	for (int64_t i = 0; i < int64_t(primitiveCount); ++i)
+	{
+		primitiveCenters[i] = primitiveAABBs[i].getCenter();
+		primitiveIndices[i] = uint64_t(i);
+	}
+
+	if (buildInfo.useLinearBuild)
+		buildLinear(buildInfo, threadCount);
+	else if (buildInfo.useSpatialSplits)
+	{
+		buildWithSpatialSplits(buildInfo);
+
+		double duplicated = 100.0 * (double(primitiveIndices.size()) / double(std::max(uint64_t(1), primitiveCount)) - 1.0);
+		log.logInfo("BVH spatial splits (references: %d, duplicated: %.1f %%)", primitiveIndices.size(), duplicated);
+	}
+	else if (threadCount == 1)
+	{
+		FlatBVHBuildThreadData threadData(buildInfo);
+		buildSubtree(0, primitiveCount, flatNodes, buildInfo, threadData);
+	}
+	else
+	{
+		std::mutex ompThreadExceptionMutex;
+		std::exception_ptr ompThreadException = nullptr;
+		std::atomic<bool> ompThreadFailed(false);
+
+		// tasks are tied and do not use the data over a task scheduling point -> one instance per thread is enough
+		std::vector<std::unique_ptr<FlatBVHBuildThreadData>> threadDatas;
+
+		for (int32_t i = 0; i < threadCount; ++i)
+			threadDatas.push_back(std::make_unique<FlatBVHBuildThreadData>(buildInfo));
+
+		// large subtrees are split into tasks, subtree nodes are concatenated after both children are done
+		// child offsets are relative so the final layout is the same as with the single threaded build for the non-random split modes
+		std::function<void(uint64_t, uint64_t, std::vector<FlatBVHNode>&)> buildParallel = [&](uint64_t start, uint64_t end, std::vector<FlatBVHNode>& nodes)
+		{
+			try
+			{
+				if (ompThreadFailed)
+					return;
+
+				FlatBVHBuildThreadData& threadData = *threadDatas[uint64_t(omp_get_thread_num())];
+
+				// the random splits depend only on the subtree, not on which thread happens to build it
+				threadData.generator.seed(uint32_t(start));
+
+				if (end - start < PARALLEL_BUILD_MIN_PRIMITIVES)
+				{
+					buildSubtree(start, end, nodes, buildInfo, threadData);
+					return;
+				}
+
+				FlatBVHBuildEntry buildEntry;
+				buildEntry.start = start;
+				buildEntry.end = end;
+
+				FlatBVHNode flatNode;
+				uint64_t middle;
+				buildNode(flatNode, buildEntry, middle, buildInfo, threadData);
+
+				if (flatNode.rightOffset == 0)
+				{
+					nodes.push_back(flatNode);
+					return;
+				}
+
+				std::vector<FlatBVHNode> leftNodes;
+				std::vector<FlatBVHNode> rightNodes;
+
+				#pragma omp task shared(buildParallel, leftNodes)
+				buildParallel(start, middle, leftNodes);
+
+				buildParallel(middle, end, rightNodes);
+
+				#pragma omp taskwait
+
+				flatNode.rightOffset = int64_t(leftNodes.size()) + 1;
+
+				nodes.reserve(nodes.size() + 1 + leftNodes.size() + rightNodes.size());
+				nodes.push_back(flatNode);
+				nodes.insert(nodes.end(), leftNodes.begin(), leftNodes.end());
+				nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(ompThreadExceptionMutex);
+
+				if (ompThreadException == nullptr)
+					ompThreadException = std::current_exception();
+
+				ompThreadFailed = true;
+			}
+		};
+
+		#pragma omp parallel num_threads(threadCount)
+		{
+			#pragma omp single
+			buildParallel(0, primitiveCount, flatNodes);
+		}
+
+		if (ompThreadException != nullptr)
+			std::rethrow_exception(ompThreadException);
+	}
+
+	hasBeenBuilt = true;
+
+	std::vector<AABB>().swap(primitiveAABBs);
+	std::vector<Vector3>().swap(primitiveCenters);
+}
+
+void FlatBVH::logBuildFinished(std::chrono::high_resolution_clock::time_point startTime) const
+{
+	uint64_t nodeCount = flatNodes.size();
+	uint64_t leafCount = 0;
+
+	for (const FlatBVHNode& flatNode : flatNodes)
+	{
+		if (flatNode.rightOffset == 0)
+			leafCount++;
+	}
+
+	auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
+	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsedTime).count();
+
+	uint64_t flatMemory = flatNodes.size() * sizeof(FlatBVHNode);
+	uint64_t traversalMemory = compactNodes.size() * sizeof(FlatBVHCompactNode) + qbvhNodes.size() * sizeof(FlatQBVHNode);
+
+	// the cost of the final tree, after the splits and the restructuring
+	App::getLog().logInfo("BVH building finished (time: %d ms, nodes: %d, leafs: %d, SAH cost: %.2f, traversal memory: %d kB, flat memory: %d kB)", milliseconds, nodeCount, leafCount, builtSAHCost, traversalMemory / 1024, flatMemory / 1024);
+}
+
+void FlatBVH::restore(const Scene& scene, const BVHBuildInfo& buildInfo)
+{
+	orderedPrimitives.clear();
+
+	for (uint64_t primitiveId : orderedPrimitiveIds)
+		orderedPrimitives.push_back(scene.primitivesMap.at(primitiveId));
+
+	initializeTraversal(buildInfo);
+}
+
+void FlatBVH::initializeTraversal(const BVHBuildInfo& buildInfo)
+{
+	if (!flatNodes.empty())
+		aabb = flatNodes[0].aabb;
+
+	builtSAHCost = calculateSAHCost();
+	compactNodes.clear();
+	qbvhNodes.clear();
+	qbvhFlatIndices.clear();
+
+	if (buildInfo.useQBVH)
+		buildQBVH();
+	else
+		buildCompactNodes();
+
+	buildTrianglePackets();
+}
+
+bool FlatBVH::loadFromCache(const std::string& fileName, const std::vector<Primitive*>& primitives, uint64_t cacheKey)
+{
+	// the traversal nodes are converted from the flat nodes anyway -> a plain read straight to the vectors
+	std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+
+	if (!file.is_open())
+		return false;
+
+	uint64_t dataSize = uint64_t(file.tellg());
+	file.seekg(0);
+
+	if (dataSize < sizeof(FlatBVHCacheHeader))
+		return false;
+
+	FlatBVHCacheHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(FlatBVHCacheHeader));
+
+	// spatial splits can reference primitives more than once
+	if (!file || header.magic != CACHE_FILE_MAGIC || header.version != CACHE_FILE_VERSION || header.cacheKey != cacheKey || header.nodeSize != sizeof(FlatBVHNode) || header.primitiveCount < primitives.size() || header.nodeCount == 0)
+		return false;
+
+	if (header.nodeCount > dataSize / sizeof(FlatBVHNode) || header.primitiveCount > dataSize / sizeof(uint64_t))
+		return false;
+
+	uint64_t nodesSize = header.nodeCount * sizeof(FlatBVHNode);
+	uint64_t indicesSize = header.primitiveCount * sizeof(uint64_t);
+
+	if (dataSize != sizeof(FlatBVHCacheHeader) + nodesSize + indicesSize)
+		return false;
+
+	std::vector<FlatBVHNode> cachedNodes(header.nodeCount);
+	std::vector<uint64_t> cachedIndices(header.primitiveCount);
+
+	file.read(reinterpret_cast<char*>(cachedNodes.data()), std::streamsize(nodesSize));
+	file.read(reinterpret_cast<char*>(cachedIndices.data()), std::streamsize(indicesSize));
+
+	if (!file)
+	{
+		App::getLog().logWarning("Could not read BVH cache file %s", fileName);
+		return false;
+	}
+
+	// primitives are stored as indices to the build input -> no id lookups
+	std::vector<Primitive*> cachedPrimitives(header.primitiveCount);
+
+	for (uint64_t i = 0; i < cachedIndices.size(); ++i)
+	{
+		if (cachedIndices[i] >= primitives.size())
+			return false;
+
+		cachedPrimitives[i] = primitives[cachedIndices[i]];
+	}
+
+	flatNodes.swap(cachedNodes);
+	orderedPrimitives.swap(cachedPrimitives);
+
+	// marks the file recently used for the cache trimming
+	boost::system::error_code error;
+	boost::filesystem::last_write_time(fileName, std::time(nullptr), error);
+
+	hasBeenBuilt = true;
+	orderedPrimitiveIds.clear();
+
+	for (const Primitive* primitive : orderedPrimitives)
+		orderedPrimitiveIds.push_back(primitive->id);
+
+	return true;
+}
+
+void FlatBVH::saveToCache(const std::string& fileName, const std::vector<Primitive*>& primitives, uint64_t cacheKey) const
+{
+	std::unordered_map<const Primitive*, uint64_t> primitiveIndices;
+	primitiveIndices.reserve(primitives.size());
+
+	for (uint64_t i = 0; i < primitives.size(); ++i)
+		primitiveIndices[primitives[i]] = i;
+
+	std::vector<uint64_t> orderedIndices;
+	orderedIndices.reserve(orderedPrimitives.size());
+
+	for (const Primitive* primitive : orderedPrimitives)
+		orderedIndices.push_back(primitiveIndices[primitive]);
+
+	FlatBVHCacheHeader header;
+	header.magic = CACHE_FILE_MAGIC;
+	header.version = CACHE_FILE_VERSION;
+	header.cacheKey = cacheKey;
+	header.nodeSize = sizeof(FlatBVHNode);
+	header.nodeCount = flatNodes.size();
+	header.primitiveCount = orderedIndices.size();
+
+	boost::filesystem::path filePath(fileName);
+	boost::system::error_code error;
+	boost::filesystem::create_directories(filePath.parent_path(), error);
+
+	// written next to the target and renamed over it -> readers never see a partial file
+	boost::filesystem::path tempFilePath = filePath.parent_path() / boost::filesystem::unique_path(filePath.filename().string() + ".%%%%%%%%.tmp");
+	std::ofstream file(tempFilePath.string(), std::ios::binary | std::ios::trunc);
+
+	if (!file.is_open())
+	{
+		App::getLog().logWarning("Could not open BVH cache file %s for writing", tempFilePath.string());
+		return;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(FlatBVHCacheHeader));
+	file.write(reinterpret_cast<const char*>(flatNodes.data()), std::streamsize(flatNodes.size() * sizeof(FlatBVHNode)));
+	file.write(reinterpret_cast<const char*>(orderedIndices.data()), std::streamsize(orderedIndices.size() * sizeof(uint64_t)));
+	file.close();
+
+	if (file.fail())
+	{
+		App::getLog().logWarning("Could not write BVH cache file %s", tempFilePath.string());
+		boost::filesystem::remove(tempFilePath, error);
+		return;
+	}
+
+	boost::filesystem::rename(tempFilePath, filePath, error);
+
+	if (error)
+	{
+		App::getLog().logWarning("Could not rename BVH cache file %s to %s: %s", tempFilePath.string(), fileName, error.message());
+		boost::filesystem::remove(tempFilePath, error);
+	}
+}
+
+void FlatBVH::refit()
+{
+	// trees built from raw bounds have no primitives to get the new bounds from
+	if (flatNodes.empty() || orderedPrimitives.empty())
+		return;
+
+	// the topology stays the same -> the traversal nodes and the packets are updated in place
+	bool hasPackets = (primitivePackets.size() == orderedPrimitives.size());
+	bool hasCompactNodes = (compactNodes.size() == flatNodes.size());
+
+	// children are always after their parent -> reverse order is bottom-up
+	for (uint64_t i = flatNodes.size(); i-- > 0;)
+	{
+		FlatBVHNode& flatNode = flatNodes[i];
+		flatNode.aabb = AABB();
+
+		if (flatNode.rightOffset == 0)
+		{
+			for (uint64_t j = 0; j < flatNode.primitiveCount; ++j)
+			{
+				uint64_t index = flatNode.startOffset + j;
+				flatNode.aabb.expand(orderedPrimitives[index]->getAABB());
+
+				// a triangle can move without changing the leaf bounds -> the lanes are always refreshed
+				if (hasPackets && primitivePackets[index] != NO_TRIANGLE_PACKET)
+				{
+					FlatBVHTrianglePacket& packet = trianglePackets[primitivePackets[index]];
+
+					for (uint64_t lane = 0; lane < packet.triangleCount; ++lane)
+						setPacketTriangle(packet, lane, orderedPrimitives[index + lane]);
+				}
+			}
+		}
+		else
+		{
+			flatNode.aabb.expand(flatNodes[i + 1].aabb);
+			flatNode.aabb.expand(flatNodes[i + uint64_t(flatNode.rightOffset)].aabb);
+		}
+
+		if (hasCompactNodes)
+			setCompactNodeBounds(compactNodes[i], flatNode.aabb);
+	}
+
+	aabb = flatNodes[0].aabb;
+
+	for (uint64_t i = 0; i < qbvhFlatIndices.size(); ++i)
+	{
+		// empty slots keep their inverted bounds
+		if (qbvhFlatIndices[i] != NO_QBVH_CHILD)
+			setQBVHChildBounds(qbvhNodes[i / 4], i % 4, flatNodes[qbvhFlatIndices[i]].aabb);
+	}
+}
+
+double FlatBVH::calculateSAHCost() const
+{
+	double cost = 0.0;
+
+	// not normalized by the root area so that growing root bounds also increase the cost
+	// node traversal and primitive intersection costs are both one unit
+	for (const FlatBVHNode& flatNode : flatNodes)
+		cost += flatNode.aabb.getSurfaceArea() * ((flatNode.rightOffset == 0) ? double(flatNode.primitiveCount) : 1.0);
+
+	return cost;
+}
+
+AABB FlatBVH::getTransformedAABB(const Matrix4x4& transformation) const
+{
+	if (flatNodes.empty())
+		return aabb.transformed(transformation);
+
+	AABB transformedAABB;
+	std::pair<uint64_t, uint64_t> stack[TRANSFORMED_AABB_DEPTH + 2];
+	uint64_t stackptr = 0;
+
+	// node index, depth
+	stack[stackptr++] = std::make_pair(0, 0);
+
+	// union of the transformed child boxes is tighter than the transformed root box
+	while (stackptr > 0)
+	{
+		stackptr--;
+		uint64_t index = stack[stackptr].first;
+		uint64_t depth = stack[stackptr].second;
+		const FlatBVHNode& flatNode = flatNodes[index];
+
+		if (flatNode.rightOffset == 0 || depth == TRANSFORMED_AABB_DEPTH)
+		{
+			transformedAABB.expand(flatNode.aabb.transformed(transformation));
+			continue;
+		}
+
+		stack[stackptr++] = std::make_pair(index + uint64_t(flatNode.rightOffset), depth + 1);
+		stack[stackptr++] = std::make_pair(index + 1, depth + 1);
+	}
+
+	return transformedAABB;
+}
+
+template <typename T>
+bool FlatBVH::traverseQBVH(T& leafPrimitives, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	FlatBVHRay flatRay(ray);
+	FlatQBVHRay qbvhRay(flatRay);
+
+	uint64_t stack[256];
+	float stackDistance[256];
+	uint64_t stackptr = 0;
+	bool wasFound = false;
+
+	// push to stack
+	stack[stackptr] = 0;
+	stackDistance[stackptr] = 0.0f;
+	stackptr++;
+
+	while (stackptr > 0)
+	{
+		// pop from stack
+		stackptr--;
+
+		// a closer intersection was found after pushing
+		if (isBeyond(stackDistance[stackptr], ray, intersection))
+			continue;
+
+		const FlatQBVHNode& qbvhNode = qbvhNodes[stack[stackptr]];
+
+		alignas(16) float distances[4];
+		int hitMask = intersects(qbvhNode, qbvhRay, distances);
+
+		uint64_t order[4];
+		uint64_t hitCount = 0;
+
+		// sort the hit children by entry distance
+		for (uint64_t i = 0; i < 4; ++i)
+		{
+			if ((hitMask & (1 << i)) == 0 || isBeyond(distances[i], ray, intersection))
+				continue;
+
+			uint64_t j = hitCount++;
+
+			for (; j > 0 && distances[order[j - 1]] > distances[i]; --j)
+				order[j] = order[j - 1];
+
+			order[j] = i;
+		}
+
+		// inner nodes -> travel down the tree, nearest is pushed last
+		for (uint64_t k = hitCount; k-- > 0;)
+		{
+			uint64_t i = order[k];
+
+			if (qbvhNode.primitiveCount[i] < 0)
+			{
+				stack[stackptr] = uint64_t(qbvhNode.childOffset[i]);
+				stackDistance[stackptr] = distances[i];
+				stackptr++;
+			}
+		}
+
+		// leaf nodes -> intersect with all their primitives, nearest first
+		for (uint64_t k = 0; k < hitCount; ++k)
+		{
+			uint64_t i = order[k];
+
+			if (qbvhNode.primitiveCount[i] < 0 || isBeyond(distances[i], ray, intersection))
+				continue;
+
+			if (intersectLeaf(leafPrimitives, uint64_t(qbvhNode.childOffset[i]), uint64_t(qbvhNode.primitiveCount[i]), ray, intersection, intersections))
+			{
+				if (ray.fastOcclusion)
+					return true;
+
+				wasFound = true;
+			}
+		}
+	}
+
+	return wasFound;
+}
+
+template <typename T>
+bool FlatBVH::intersectLeaf(T& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	bool wasFound = false;
+
+	for (uint64_t i = startOffset; i < startOffset + primitiveCount; ++i)
+	{
+		if (leafPrimitives.intersectPrimitive(i, ray, intersection, intersections))
+		{
+			if (ray.fastOcclusion)
+				return true;
+
+			wasFound = true;
+		}
+	}
+
+	return wasFound;
+}
+
+bool FlatBVH::intersectLeaf(FlatBVH& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	if (leafPrimitives.trianglePackets.empty())
+		return intersectLeaf<FlatBVH>(leafPrimitives, startOffset, primitiveCount, ray, intersection, intersections);
+
+	bool wasFound = false;
+	uint64_t i = startOffset;
+
+	while (i < startOffset + primitiveCount)
+	{
+		uint32_t packetIndex = leafPrimitives.primitivePackets[i];
+
+		// other primitive types use the virtual call
+		if (packetIndex == NO_TRIANGLE_PACKET)
+		{
+			if (leafPrimitives.orderedPrimitives[i]->intersect(ray, intersection, intersections))
+			{
+				if (ray.fastOcclusion)
+					return true;
+
+				wasFound = true;
+			}
+
+			++i;
+			continue;
+		}
+
+		const FlatBVHTrianglePacket& packet = leafPrimitives.trianglePackets[packetIndex];
+
+		alignas(16) float distances[4];
+		int candidateMask = intersectTrianglePacket(packet, ray, distances);
+
+		// the candidates are rare, the full triangle test makes the final decision nearest first and calculates the hit data
+		while (candidateMask != 0)
+		{
+			uint64_t nearestLane = 4;
+
+			for (uint64_t lane = 0; lane < 4; ++lane)
+			{
+				if ((candidateMask & (1 << lane)) != 0 && (nearestLane == 4 || distances[lane] < distances[nearestLane]))
+					nearestLane = lane;
+			}
+
+			candidateMask &= ~(1 << nearestLane);
+
+			if (leafPrimitives.orderedPrimitives[i + nearestLane]->intersect(ray, intersection, intersections))
+			{
+				if (ray.fastOcclusion)
+					return true;
+
+				wasFound = true;
+			}
+		}
+
+		i += packet.triangleCount;
+	}
+
+	return wasFound;
+}
+
+// any hit ends the traversal, so the children are visited in the stored order
+template <typename T>
+bool FlatBVH::traverseOcclusion(T& leafPrimitives, const Ray& ray)
+{
+	if (!qbvhNodes.empty())
+		return traverseQBVHOcclusion(leafPrimitives, ray);
+
+	if (compactNodes.empty())
+		return false;
+
+	FlatBVHRay flatRay(ray);
+	uint64_t stack[128];
+	uint64_t stackptr = 0;
+
+	stack[stackptr++] = 0;
+
+	while (stackptr > 0)
+	{
+		uint64_t index = stack[--stackptr];
+		const FlatBVHCompactNode& compactNode = compactNodes[index];
+		float distance;
+
+		if (!intersects(compactNode, flatRay, distance) || isBeyond(distance, ray))
+			continue;
+
+		if (compactNode.primitiveCount > 0)
+		{
+			if (occludedLeaf(leafPrimitives, compactNode.offset, compactNode.primitiveCount, ray))
+				return true;
+		}
+		else
+		{
+			stack[stackptr++] = index + compactNode.offset;
+			stack[stackptr++] = index + 1;
+		}
+	}
+
+	return false;
+}
+
+template <typename T>
+bool FlatBVH::traverseQBVHOcclusion(T& leafPrimitives, const Ray& ray)
+{
+	FlatBVHRay flatRay(ray);
+	FlatQBVHRay qbvhRay(flatRay);
+
+	uint64_t stack[256];
+	uint64_t stackptr = 0;
+
+	stack[stackptr++] = 0;
+
+	while (stackptr > 0)
+	{
+		const FlatQBVHNode& qbvhNode = qbvhNodes[stack[--stackptr]];
+
+		alignas(16) float distances[4];
+		int hitMask = intersects(qbvhNode, qbvhRay, distances);
+
+		for (uint64_t i = 0; i < 4; ++i)
+		{
+			if ((hitMask & (1 << i)) == 0 || isBeyond(distances[i], ray))
+				continue;
+
+			if (qbvhNode.primitiveCount[i] < 0)
+				stack[stackptr++] = uint64_t(qbvhNode.childOffset[i]);
+			else if (occludedLeaf(leafPrimitives, uint64_t(qbvhNode.childOffset[i]), uint64_t(qbvhNode.primitiveCount[i]), ray))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+template <typename T>
+bool FlatBVH::occludedLeaf(T& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray)
+{
+	for (uint64_t i = startOffset; i < startOffset + primitiveCount; ++i)
+	{
+		if (leafPrimitives.occludedPrimitive(i, ray))
+			return true;
+	}
+
+	return false;
+}
+
+bool FlatBVH::occludedLeaf(FlatBVH& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray)
+{
+	if (leafPrimitives.trianglePackets.empty())
+		return occludedLeaf<FlatBVH>(leafPrimitives, startOffset, primitiveCount, ray);
+
+	uint64_t i = startOffset;
+
+	while (i < startOffset + primitiveCount)
+	{
+		uint32_t packetIndex = leafPrimitives.primitivePackets[i];
+
+		if (packetIndex == NO_TRIANGLE_PACKET)
+		{
+			if (leafPrimitives.orderedPrimitives[i]->occluded(ray))
+				return true;
+
+			++i;
+			continue;
+		}
+
+		const FlatBVHTrianglePacket& packet = leafPrimitives.trianglePackets[packetIndex];
+
+		alignas(16) float distances[4];
+		int candidateMask = intersectTrianglePacket(packet, ray, distances);
+
+		// any confirmed candidate is enough, the order does not matter
+		for (uint64_t lane = 0; lane < 4; ++lane)
+		{
+			if ((candidateMask & (1 << lane)) != 0 && leafPrimitives.orderedPrimitives[i + lane]->occluded(ray))
+				return true;
+		}
+
+		i += packet.triangleCount;
+	}
+
+	return false;
+}
+
+// Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"
+// primitives are sorted by the Morton codes of their centers and every inner node is found independently
+void FlatBVH::buildLinear(const BVHBuildInfo& buildInfo, int32_t threadCount)
+{
+	uint64_t primitiveCount = primitiveAABBs.size();
+
+	if (primitiveCount <= buildInfo.maxLeafSize)
+	{
+		FlatBVHBuildThreadData threadData(buildInfo);
+		buildSubtree(0, primitiveCount, flatNodes, buildInfo, threadData);
+		return;
+	}
+
+	AABB centerAABB;
+
+	for (const Vector3& center : primitiveCenters)
+		centerAABB.expand(center);
+
+	Vector3 minCenter = centerAABB.getMin();
+	Vector3 extent = centerAABB.getExtent();
+	Vector3 scale;
+
+	for (uint64_t axis = 0; axis < 3; ++axis)
+		scale.set(axis, (extent.get(axis) > 0.0) ? 1023.0 / extent.get(axis) : 0.0);
+
+	// primitive index in the lower bits makes the keys unique
+	std::vector<uint64_t> keys(primitiveCount);
+
+	#pragma omp parallel for num_threads(threadCount)
+	for (int64_t i = 0; i < int64_t(primitiveCount); ++i)
+	{
+		Vector3 position = (primitiveCenters[i] - minCenter) * scale;
+
+		uint32_t code = expandMortonBits(uint32_t(std::min(1023.0, position.x)));
+		code |= expandMortonBits(uint32_t(std::min(1023.0, position.y))) << 1;
+		code |= expandMortonBits(uint32_t(std::min(1023.0, position.z))) << 2;
+
+		keys[i] = (uint64_t(code) << 32) | uint64_t(i);
+	}
+
+	radixSort(keys, threadCount);
+
+	// inner nodes first, then the leafs in the sorted order
+	uint64_t innerCount = primitiveCount - 1;
+	std::vector<LinearBVHNode> nodes(innerCount + primitiveCount);
+
+	#pragma omp parallel for num_threads(threadCount)
+	for (int64_t i = 0; i < int64_t(primitiveCount); ++i)
+	{
+		LinearBVHNode& node = nodes[innerCount + uint64_t(i)];
+		node.primitiveIndex = keys[i] & 0xffffffff;
+		node.aabb = primitiveAABBs[node.primitiveIndex];
+		node.left = -1;
+		node.right = -1;
+		node.primitiveCount = 1;
+		node.cost = node.aabb.getSurfaceArea();
+	}
+
+	auto commonPrefix = [&](int64_t i, int64_t j)
+	{
+		if (j < 0 || j >= int64_t(primitiveCount))
+			return int64_t(-1);
+
+		return int64_t(countLeadingZeros(keys[i] ^ keys[j]));
+	};
+
+	#pragma omp parallel for num_threads(threadCount)
+	for (int64_t i = 0; i < int64_t(innerCount); ++i)
+	{
+		// direction of the range covered by the node
+		int64_t direction = (commonPrefix(i, i + 1) > commonPrefix(i, i - 1)) ? 1 : -1;
+		int64_t minPrefix = commonPrefix(i, i - direction);
+		int64_t maxLength = 2;
+
+		while (commonPrefix(i, i + maxLength * direction) > minPrefix)
+			maxLength *= 2;
+
+		int64_t length = 0;
+
+		for (int64_t step = maxLength / 2; step >= 1; step /= 2)
+		{
+			if (commonPrefix(i, i + (length + step) * direction) > minPrefix)
+				length += step;
+		}
+
+		int64_t j = i + length * direction;
+		int64_t nodePrefix = commonPrefix(i, j);
+		int64_t split = 0;
+
+		// find the highest differing bit inside the range
+		for (int64_t divisor = 2; ; divisor *= 2)
+		{
+			int64_t step = (length + divisor - 1) / divisor;
+
+			if (commonPrefix(i, i + (split + step) * direction) > nodePrefix)
+				split += step;
+
+			if (step <= 1)
+				break;
+		}
+
+		int64_t middle = i + split * direction + std::min(direction, int64_t(0));
+		int64_t first = std::min(i, j);
+		int64_t last = std::max(i, j);
+
+		LinearBVHNode& node = nodes[uint64_t(i)];
+		node.left = (first == middle) ? int64_t(innerCount) + middle : middle;
+		node.right = (last == middle + 1) ? int64_t(innerCount) + middle + 1 : middle + 1;
+		node.primitiveCount = uint64_t(last - first + 1);
+	}
+
+	// bounds are calculated bottom-up, optionally followed by restructuring the treelet of each node
+	std::function<void(uint64_t, bool)> updateSubtree = [&](uint64_t nodeIndex, bool restructure)
+	{
+		uint64_t leftIndex = uint64_t(nodes[nodeIndex].left);
+		uint64_t rightIndex = uint64_t(nodes[nodeIndex].right);
+
+		if (nodes[nodeIndex].left < 0)
+			return;
+
+		if (nodes[nodeIndex].primitiveCount >= PARALLEL_BUILD_MIN_PRIMITIVES)
+		{
+			#pragma omp task shared(updateSubtree)
+			updateSubtree(leftIndex, restructure);
+
+			updateSubtree(rightIndex, restructure);
+
+			#pragma omp taskwait
+		}
+		else
+		{
+			updateSubtree(leftIndex, restructure);
+			updateSubtree(rightIndex, restructure);
+		}
+
+		LinearBVHNode& node = nodes[nodeIndex];
+		node.aabb = nodes[leftIndex].aabb;
+		node.aabb.expand(nodes[rightIndex].aabb);
+		node.cost = node.aabb.getSurfaceArea() + nodes[leftIndex].cost + nodes[rightIndex].cost;
+
+		// smaller subtrees are collapsed into leafs anyway
+		if (restructure && node.primitiveCount > buildInfo.maxLeafSize)
+			restructureTreelet(nodes, nodeIndex);
+	};
+
+	// children are finished before their parent -> the first pass can already restructure
+	for (uint64_t pass = 0; pass < std::max(uint64_t(1), buildInfo.treeletRestructurePasses); ++pass)
+	{
+		#pragma omp parallel num_threads(threadCount)
+		{
+			#pragma omp single
+			updateSubtree(0, buildInfo.treeletRestructurePasses > 0);
+		}
+	}
+
+	enum { ROOT = -4, UNVISITED = -3, VISITED_TWICE = -1 };
+
+	struct LinearBuildEntry
+	{
+		uint64_t nodeIndex;
+		int64_t parent;
+	};
+
+	std::vector<LinearBuildEntry> stack;
+	std::vector<uint64_t> leafStack;
+	std::vector<uint64_t> linearIndices;
+
+	stack.push_back({ 0, ROOT });
+	flatNodes.reserve(2 * primitiveCount / std::max(uint64_t(1), buildInfo.maxLeafSize));
+	linearIndices.reserve(primitiveCount);
+
+	// subtrees small enough are collapsed into leafs
+	while (!stack.empty())
+	{
+		// pop from stack
+		LinearBuildEntry buildEntry = stack.back();
+		stack.pop_back();
+
+		const LinearBVHNode& node = nodes[buildEntry.nodeIndex];
+
+		FlatBVHNode flatNode;
+		flatNode.aabb = node.aabb;
+		flatNode.rightOffset = UNVISITED;
+		flatNode.startOffset = linearIndices.size();
+		flatNode.primitiveCount = node.primitiveCount;
+
+		int64_t flatNodeIndex = int64_t(flatNodes.size());
+		flatNodes.push_back(flatNode);
+
+		// update the parent rightOffset when visiting its right child
+		if (buildEntry.parent != ROOT)
+		{
+			flatNodes[uint64_t(buildEntry.parent)].rightOffset++;
+
+			if (flatNodes[uint64_t(buildEntry.parent)].rightOffset == VISITED_TWICE)
+				flatNodes[uint64_t(buildEntry.parent)].rightOffset = flatNodeIndex - buildEntry.parent;
+		}
+
+		if (node.primitiveCount <= buildInfo.maxLeafSize)
+		{
+			flatNodes[uint64_t(flatNodeIndex)].rightOffset = 0;
+			leafStack.push_back(buildEntry.nodeIndex);
+
+			while (!leafStack.empty())
+			{
+				const LinearBVHNode& subtreeNode = nodes[leafStack.back()];
+				leafStack.pop_back();
+
+				if (subtreeNode.left < 0)
+					linearIndices.push_back(subtreeNode.primitiveIndex);
+				else
+				{
+					leafStack.push_back(uint64_t(subtreeNode.right));
+					leafStack.push_back(uint64_t(subtreeNode.left));
+				}
+			}
+
+			continue;
+		}
+
+		// push right child
+		stack.push_back({ uint64_t(node.right), flatNodeIndex });
+
+		// push left child
+		stack.push_back({ uint64_t(node.left), flatNodeIndex });
+	}
+
+	primitiveIndices.swap(linearIndices);
+}
+
+// Stich et al. 2009, "Spatial Splits in Bounding Volume Hierarchies"
+// primitive references straddling a spatial split are clipped to both children
+void FlatBVH::buildWithSpatialSplits(const BVHBuildInfo& buildInfo)
+{
+	enum { ROOT = -4, UNVISITED = -3, VISITED_TWICE = -1 };
+
+	struct SpatialBuildEntry
+	{
+		std::vector<FlatBVHReference> references;
+		int64_t parent;
+	};
+
+	FlatBVHBuildThreadData threadData(buildInfo);
+	std::vector<FlatBVHSpatialBin> spatialBins(threadData.bins.size());
+	std::vector<SpatialBuildEntry> stack(1);
+	std::vector<uint64_t> referencedIndices;
+	std::vector<AABB> referenceAABBs;
+	std::vector<Vector3> referenceCenters;
+	AABB rootAABB;
+
+	for (uint64_t i = 0; i < primitiveAABBs.size(); ++i)
+	{
+		stack[0].references.push_back({ primitiveAABBs[i], i });
+		rootAABB.expand(primitiveAABBs[i]);
+	}
+
+	stack[0].parent = ROOT;
+
+	double minOverlapArea = getSurfaceArea(rootAABB) * SPATIAL_SPLIT_MIN_OVERLAP;
+	uint64_t referenceCount = primitiveAABBs.size();
+	uint64_t maxReferenceCount = uint64_t(double(referenceCount) * (1.0 + std::max(0.0, buildInfo.spatialSplitBudget)));
+
+	while (!stack.empty())
+	{
+		// pop from stack
+		SpatialBuildEntry buildEntry = std::move(stack.back());
+		stack.pop_back();
+
+		std::vector<FlatBVHReference>& references = buildEntry.references;
+		uint64_t count = references.size();
+
+		FlatBVHNode flatNode;
+		flatNode.aabb = calculateAABB(references);
+		flatNode.rightOffset = UNVISITED;
+		flatNode.startOffset = referencedIndices.size();
+		flatNode.primitiveCount = count;
+
+		int64_t nodeIndex = int64_t(flatNodes.size());
+		flatNodes.push_back(flatNode);
+
+		// update the parent rightOffset when visiting its right child
+		if (buildEntry.parent != ROOT)
+		{
+			flatNodes[uint64_t(buildEntry.parent)].rightOffset++;
+
+			if (flatNodes[uint64_t(buildEntry.parent)].rightOffset == VISITED_TWICE)
+				flatNodes[uint64_t(buildEntry.parent)].rightOffset = nodeIndex - buildEntry.parent;
+		}
+
+		// leaf node indicated by rightOffset == 0
+		if (count <= buildInfo.maxLeafSize)
+		{
+			flatNodes[uint64_t(nodeIndex)].rightOffset = 0;
+
+			for (const FlatBVHReference& reference : references)
+				referencedIndices.push_back(reference.primitiveIndex);
+
+			continue;
+		}
+
+		// object split uses the regular binned SAH on the clipped reference bounds, the primitive bounds are left intact
+		referenceAABBs.resize(count);
+		referenceCenters.resize(count);
+
+		AABB centerAABB;
+
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			referenceAABBs[i] = references[i].aabb;
+			referenceCenters[i] = references[i].aabb.getCenter();
+			centerAABB.expand(referenceCenters[i]);
+		}
+
+		FlatBVHBuildEntry objectEntry;
+		objectEntry.start = 0;
+		objectEntry.end = count;
+		objectEntry.parent = nodeIndex;
+
+		uint64_t axis;
+		double splitPoint;
+
+		calculateBinnedSAHSplit(axis, splitPoint, flatNode.aabb, centerAABB, referenceAABBs, referenceCenters, objectEntry, threadData);
+
+		std::vector<FlatBVHReference> leftReferences;
+		std::vector<FlatBVHReference> rightReferences;
+
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			if (referenceCenters[i].get(axis) <= splitPoint)
+				leftReferences.push_back(references[i]);
+			else
+				rightReferences.push_back(references[i]);
+		}
+
+		// partition failed -> fallback
+		if (leftReferences.empty() || rightReferences.empty())
+		{
+			leftReferences.assign(references.begin(), references.begin() + int64_t(count / 2));
+			rightReferences.assign(references.begin() + int64_t(count / 2), references.end());
+		}
+
+		AABB leftAABB = calculateAABB(leftReferences);
+		AABB rightAABB = calculateAABB(rightReferences);
+
+		double nodeSurfaceArea = flatNode.aabb.getSurfaceArea();
+		double objectCost = (getSurfaceArea(leftAABB) * double(leftReferences.size()) + getSurfaceArea(rightAABB) * double(rightReferences.size())) / nodeSurfaceArea;
+
+		// spatial splits only help when the object split children overlap
+		if (getSurfaceArea(intersectAABBs(leftAABB, rightAABB)) > minOverlapArea && referenceCount < maxReferenceCount)
+		{
+			double spatialCost = calculateSpatialSplit(axis, splitPoint, flatNode.aabb, references, spatialBins);
+
+			if (spatialCost < objectCost)
+			{
+				std::vector<FlatBVHReference> spatialLeftReferences;
+				std::vector<FlatBVHReference> spatialRightReferences;
+				uint64_t spatialReferenceCount = referenceCount;
+
+				for (const FlatBVHReference& reference : references)
+				{
+					if (reference.aabb.getMax().get(axis) <= splitPoint)
+						spatialLeftReferences.push_back(reference);
+					else if (reference.aabb.getMin().get(axis) >= splitPoint)
+						spatialRightReferences.push_back(reference);
+					else
+					{
+						FlatBVHReference leftReference;
+						FlatBVHReference rightReference;
+
+						splitReference(reference, axis, splitPoint, leftReference, rightReference);
+
+						// the primitive may only touch the split plane
+						if (isEmpty(leftReference.aabb))
+							spatialRightReferences.push_back(isEmpty(rightReference.aabb) ? reference : rightReference);
+						else if (isEmpty(rightReference.aabb))
+							spatialLeftReferences.push_back(leftReference);
+						else
+						{
+							spatialLeftReferences.push_back(leftReference);
+							spatialRightReferences.push_back(rightReference);
+							spatialReferenceCount++;
+						}
+					}
+				}
+
+				if (!spatialLeftReferences.empty() && !spatialRightReferences.empty() && spatialReferenceCount <= maxReferenceCount)
+				{
+					leftReferences.swap(spatialLeftReferences);
+					rightReferences.swap(spatialRightReferences);
+					referenceCount = spatialReferenceCount;
+				}
+			}
+		}
+
+		// push right child
+		stack.push_back({ std::move(rightReferences), nodeIndex });
+
+		// push left child
+		stack.push_back({ std::move(leftReferences), nodeIndex });
+	}
+
+	primitiveIndices.swap(referencedIndices);
+}
+
+double FlatBVH::calculateSpatialSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const std::vector<FlatBVHReference>& references, std::vector<FlatBVHSpatialBin>& bins) const
 {
-	if (ray.fastOcclusion && intersection.wasFound)
-		return true;
+	uint64_t binCount = bins.size();
+	uint64_t referenceCount = references.size();
+	double lowestScore = std::numeric_limits<double>::max();
+	double nodeSurfaceArea = nodeAABB.getSurfaceArea();
 
-	uint64_t stack[128];
-	uint64_t stackptr = 0;
-	bool wasFound = false;
+	for (uint64_t tempAxis = 0; tempAxis <= 2; ++tempAxis)
+	{
+		double minPoint = nodeAABB.getMin().get(tempAxis);
+		double extent = nodeAABB.getExtent().get(tempAxis);
 
-	// push to stack
-	stack[stackptr] = 0;
-	stackptr++;
+		if (extent <= 0.0)
+			continue;
 
-	while (stackptr > 0)
-	{
-		// pop from stack
-		stackptr--;
-		uint64_t index = stack[stackptr];
-		FlatBVHNode flatNode = flatNodes[index];
+		double binScale = double(binCount) / extent;
+		double binSize = extent / double(binCount);
 
-		// leaf node -> intersect with all its primitives
-		if (flatNode.rightOffset == 0)
+		for (FlatBVHSpatialBin& bin : bins)
+		{
+			bin.aabb = AABB();
+			bin.entryCount = 0;
+			bin.exitCount = 0;
+		}
+
+		for (const FlatBVHReference& reference : references)
 		{
-			for (uint64_t i = 0; i < flatNode.primitiveCount; ++i)
+			uint64_t firstBin = std::min(binCount - 1, uint64_t(std::max(0.0, (reference.aabb.getMin().get(tempAxis) - minPoint) * binScale)));
+			uint64_t lastBin = std::min(binCount - 1, uint64_t(std::max(0.0, (reference.aabb.getMax().get(tempAxis) - minPoint) * binScale)));
+			lastBin = std::max(firstBin, lastBin);
+
+			FlatBVHReference remainingReference = reference;
+
+			// clip the reference to every bin it overlaps
+			for (uint64_t i = firstBin; i < lastBin; ++i)
 			{
-				if (orderedPrimitives[flatNode.startOffset + i]->intersect(ray, intersection, intersections))
-				{
-					if (ray.fastOcclusion)
-						return true;
+				FlatBVHReference leftReference;
+				FlatBVHReference rightReference;
 
-					wasFound = true;
-				}
+				splitReference(remainingReference, tempAxis, minPoint + double(i + 1) * binSize, leftReference, rightReference);
+				bins[i].aabb.expand(leftReference.aabb);
+				remainingReference = rightReference;
 			}
+
+			bins[lastBin].aabb.expand(remainingReference.aabb);
+			bins[firstBin].entryCount++;
+			bins[lastBin].exitCount++;
 		}
-		else // travel down the tree
+
+		AABB rightAABB;
+		uint64_t rightCount = 0;
+
+		// rightCost of bin i is the cost of everything after the boundary following it
+		for (uint64_t i = binCount - 1; i > 0; --i)
+		{
+			rightAABB.expand(bins[i].aabb);
+			rightCount += bins[i].exitCount;
+			bins[i - 1].rightCost = getSurfaceArea(rightAABB) * double(rightCount);
+		}
+
+		AABB leftAABB;
+		uint64_t leftCount = 0;
+		uint64_t leftExitCount = 0;
+
+		for (uint64_t i = 0; i < binCount - 1; ++i)
 		{
-			// right child
-			if (flatNodes[index + uint64_t(flatNode.rightOffset)].aabb.intersects(ray))
+			leftAABB.expand(bins[i].aabb);
+			leftCount += bins[i].entryCount;
+			leftExitCount += bins[i].exitCount;
+
+			if (leftCount == 0 || leftExitCount == referenceCount)
+				continue;
+
+			double score = (getSurfaceArea(leftAABB) * double(leftCount) + bins[i].rightCost) / nodeSurfaceArea;
+
+			if (score < lowestScore)
 			{
-				stack[stackptr] = index + uint64_t(flatNode.rightOffset);
-				stackptr++;
+				axis = tempAxis;
+				splitPoint = minPoint + double(i + 1) * binSize;
+				lowestScore = score;
 			}
+		}
+	}
+
+	return lowestScore;
+}
+
+void FlatBVH::splitReference(const FlatBVHReference& reference, uint64_t axis, double splitPoint, FlatBVHReference& leftReference, FlatBVHReference& rightReference) const
+{
+	leftReference.primitiveIndex = reference.primitiveIndex;
+	rightReference.primitiveIndex = reference.primitiveIndex;
 
-			// left child
-			if (flatNodes[index + 1].aabb.intersects(ray))
+	// the build input is only available when building from primitives
+	const Triangle* triangle = orderedPrimitives.empty() ? nullptr : dynamic_cast<const Triangle*>(orderedPrimitives[reference.primitiveIndex]);
+
+	// triangles are clipped exactly, other primitives only by their bounds
+	if (triangle != nullptr)
+	{
+		leftReference.aabb = AABB();
+		rightReference.aabb = AABB();
+
+		for (uint64_t i = 0; i < 3; ++i)
+		{
+			const Vector3& v0 = triangle->vertices[i];
+			const Vector3& v1 = triangle->vertices[(i + 1) % 3];
+			double p0 = v0.get(axis);
+			double p1 = v1.get(axis);
+
+			if (p0 <= splitPoint)
+				leftReference.aabb.expand(v0);
+
+			if (p0 >= splitPoint)
+				rightReference.aabb.expand(v0);
+
+			// edge crosses the split plane
+			if ((p0 < splitPoint && p1 > splitPoint) || (p0 > splitPoint && p1 < splitPoint))
 			{
-				stack[stackptr] = index + 1;
-				stackptr++;
+				Vector3 edgePoint = Vector3::lerp(v0, v1, (splitPoint - p0) / (p1 - p0));
+				edgePoint.set(axis, splitPoint);
+
+				leftReference.aabb.expand(edgePoint);
+				rightReference.aabb.expand(edgePoint);
 			}
 		}
 	}
+	else
+	{
+		leftReference.aabb = reference.aabb;
+		rightReference.aabb = reference.aabb;
+	}
 
-	return wasFound;
+	Vector3 leftMax = reference.aabb.getMax();
+	Vector3 rightMin = reference.aabb.getMin();
+	leftMax.set(axis, splitPoint);
+	rightMin.set(axis, splitPoint);
+
+	// earlier splits may have clipped the reference already
+	leftReference.aabb = intersectAABBs(leftReference.aabb, AABB::createFromMinMax(reference.aabb.getMin(), leftMax));
+	rightReference.aabb = intersectAABBs(rightReference.aabb, AABB::createFromMinMax(rightMin, reference.aabb.getMax()));
 }
 
-AABB FlatBVH::getAABB() const
+void FlatBVH::buildCompactNodes()
 {
-	return aabb;
+	// nothing to traverse
+	if (flatNodes.empty() || flatNodes[0].primitiveCount == 0)
+		return;
+
+	if (flatNodes.size() > uint64_t(std::numeric_limits<uint32_t>::max()) || getReferenceCount(flatNodes) > uint64_t(std::numeric_limits<uint32_t>::max()))
+		throw std::runtime_error("Too many BVH nodes or primitives for compact nodes");
+
+	compactNodes.resize(flatNodes.size());
+
+	for (uint64_t i = 0; i < flatNodes.size(); ++i)
+	{
+		const FlatBVHNode& flatNode = flatNodes[i];
+		FlatBVHCompactNode& compactNode = compactNodes[i];
+
+		setCompactNodeBounds(compactNode, flatNode.aabb);
+
+		if (flatNode.rightOffset == 0)
+		{
+			compactNode.offset = uint32_t(flatNode.startOffset);
+			compactNode.primitiveCount = uint32_t(flatNode.primitiveCount);
+		}
+		else
+		{
+			compactNode.offset = uint32_t(flatNode.rightOffset);
+			compactNode.primitiveCount = 0;
+		}
+	}
 }
 
-void FlatBVH::transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate)
+void FlatBVH::buildTrianglePackets()
+{
+	trianglePackets.clear();
+	primitivePackets.clear();
+
+	// triangle meshes have their own leaf primitives
+	if (orderedPrimitives.empty() || orderedPrimitiveIds.size() != orderedPrimitives.size())
+		return;
+
+	primitivePackets.resize(orderedPrimitives.size(), NO_TRIANGLE_PACKET);
+	std::vector<std::pair<Primitive*, uint64_t>> leafPrimitives;
+
+	auto isTriangle = [](const std::pair<Primitive*, uint64_t>& primitive)
+	{
+		return dynamic_cast<Triangle*>(primitive.first) != nullptr;
+	};
+
+	for (const FlatBVHNode& flatNode : flatNodes)
+	{
+		if (flatNode.rightOffset != 0)
+			continue;
+
+		uint64_t start = flatNode.startOffset;
+		uint64_t end = start + flatNode.primitiveCount;
+
+		leafPrimitives.clear();
+
+		for (uint64_t i = start; i < end; ++i)
+			leafPrimitives.push_back(std::make_pair(orderedPrimitives[i], orderedPrimitiveIds[i]));
+
+		// triangles first in the leaf so that they are consecutive for the packets
+		auto trianglesEnd = std::stable_partition(leafPrimitives.begin(), leafPrimitives.end(), isTriangle);
+		uint64_t triangleCount = uint64_t(trianglesEnd - leafPrimitives.begin());
+
+		for (uint64_t i = 0; i < leafPrimitives.size(); ++i)
+		{
+			orderedPrimitives[start + i] = leafPrimitives[i].first;
+			orderedPrimitiveIds[start + i] = leafPrimitives[i].second;
+		}
+
+		for (uint64_t i = 0; i < triangleCount; i += 4)
+		{
+			FlatBVHTrianglePacket packet;
+			memset(&packet, 0, sizeof(FlatBVHTrianglePacket));
+			packet.triangleCount = uint32_t(std::min(uint64_t(4), triangleCount - i));
+
+			for (uint64_t lane = 0; lane < packet.triangleCount; ++lane)
+				setPacketTriangle(packet, lane, orderedPrimitives[start + i + lane]);
+
+			primitivePackets[start + i] = uint32_t(trianglePackets.size());
+			trianglePackets.push_back(packet);
+		}
+	}
+
+	if (trianglePackets.size() >= uint64_t(NO_TRIANGLE_PACKET))
+		throw std::runtime_error("Too many triangle packets");
+}
+
+void FlatBVH::setPacketTriangle(FlatBVHTrianglePacket& packet, uint64_t lane, const Primitive* primitive) const
 {
-	(void)scale;
-	(void)rotate;
-	(void)translate;
+	// the packets only contain triangles
+	const Triangle* triangle = static_cast<const Triangle*>(primitive);
+
+	for (uint64_t vertex = 0; vertex < 3; ++vertex)
+	{
+		for (uint64_t axis = 0; axis < 3; ++axis)
+			packet.vertices[vertex][axis][lane] = triangle->intersectionVertices[vertex * 3 + axis];
+	}
 }
 
-void FlatBVH::build(const std::vector<Primitive*>& primitives, const BVHBuildInfo& buildInfo)
+void FlatBVH::buildQBVH()
 {
-	Log& log = App::getLog();
+	if (flatNodes.empty())
+		return;
 
-	log.logInfo("Building BVH (primitives: %d)", primitives.size());
+	if (flatNodes.size() > uint64_t(std::numeric_limits<int32_t>::max()) || getReferenceCount(flatNodes) > uint64_t(std::numeric_limits<int32_t>::max()))
+		throw std::runtime_error("Too many BVH nodes or primitives for QBVH conversion");
 
-	auto startTime = std::chrono::high_resolution_clock::now();
+	std::vector<std::pair<uint64_t, uint64_t>> stack;
 
-	std::random_device rd;
-	std::mt19937 generator(rd());
+	// flat node index, qbvh node index
+	stack.push_back(std::make_pair(0, 0));
+	qbvhNodes.emplace_back();
+	qbvhFlatIndices.resize(4);
 
-	FlatBVHBuildEntry stack[128];
-	orderedPrimitives = primitives;
-	flatNodes.clear();
+	while (!stack.empty())
+	{
+		uint64_t flatIndex = stack.back().first;
+		uint64_t qbvhIndex = stack.back().second;
+		stack.pop_back();
 
+		uint64_t children[4];
+		uint64_t childCount = 0;
+
+		// only the root can be a leaf
+		if (flatNodes[flatIndex].rightOffset == 0)
+			children[childCount++] = flatIndex;
+		else
+		{
+			children[childCount++] = flatIndex + 1;
+			children[childCount++] = flatIndex + uint64_t(flatNodes[flatIndex].rightOffset);
+		}
+
+		// pull up grandchildren until all slots are used, largest inner child first
+		while (childCount < 4)
+		{
+			uint64_t largestChild = childCount;
+			double largestArea = -1.0;
+
+			for (uint64_t i = 0; i < childCount; ++i)
+			{
+				const FlatBVHNode& flatNode = flatNodes[children[i]];
+
+				if (flatNode.rightOffset != 0 && flatNode.aabb.getSurfaceArea() > largestArea)
+				{
+					largestChild = i;
+					largestArea = flatNode.aabb.getSurfaceArea();
+				}
+			}
+
+			if (largestChild == childCount)
+				break;
+
+			uint64_t innerIndex = children[largestChild];
+			children[largestChild] = innerIndex + 1;
+			children[childCount++] = innerIndex + uint64_t(flatNodes[innerIndex].rightOffset);
+		}
+
+		FlatQBVHNode qbvhNode;
+
+		for (uint64_t i = 0; i < 4; ++i)
+		{
+			// empty slots have inverted bounds and no primitives
+			if (i >= childCount)
+			{
+				for (uint64_t axis = 0; axis < 3; ++axis)
+				{
+					qbvhNode.bounds[axis][i] = std::numeric_limits<float>::max();
+					qbvhNode.bounds[axis + 3][i] = std::numeric_limits<float>::lowest();
+				}
+
+				qbvhNode.childOffset[i] = 0;
+				qbvhNode.primitiveCount[i] = 0;
+				qbvhFlatIndices[qbvhIndex * 4 + i] = NO_QBVH_CHILD;
+
+				continue;
+			}
+
+			const FlatBVHNode& flatNode = flatNodes[children[i]];
+			setQBVHChildBounds(qbvhNode, i, flatNode.aabb);
+			qbvhFlatIndices[qbvhIndex * 4 + i] = uint32_t(children[i]);
+
+			if (flatNode.rightOffset == 0)
+			{
+				qbvhNode.childOffset[i] = int32_t(flatNode.startOffset);
+				qbvhNode.primitiveCount[i] = int32_t(flatNode.primitiveCount);
+			}
+			else
+			{
+				qbvhNode.childOffset[i] = int32_t(qbvhNodes.size());
+				qbvhNode.primitiveCount[i] = -1;
+
+				stack.push_back(std::make_pair(children[i], qbvhNodes.size()));
+				qbvhNodes.emplace_back();
+				qbvhFlatIndices.resize(qbvhNodes.size() * 4);
+			}
+		}
+
+		qbvhNodes[qbvhIndex] = qbvhNode;
+	}
+}
+
+void FlatBVH::buildSubtree(uint64_t start, uint64_t end, std::vector<FlatBVHNode>& nodes, const BVHBuildInfo& buildInfo, FlatBVHBuildThreadData& threadData)
+{
+	FlatBVHBuildEntry stack[128];
 	uint64_t stackptr = 0;
-	uint64_t nodeCount = 0;
-	uint64_t leafCount = 0;
-	uint64_t actualNodeCount = 0;
 
 	enum { ROOT = -4, UNVISITED = -3, VISITED_TWICE = -1 };
 
 	// push to stack
-	stack[stackptr].start = 0;
-	stack[stackptr].end = orderedPrimitives.size();
+	stack[stackptr].start = start;
+	stack[stackptr].end = end;
 	stack[stackptr].parent = ROOT;
 	stackptr++;
 
 	while (stackptr > 0)
 	{
 		stackptr--;
-		nodeCount++;
 
 		// pop from stack
 		FlatBVHNode flatNode;
 		FlatBVHBuildEntry buildEntry = stack[stackptr];
-		flatNode.rightOffset = UNVISITED;
-		flatNode.startOffset = buildEntry.start;
-		flatNode.primitiveCount = buildEntry.end - buildEntry.start;
+		uint64_t middle;
 
-		for (uint64_t i = buildEntry.start; i < buildEntry.end; ++i)
-			flatNode.aabb.expand(orderedPrimitives[i]->getAABB());
-
-		// leaf node indicated by rightOffset == 0
-		if (flatNode.primitiveCount <= buildInfo.maxLeafSize)
-		{
-			flatNode.rightOffset = 0;
-			leafCount++;
-		}
+		buildNode(flatNode, buildEntry, middle, buildInfo, threadData);
 
-		flatNodes.push_back(flatNode);
+		int64_t nodeIndex = int64_t(nodes.size());
+		nodes.push_back(flatNode);
 
 		// update the parent rightOffset when visiting its right child
 		if (buildEntry.parent != ROOT)
 		{
-			flatNodes[uint64_t(buildEntry.parent)].rightOffset++;
+			nodes[uint64_t(buildEntry.parent)].rightOffset++;
 
-			if (flatNodes[uint64_t(buildEntry.parent)].rightOffset == VISITED_TWICE)
-				flatNodes[uint64_t(buildEntry.parent)].rightOffset = int64_t(nodeCount) - 1 - buildEntry.parent;
+			if (nodes[uint64_t(buildEntry.parent)].rightOffset == VISITED_TWICE)
+				nodes[uint64_t(buildEntry.parent)].rightOffset = nodeIndex - buildEntry.parent;
 		}
 
 		// leaf node -> no further subdivision
 		if (flatNode.rightOffset == 0)
 			continue;
 
-		uint64_t axis;
-		double splitPoint;
-		actualNodeCount++;
-
-		if (buildInfo.useSAH)
-			calculateSAHSplit(axis, splitPoint, flatNode.aabb, buildInfo, buildEntry);
-		else
-			calculateSplit(axis, splitPoint, flatNode.aabb, buildInfo, buildEntry, generator);
-
-		uint64_t middle = buildEntry.start;
-
-		// partition primitive range by the split point
-		for (uint64_t i = buildEntry.start; i < buildEntry.end; ++i)
-		{
-			if (orderedPrimitives[i]->getAABB().getCenter().get(axis) <= splitPoint)
-			{
-				std::swap(orderedPrimitives[i], orderedPrimitives[middle]);
-				middle++;
-			}
-		}
-
-		// partition failed -> fallback
-		if (middle == buildEntry.start || middle == buildEntry.end)
-			middle = buildEntry.start + (buildEntry.end - buildEntry.start) / 2;
-
 		// push right child
 		stack[stackptr].start = middle;
 		stack[stackptr].end = buildEntry.end;
-		stack[stackptr].parent = int64_t(nodeCount) - 1;
+		stack[stackptr].parent = nodeIndex;
 		stackptr++;
 
 		// push left child
 		stack[stackptr].start = buildEntry.start;
 		stack[stackptr].end = middle;
-		stack[stackptr].parent = int64_t(nodeCount) - 1;
+		stack[stackptr].parent = nodeIndex;
 		stackptr++;
 	}
+}
 
-	hasBeenBuilt = true;
-	aabb = flatNodes[0].aabb;
+void FlatBVH::buildNode(FlatBVHNode& flatNode, const FlatBVHBuildEntry& buildEntry, uint64_t& middle, const BVHBuildInfo& buildInfo, FlatBVHBuildThreadData& threadData)
+{
+	enum { UNVISITED = -3 };
 
-	orderedPrimitiveIds.clear();
+	flatNode.rightOffset = UNVISITED;
+	flatNode.startOffset = buildEntry.start;
+	flatNode.primitiveCount = buildEntry.end - buildEntry.start;
 
-	for (const Primitive* primitive : orderedPrimitives)
-		orderedPrimitiveIds.push_back(primitive->id);
+	AABB centerAABB;
 
-	auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
-	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsedTime).count();
+	for (uint64_t i = buildEntry.start; i < buildEntry.end; ++i)
+	{
+		flatNode.aabb.expand(primitiveAABBs[i]);
+		centerAABB.expand(primitiveCenters[i]);
+	}
 
-	log.logInfo("BVH building finished (time: %d ms, nodes: %d, leafs: %d)", milliseconds, nodeCount, leafCount);
-}
+	// leaf node indicated by rightOffset == 0
+	if (flatNode.primitiveCount <= buildInfo.maxLeafSize)
+	{
+		flatNode.rightOffset = 0;
+		return;
+	}
 
-void FlatBVH::restore(const Scene& scene)
-{
-	orderedPrimitives.clear();
+	uint64_t axis;
+	double splitPoint;
 
-	for (uint64_t primitiveId : orderedPrimitiveIds)
-		orderedPrimitives.push_back(scene.primitivesMap.at(primitiveId));
+	if (buildInfo.useSAH && buildInfo.useBinnedSAH)
+		calculateBinnedSAHSplit(axis, splitPoint, flatNode.aabb, centerAABB, primitiveAABBs, primitiveCenters, buildEntry, threadData);
+	else if (buildInfo.useSAH)
+		calculateSAHSplit(axis, splitPoint, flatNode.aabb, buildInfo, buildEntry, threadData);
+	else
+		calculateSplit(axis, splitPoint, flatNode.aabb, buildInfo, buildEntry, threadData);
+
+	middle = buildEntry.start;
+
+	// partition primitive range by the split point
+	for (uint64_t i = buildEntry.start; i < buildEntry.end; ++i)
+	{
+		if (primitiveCenters[i].get(axis) <= splitPoint)
+		{
+			std::swap(primitiveIndices[i], primitiveIndices[middle]);
+			std::swap(primitiveAABBs[i], primitiveAABBs[middle]);
+			std::swap(primitiveCenters[i], primitiveCenters[middle]);
+			middle++;
+		}
+	}
 
-	return;
+	// partition failed -> fallback
+	if (middle == buildEntry.start || middle == buildEntry.end)
+		middle = buildEntry.start + (buildEntry.end - buildEntry.start) / 2;
 }
 
-void FlatBVH::calculateSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry, std::mt19937& generator)
+void FlatBVH::calculateSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData)
 {
+	std::mt19937& generator = threadData.generator;
+
 	if (buildInfo.axisSelection == BVHAxisSelection::LARGEST)
 		axis = nodeAABB.getLargestAxis();
 	else if (buildInfo.axisSelection == BVHAxisSelection::RANDOM)
@@ -228,7 +2409,7 @@ void FlatBVH::calculateSplit(uint64_t& axis, double& splitPoint, const AABB& nod
 	if (buildInfo.axisSplit == BVHAxisSplit::MIDDLE)
 		splitPoint = nodeAABB.getCenter().get(axis);
 	else if (buildInfo.axisSplit == BVHAxisSplit::MEDIAN)
-		splitPoint = calculateMedianPoint(axis, buildEntry);
+		splitPoint = calculateMedianPoint(axis, buildEntry, threadData);
 	else if (buildInfo.axisSplit == BVHAxisSplit::RANDOM)
 	{
 		std::uniform_real_distribution<double> randomDouble(nodeAABB.getMin().get(axis), nodeAABB.getMax().get(axis));
@@ -238,7 +2419,7 @@ void FlatBVH::calculateSplit(uint64_t& axis, double& splitPoint, const AABB& nod
 		throw std::runtime_error("Unknown BVH axis split");
 }
 
-void FlatBVH::calculateSAHSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry)
+void FlatBVH::calculateSAHSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData)
 {
 	double lowestScore = std::numeric_limits<double>::max();
 
@@ -254,7 +2435,7 @@ void FlatBVH::calculateSAHSplit(uint64_t& axis, double& splitPoint, const AABB&
 			lowestScore = score;
 		}
 
-		tempSplitPoint = calculateMedianPoint(tempAxis, buildEntry);
+		tempSplitPoint = calculateMedianPoint(tempAxis, buildEntry, threadData);
 		score = calculateSAHScore(tempAxis, tempSplitPoint, nodeAABB, buildEntry);
 
 		if (score < lowestScore)
@@ -285,6 +2466,76 @@ void FlatBVH::calculateSAHSplit(uint64_t& axis, double& splitPoint, const AABB&
 	}
 }
 
+// bin the primitive centers and evaluate the SAH at the bin boundaries with one sweep per axis
+void FlatBVH::calculateBinnedSAHSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const AABB& centerAABB, const std::vector<AABB>& aabbs, const std::vector<Vector3>& centers, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData)
+{
+	std::vector<FlatBVHBin>& bins = threadData.bins;
+	uint64_t binCount = bins.size();
+	double lowestScore = std::numeric_limits<double>::max();
+	double nodeSurfaceArea = nodeAABB.getSurfaceArea();
+
+	// used if all the centers are at the same point
+	axis = centerAABB.getLargestAxis();
+	splitPoint = centerAABB.getCenter().get(axis);
+
+	for (uint64_t tempAxis = 0; tempAxis <= 2; ++tempAxis)
+	{
+		double minCenter = centerAABB.getMin().get(tempAxis);
+		double extent = centerAABB.getExtent().get(tempAxis);
+
+		if (extent <= 0.0)
+			continue;
+
+		double binScale = double(binCount) / extent;
+
+		for (FlatBVHBin& bin : bins)
+		{
+			bin.aabb = AABB();
+			bin.primitiveCount = 0;
+		}
+
+		for (uint64_t i = buildEntry.start; i < buildEntry.end; ++i)
+		{
+			uint64_t binIndex = std::min(binCount - 1, uint64_t((centers[i].get(tempAxis) - minCenter) * binScale));
+
+			bins[binIndex].aabb.expand(aabbs[i]);
+			bins[binIndex].primitiveCount++;
+		}
+
+		AABB rightAABB;
+		uint64_t rightCount = 0;
+
+		// rightCost of bin i is the cost of everything after the boundary following it
+		for (uint64_t i = binCount - 1; i > 0; --i)
+		{
+			rightAABB.expand(bins[i].aabb);
+			rightCount += bins[i].primitiveCount;
+			bins[i - 1].rightCost = (rightCount > 0) ? rightAABB.getSurfaceArea() * double(rightCount) : 0.0;
+		}
+
+		AABB leftAABB;
+		uint64_t leftCount = 0;
+
+		for (uint64_t i = 0; i < binCount - 1; ++i)
+		{
+			leftAABB.expand(bins[i].aabb);
+			leftCount += bins[i].primitiveCount;
+
+			if (leftCount == 0 || leftCount == (buildEntry.end - buildEntry.start))
+				continue;
+
+			double score = (leftAABB.getSurfaceArea() * double(leftCount) + bins[i].rightCost) / nodeSurfaceArea;
+
+			if (score < lowestScore)
+			{
+				axis = tempAxis;
+				splitPoint = minCenter + double(i + 1) / binScale;
+				lowestScore = score;
+			}
+		}
+	}
+}
+
 double FlatBVH::calculateSAHScore(uint64_t axis, double splitPoint, const AABB& nodeAABB, const FlatBVHBuildEntry& buildEntry)
 {
 	assert(buildEntry.end != buildEntry.start);
@@ -295,9 +2546,9 @@ double FlatBVH::calculateSAHScore(uint64_t axis, double splitPoint, const AABB&
 
 	for (uint64_t i = buildEntry.start; i < buildEntry.end; ++i)
 	{
-		AABB primitiveAABB = orderedPrimitives[i]->getAABB();
+		const AABB& primitiveAABB = primitiveAABBs[i];
 
-		if (primitiveAABB.getCenter().get(axis) <= splitPoint)
+		if (primitiveCenters[i].get(axis) <= splitPoint)
 		{
 			leftAABB.expand(primitiveAABB);
 			leftCount++;
@@ -320,23 +2571,33 @@ double FlatBVH::calculateSAHScore(uint64_t axis, double splitPoint, const AABB&
 	return score;
 }
 
-double FlatBVH::calculateMedianPoint(uint64_t axis, const FlatBVHBuildEntry& buildEntry)
+double FlatBVH::calculateMedianPoint(uint64_t axis, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData)
 {
-	std::vector<double> centerPoints;
+	std::vector<double>& medianPoints = threadData.medianPoints;
+
+	medianPoints.clear();
 
 	for (uint64_t i = buildEntry.start; i < buildEntry.end; ++i)
-		centerPoints.push_back(orderedPrimitives[i]->getAABB().getCenter().get(axis));
+		medianPoints.push_back(primitiveCenters[i].get(axis));
 
-	std::sort(centerPoints.begin(), centerPoints.end());
-	uint64_t size = centerPoints.size();
+	uint64_t size = medianPoints.size();
 	double median;
 
 	assert(size >= 2);
 
+	auto middle = medianPoints.begin() + int64_t(size / 2);
+	std::nth_element(medianPoints.begin(), middle, medianPoints.end());
+	median = *middle;
+
+	// the lower middle element is the largest one of the lower half
 	if (size % 2 == 0)
-		median = (centerPoints[size / 2 - 1] + centerPoints[size / 2]) / 2.0;
-	else
-		median = centerPoints[size / 2];
+		median = (*std::max_element(medianPoints.begin(), middle) + median) / 2.0;
 
 	return median;
 }
+
+// leaf primitive types of the shared traversal
+template bool FlatBVH::traverse(FlatBVH& leafPrimitives, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+template bool FlatBVH::traverse(TriangleMesh& leafPrimitives, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+template bool FlatBVH::traverseOcclusion(FlatBVH& leafPrimitives, const Ray& ray);
+template bool FlatBVH::traverseOcclusion(TriangleMesh& leafPrimitives, const Ray& ray);
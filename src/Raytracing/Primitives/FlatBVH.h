@@ -3,11 +3,15 @@
 
 #pragma once
 
+#include <chrono>
 #include <random>
 #include <vector>
 
+#include <boost/align/aligned_allocator.hpp>
+
 #include "cereal/cereal.hpp"
 
+#include "Common.h"
 #include "Raytracing/Primitives/Primitive.h"
 #include "Raytracing/AABB.h"
 
@@ -20,18 +24,34 @@ namespace Raycer
 	{
 		uint64_t maxLeafSize = 5;
 		bool useSAH = true;
+		bool useBinnedSAH = false;
+		uint64_t sahBinCount = 16;
 		uint64_t regularSAHSplits = 0;
 		BVHAxisSelection axisSelection = BVHAxisSelection::LARGEST;
 		BVHAxisSplit axisSplit = BVHAxisSplit::MEDIAN;
+		bool useQBVH = false;
+		double refitRebuildThreshold = 0.5; // rebuild when refitting has increased the SAH cost by this fraction
+		bool useSpatialSplits = false; // binned SAH with split primitive references, always serial
+		double spatialSplitBudget = 0.3; // maximum fraction of duplicated primitive references
+		bool useLinearBuild = false; // fast Morton code build, overrides the other split options
+		uint64_t treeletRestructurePasses = 0; // SAH optimization passes after the linear build
 
 		template <class Archive>
 		void serialize(Archive& ar)
 		{
 			ar(CEREAL_NVP(maxLeafSize),
 				CEREAL_NVP(useSAH),
+				CEREAL_NVP(useBinnedSAH),
+				CEREAL_NVP(sahBinCount),
 				CEREAL_NVP(regularSAHSplits),
 				CEREAL_NVP(axisSelection),
-				CEREAL_NVP(axisSplit));
+				CEREAL_NVP(axisSplit),
+				CEREAL_NVP(useQBVH),
+				CEREAL_NVP(refitRebuildThreshold),
+				CEREAL_NVP(useSpatialSplits),
+				CEREAL_NVP(spatialSplitBudget),
+				CEREAL_NVP(useLinearBuild),
+				CEREAL_NVP(treeletRestructurePasses));
 		}
 	};
 
@@ -52,6 +72,38 @@ namespace Raycer
 		}
 	};
 
+	// float copy of FlatBVHNode used for traversal, half a cache line
+	struct FlatBVHCompactNode
+	{
+		float min[3];
+		uint32_t offset; // right child offset for inner nodes, first primitive for leafs
+		float max[3];
+		uint32_t primitiveCount; // 0 -> inner node
+	};
+
+	static_assert(sizeof(FlatBVHCompactNode) == 32, "FlatBVHCompactNode should be 32 bytes");
+
+	using AlignedFlatBVHCompactNodeVector = std::vector<FlatBVHCompactNode, boost::alignment::aligned_allocator<FlatBVHCompactNode, CACHE_LINE_SIZE>>;
+
+	// four child nodes collapsed from the binary tree, bounds in SoA layout for SSE
+	struct FlatQBVHNode
+	{
+		float bounds[6][4]; // min x/y/z, max x/y/z
+		int32_t childOffset[4]; // qbvh node index or the first primitive of a leaf
+		int32_t primitiveCount[4]; // -1 -> inner node
+	};
+
+	using AlignedFlatQBVHNodeVector = std::vector<FlatQBVHNode, boost::alignment::aligned_allocator<FlatQBVHNode, CACHE_LINE_SIZE>>;
+
+	// up to four consecutive leaf triangles with the vertices in SoA layout for SSE
+	struct alignas(16) FlatBVHTrianglePacket
+	{
+		float vertices[3][3][4]; // vertex, axis, lane
+		uint32_t triangleCount;
+	};
+
+	using AlignedFlatBVHTrianglePacketVector = std::vector<FlatBVHTrianglePacket, boost::alignment::aligned_allocator<FlatBVHTrianglePacket, CACHE_LINE_SIZE>>;
+
 	struct FlatBVHBuildEntry
 	{
 		uint64_t start;
@@ -59,11 +111,44 @@ namespace Raycer
 		int64_t parent;
 	};
 
+	struct FlatBVHBin
+	{
+		AABB aabb;
+		uint64_t primitiveCount = 0;
+		double rightCost = 0.0;
+	};
+
+	// primitive bounds clipped to a node, spatial splits can reference a primitive from several leafs
+	struct FlatBVHReference
+	{
+		AABB aabb;
+		uint64_t primitiveIndex;
+	};
+
+	struct FlatBVHSpatialBin
+	{
+		AABB aabb;
+		uint64_t entryCount = 0;
+		uint64_t exitCount = 0;
+		double rightCost = 0.0;
+	};
+
+	struct FlatBVHBuildThreadData
+	{
+		explicit FlatBVHBuildThreadData(const BVHBuildInfo& buildInfo);
+
+		std::mt19937 generator;
+		std::vector<FlatBVHBin> bins;
+		std::vector<double> medianPoints;
+	};
+
 	class Scene;
 	class Ray;
 	struct Intersection;
 	class Vector3;
 	class EulerAngle;
+	class Matrix4x4;
+	class TriangleMesh;
 
 	class FlatBVH : public Primitive
 	{
@@ -74,24 +159,81 @@ namespace Raycer
 
 		void initialize(const Scene& scene) override;
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
+		bool occluded(const Ray& ray) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
 
 		void build(const std::vector<Primitive*>& primitives, const BVHBuildInfo& buildInfo);
-		void restore(const Scene& scene);
+		void build(std::vector<AABB> aabbs, const BVHBuildInfo& buildInfo, std::vector<uint64_t>& orderedIndices);
+		void restore(const Scene& scene, const BVHBuildInfo& buildInfo);
+		void refit();
+		double calculateSAHCost() const;
+		AABB getTransformedAABB(const Matrix4x4& transformation) const;
+
+		// T::intersectPrimitive(index, ...) is called for the leaf primitives, instantiated for FlatBVH and TriangleMesh
+		template <typename T>
+		bool traverse(T& leafPrimitives, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+
+		// T::occludedPrimitive(index, ray) is called for the leaf primitives
+		template <typename T>
+		bool traverseOcclusion(T& leafPrimitives, const Ray& ray);
+
+		bool intersectPrimitive(uint64_t index, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+		bool occludedPrimitive(uint64_t index, const Ray& ray);
 
 		bool hasBeenBuilt = false;
+		double builtSAHCost = 0.0;
 		std::vector<FlatBVHNode> flatNodes;
 		std::vector<uint64_t> orderedPrimitiveIds;
 
 		std::vector<Primitive*> orderedPrimitives;
+		AlignedFlatBVHCompactNodeVector compactNodes;
+		AlignedFlatQBVHNodeVector qbvhNodes;
+		std::vector<uint32_t> qbvhFlatIndices; // flat node of each qbvh child for the refit, kept out of the nodes to not grow them
+		AlignedFlatBVHTrianglePacketVector trianglePackets;
+		std::vector<uint32_t> primitivePackets; // packet starting at each ordered primitive, or none
 
 	private:
 
-		void calculateSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry, std::mt19937& generator);
-		void calculateSAHSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry);
+		template <typename T>
+		bool traverseQBVH(T& leafPrimitives, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+
+		template <typename T>
+		bool intersectLeaf(T& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+		bool intersectLeaf(FlatBVH& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+
+		template <typename T>
+		bool traverseQBVHOcclusion(T& leafPrimitives, const Ray& ray);
+
+		template <typename T>
+		bool occludedLeaf(T& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray);
+		bool occludedLeaf(FlatBVH& leafPrimitives, uint64_t startOffset, uint64_t primitiveCount, const Ray& ray);
+
+		void buildHierarchy(const BVHBuildInfo& buildInfo);
+		void logBuildFinished(std::chrono::high_resolution_clock::time_point startTime) const;
+		void initializeTraversal(const BVHBuildInfo& buildInfo);
+		bool loadFromCache(const std::string& fileName, const std::vector<Primitive*>& primitives, uint64_t cacheKey);
+		void saveToCache(const std::string& fileName, const std::vector<Primitive*>& primitives, uint64_t cacheKey) const;
+		void buildLinear(const BVHBuildInfo& buildInfo, int32_t threadCount);
+		void buildWithSpatialSplits(const BVHBuildInfo& buildInfo);
+		double calculateSpatialSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const std::vector<FlatBVHReference>& references, std::vector<FlatBVHSpatialBin>& bins) const;
+		void splitReference(const FlatBVHReference& reference, uint64_t axis, double splitPoint, FlatBVHReference& leftReference, FlatBVHReference& rightReference) const;
+		void buildCompactNodes();
+		void buildQBVH();
+		void buildTrianglePackets();
+		void setPacketTriangle(FlatBVHTrianglePacket& packet, uint64_t lane, const Primitive* primitive) const;
+		void buildSubtree(uint64_t start, uint64_t end, std::vector<FlatBVHNode>& nodes, const BVHBuildInfo& buildInfo, FlatBVHBuildThreadData& threadData);
+		void buildNode(FlatBVHNode& flatNode, const FlatBVHBuildEntry& buildEntry, uint64_t& middle, const BVHBuildInfo& buildInfo, FlatBVHBuildThreadData& threadData);
+		void calculateSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData);
+		void calculateSAHSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const BVHBuildInfo& buildInfo, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData);
+		void calculateBinnedSAHSplit(uint64_t& axis, double& splitPoint, const AABB& nodeAABB, const AABB& centerAABB, const std::vector<AABB>& aabbs, const std::vector<Vector3>& centers, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData);
 		double calculateSAHScore(uint64_t axis, double splitPoint, const AABB& nodeAABB, const FlatBVHBuildEntry& buildEntry);
-		double calculateMedianPoint(uint64_t axis, const FlatBVHBuildEntry& buildEntry);
+		double calculateMedianPoint(uint64_t axis, const FlatBVHBuildEntry& buildEntry, FlatBVHBuildThreadData& threadData);
+
+		// build time only, primitiveIndices is reordered by the builders and the others are indexed in the same order
+		std::vector<AABB> primitiveAABBs;
+		std::vector<Vector3> primitiveCenters;
+		std::vector<uint64_t> primitiveIndices;
 
 		friend class cereal::access;
 
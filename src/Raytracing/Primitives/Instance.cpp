@@ -4,6 +4,8 @@
 #include "stdafx.h"
 
 #include "Raytracing/Primitives/Instance.h"
+#include "Raytracing/Primitives/PrimitiveGroup.h"
+#include "Raytracing/Primitives/TriangleMesh.h"
 #include "Raytracing/Scene.h"
 #include "Raytracing/Ray.h"
 #include "Raytracing/Intersection.h"
@@ -11,6 +13,7 @@
 #include "Raytracing/Material.h"
 #include "Math/ONB.h"
 #include "Math/Vector2.h"
+#include "Utils/ScratchBuffer.h"
 
 using namespace Raycer;
 
@@ -18,18 +21,7 @@ void Raycer::Instance::initialize(const Scene& scene)
 {
 	(void)scene;
 
-	Vector3 position = primitive->getAABB().getCenter();
-
-	Matrix4x4 scaling = Matrix4x4::scale(scale);
-	Matrix4x4 rotation = Matrix4x4::rotateXYZ(rotate);
-	Matrix4x4 translation1 = Matrix4x4::translate(-position);
-	Matrix4x4 translation2 = Matrix4x4::translate(position + translate);
-
-	cachedTransformation = translation2 * rotation * scaling * translation1;
-	cachedTransformationInv = cachedTransformation.inverted();
-	cachedTransformationInvT = cachedTransformationInv.transposed();
-
-	aabb = primitive->getAABB().transformed(scale, rotate, translate);
+	updateTransformation();
 }
 
 bool Instance::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
@@ -42,19 +34,8 @@ bool Instance::intersect(const Ray& ray, Intersection& intersection, std::vector
 
 	if (isTimeVariant)
 	{
-		Vector3 position = primitive->getAABB().getCenter();
-		Vector3 newScale = scale + ray.time * scaleInTime;
-		EulerAngle newRotate = rotate + ray.time * rotateInTime;
-		Vector3 newTranslate = translate + ray.time * translateInTime;
-
-		Matrix4x4 scaling = Matrix4x4::scale(newScale);
-		Matrix4x4 rotation = Matrix4x4::rotateXYZ(newRotate);
-		Matrix4x4 translation1 = Matrix4x4::translate(-position);
-		Matrix4x4 translation2 = Matrix4x4::translate(position + newTranslate);
-
-		Matrix4x4 newTransformation = translation2 * rotation * scaling * translation1;
-		Matrix4x4 newTransformationInv = newTransformation.inverted();
-		Matrix4x4 newTransformationInvT = newTransformationInv.transposed();
+		Matrix4x4 newTransformation, newTransformationInv, newTransformationInvT;
+		calculateTransformation(ray.time, newTransformation, newTransformationInv, newTransformationInvT);
 
 		return internalIntersect(ray, intersection, intersections, newTransformation, newTransformationInv, newTransformationInvT);
 	}
@@ -62,37 +43,73 @@ bool Instance::intersect(const Ray& ray, Intersection& intersection, std::vector
 		return internalIntersect(ray, intersection, intersections, cachedTransformation, cachedTransformationInv, cachedTransformationInvT);
 }
 
+bool Instance::occluded(const Ray& ray)
+{
+	if (ray.isShadowRay && material->nonShadowing)
+		return false;
+
+	if (isTimeVariant)
+	{
+		Matrix4x4 newTransformation, newTransformationInv, newTransformationInvT;
+		calculateTransformation(ray.time, newTransformation, newTransformationInv, newTransformationInvT);
+
+		return internalOccluded(ray, newTransformationInv);
+	}
+	else
+		return internalOccluded(ray, cachedTransformationInv);
+}
+
+void Instance::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	// nested instances are resolved already at hit time
+	if (intersection.instancedSurfacePrimitive == nullptr)
+		return;
+
+	if (isTimeVariant)
+	{
+		Matrix4x4 newTransformation, newTransformationInv, newTransformationInvT;
+		calculateTransformation(ray.time, newTransformation, newTransformationInv, newTransformationInvT);
+
+		internalComputeSurfaceData(ray, intersection, newTransformation, newTransformationInv, newTransformationInvT);
+	}
+	else
+		internalComputeSurfaceData(ray, intersection, cachedTransformation, cachedTransformationInv, cachedTransformationInvT);
+}
+
 bool Instance::internalIntersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections, const Matrix4x4& transformation, const Matrix4x4& transformationInv, const Matrix4x4& transformationInvT)
 {
-	Ray instanceRay;
 	Intersection instanceIntersection;
-	std::vector<Intersection> instanceIntersections;
+	ScratchBuffer<Intersection> instanceIntersectionBuffer;
+	std::vector<Intersection>& instanceIntersections = instanceIntersectionBuffer.get();
+
+	double distanceScale;
+	Ray instanceRay = createInstanceRay(ray, transformationInv, distanceScale);
+
+	// closest hit so far in instance space lets the group BVH cull farther nodes
+	if (!ray.collectAllIntersections && intersection.wasFound)
+		instanceRay.maxDistance = std::min(intersection.distance, ray.maxDistance) * distanceScale * (1.0 + 1.0e-9);
 
-	instanceRay.origin = transformationInv.transformPosition(ray.origin);
-	instanceRay.direction = transformationInv.transformDirection(ray.direction).normalized();
-	instanceRay.time = ray.time;
 	instanceRay.fastOcclusion = ray.fastOcclusion;
 	instanceRay.isShadowRay = ray.isShadowRay;
-	instanceRay.precalculate();
+	instanceRay.collectAllIntersections = ray.collectAllIntersections;
 
 	bool wasFound = primitive->intersect(instanceRay, instanceIntersection, instanceIntersections);
 
+	// collected intersections are consumed by CSG right away, their surface data is resolved eagerly
 	for (Intersection& tempIntersection : instanceIntersections)
 	{
-		Vector3 position = transformation.transformPosition(tempIntersection.position);
-
-		tempIntersection.distance = (position - ray.origin).length();
-		tempIntersection.position = position;
-		tempIntersection.normal = transformationInvT.transformDirection(tempIntersection.normal).normalized();
-		tempIntersection.onb = tempIntersection.onb.transformed(transformationInvT);
+		tempIntersection.surfacePrimitive->computeSurfaceData(instanceRay, tempIntersection);
+		tempIntersection.distance /= distanceScale;
+		resolveSurfaceData(tempIntersection, transformation, transformationInvT);
+		tempIntersection.surfacePrimitive = this;
+		tempIntersection.instancedSurfacePrimitive = nullptr;
 
 		intersections.push_back(tempIntersection);
 	}
 
 	if (wasFound)
 	{
-		Vector3 position = transformation.transformPosition(instanceIntersection.position);
-		double t = (position - ray.origin).length();
+		double t = instanceIntersection.distance / distanceScale;
 
 		if (t < ray.minDistance || t > ray.maxDistance)
 			return false;
@@ -100,14 +117,23 @@ bool Instance::internalIntersect(const Ray& ray, Intersection& intersection, std
 		if (t > intersection.distance)
 			return false;
 
-		intersection.wasFound = true;
+		Primitive* instancedSurfacePrimitive = instanceIntersection.surfacePrimitive;
+
+		// a nested instance would need its own instancedSurfacePrimitive, resolve it here instead
+		if (instanceIntersection.instancePrimitive != nullptr)
+		{
+			instanceIntersection.surfacePrimitive->computeSurfaceData(instanceRay, instanceIntersection);
+			resolveSurfaceData(instanceIntersection, transformation, transformationInvT);
+			instancedSurfacePrimitive = nullptr;
+		}
+
+		// the hit data of the instanced primitive (barycentrics, box face normal) is carried along as is
+		intersection = instanceIntersection;
 		intersection.distance = t;
 		intersection.primitive = changePrimitive ? this : instanceIntersection.primitive;
 		intersection.instancePrimitive = this;
-		intersection.position = position;
-		intersection.normal = transformationInvT.transformDirection(instanceIntersection.normal).normalized();
-		intersection.onb = instanceIntersection.onb.transformed(transformationInvT);
-		intersection.texcoord = instanceIntersection.texcoord;
+		intersection.surfacePrimitive = this;
+		intersection.instancedSurfacePrimitive = instancedSurfacePrimitive;
 
 		return true;
 	}
@@ -115,27 +141,208 @@ bool Instance::internalIntersect(const Ray& ray, Intersection& intersection, std
 	return false;
 }
 
+bool Instance::internalOccluded(const Ray& ray, const Matrix4x4& transformationInv)
+{
+	double distanceScale;
+	Ray instanceRay = createInstanceRay(ray, transformationInv, distanceScale);
+
+	// the distance range scales with the direction, the unlimited ends may become infinite
+	instanceRay.minDistance = ray.minDistance * distanceScale;
+	instanceRay.maxDistance = ray.maxDistance * distanceScale;
+	instanceRay.isShadowRay = ray.isShadowRay;
+
+	return primitive->occluded(instanceRay);
+}
+
+void Instance::internalComputeSurfaceData(const Ray& ray, Intersection& intersection, const Matrix4x4& transformation, const Matrix4x4& transformationInv, const Matrix4x4& transformationInvT) const
+{
+	double distanceScale;
+	Ray instanceRay = createInstanceRay(ray, transformationInv, distanceScale);
+
+	Intersection instanceIntersection = intersection;
+	instanceIntersection.distance = intersection.distance * distanceScale;
+	instanceIntersection.instancePrimitive = nullptr;
+	instanceIntersection.surfacePrimitive = intersection.instancedSurfacePrimitive;
+	instanceIntersection.instancedSurfacePrimitive = nullptr;
+	instanceIntersection.surfacePrimitive->computeSurfaceData(instanceRay, instanceIntersection);
+
+	resolveSurfaceData(instanceIntersection, transformation, transformationInvT);
+
+	intersection.position = instanceIntersection.position;
+	intersection.normal = instanceIntersection.normal;
+	intersection.onb = instanceIntersection.onb;
+	intersection.texcoord = instanceIntersection.texcoord;
+	intersection.instancedSurfacePrimitive = nullptr;
+}
+
+Ray Instance::createInstanceRay(const Ray& ray, const Matrix4x4& transformationInv, double& distanceScale) const
+{
+	Ray instanceRay;
+
+	Vector3 instanceDirection = transformationInv.transformDirection(ray.direction);
+	distanceScale = instanceDirection.length();
+
+	instanceRay.origin = transformationInv.transformPosition(ray.origin);
+	instanceRay.direction = instanceDirection / distanceScale;
+	instanceRay.time = ray.time;
+	instanceRay.precalculate();
+
+	return instanceRay;
+}
+
+void Instance::resolveSurfaceData(Intersection& instanceIntersection, const Matrix4x4& transformation, const Matrix4x4& transformationInvT)
+{
+	instanceIntersection.position = transformation.transformPosition(instanceIntersection.position);
+	instanceIntersection.normal = transformationInvT.transformDirection(instanceIntersection.normal).normalized();
+	instanceIntersection.onb = instanceIntersection.onb.transformed(transformationInvT);
+}
+
+void Instance::calculateTransformation(double time, Matrix4x4& transformation, Matrix4x4& transformationInv, Matrix4x4& transformationInvT) const
+{
+	time = std::max(0.0, std::min(time, 1.0));
+
+	Vector3 newScale = scale + time * scaleInTime;
+	Vector3 newTranslate = translate + time * translateInTime;
+
+	if (rotationKeyframes.empty())
+		buildTransformation(newScale, cachedRotation, newTranslate, transformation, transformationInv, transformationInvT);
+	else
+		buildTransformation(newScale, interpolateRotation(time).toMatrix4x4(), newTranslate, transformation, transformationInv, transformationInvT);
+}
+
+// translate(pivot + T) * R * S * translate(-pivot), the inverse is put together from the parts instead of a general inversion
+void Instance::buildTransformation(const Vector3& newScale, const Matrix4x4& rotation, const Vector3& newTranslate, Matrix4x4& transformation, Matrix4x4& transformationInv, Matrix4x4& transformationInvT) const
+{
+	double s[3] = { newScale.x, newScale.y, newScale.z };
+	double p[3] = { pivot.x, pivot.y, pivot.z };
+	double q[3] = { pivot.x + newTranslate.x, pivot.y + newTranslate.y, pivot.z + newTranslate.z };
+
+	transformation = Matrix4x4::IDENTITY;
+	transformationInv = Matrix4x4::IDENTITY;
+
+	for (uint64_t r = 0; r < 3; ++r)
+	{
+		transformation.m[r][3] = q[r];
+		transformationInv.m[r][3] = p[r];
+
+		for (uint64_t c = 0; c < 3; ++c)
+		{
+			transformation.m[r][c] = rotation.m[r][c] * s[c];
+			transformationInv.m[r][c] = rotation.m[c][r] / s[r];
+		}
+
+		for (uint64_t c = 0; c < 3; ++c)
+		{
+			transformation.m[r][3] -= transformation.m[r][c] * p[c];
+			transformationInv.m[r][3] -= transformationInv.m[r][c] * q[c];
+		}
+	}
+
+	transformationInvT = transformationInv.transposed();
+}
+
+Quaternion Instance::interpolateRotation(double time) const
+{
+	double position = time * double(ROTATION_KEYFRAME_COUNT - 1);
+	uint64_t index = std::min(uint64_t(position), uint64_t(ROTATION_KEYFRAME_COUNT - 2));
+	double alpha = std::min(position - double(index), 1.0);
+
+	// the keyframes are close to each other, normalized lerp is enough
+	return Quaternion::lerp(rotationKeyframes[index], rotationKeyframes[index + 1], alpha).normalized();
+}
+
+AABB Instance::getTransformedPrimitiveAABB(const Matrix4x4& transformation) const
+{
+	// the group and mesh BVHs give tighter bounds for the root BVH than the transformed box
+	PrimitiveGroup* primitiveGroup = dynamic_cast<PrimitiveGroup*>(primitive);
+	TriangleMesh* triangleMesh = dynamic_cast<TriangleMesh*>(primitive);
+
+	if (primitiveGroup != nullptr)
+		return primitiveGroup->getTransformedAABB(transformation);
+	else if (triangleMesh != nullptr)
+		return triangleMesh->getTransformedAABB(transformation);
+	else
+		return primitive->getAABB().transformed(transformation);
+}
+
 AABB Instance::getAABB() const
 {
 	return aabb;
 }
 
+bool Instance::isUnbounded() const
+{
+	return primitive->isUnbounded();
+}
+
 void Instance::transform(const Vector3& scale_, const EulerAngle& rotate_, const Vector3& translate_)
 {
 	scale *= scale_;
 	rotate += rotate_;
 	translate += translate_;
 
-	Vector3 position = primitive->getAABB().getCenter();
+	updateTransformation();
+}
+
+void Instance::updateTransformation()
+{
+	pivot = primitive->getAABB().getCenter();
+	cachedRotation = Matrix4x4::rotateXYZ(rotate);
+	rotationKeyframes.clear();
+
+	buildTransformation(scale, cachedRotation, translate, cachedTransformation, cachedTransformationInv, cachedTransformationInvT);
+	aabb = getTransformedPrimitiveAABB(cachedTransformation);
+
+	if (!isTimeVariant || primitive->isUnbounded())
+		return;
+
+	bool rotatesInTime = (rotateInTime.pitch != 0.0 || rotateInTime.yaw != 0.0 || rotateInTime.roll != 0.0);
 
-	Matrix4x4 scaling = Matrix4x4::scale(scale);
-	Matrix4x4 rotation = Matrix4x4::rotateXYZ(rotate);
-	Matrix4x4 translation1 = Matrix4x4::translate(-position);
-	Matrix4x4 translation2 = Matrix4x4::translate(position + translate);
+	if (rotatesInTime)
+	{
+		for (uint64_t i = 0; i < ROTATION_KEYFRAME_COUNT; ++i)
+		{
+			EulerAngle keyframeRotate = rotate + (double(i) / double(ROTATION_KEYFRAME_COUNT - 1)) * rotateInTime;
+
+			Quaternion keyframe = Quaternion(Vector3(1.0, 0.0, 0.0), keyframeRotate.pitch) * Quaternion(Vector3(0.0, 1.0, 0.0), keyframeRotate.yaw) * Quaternion(Vector3(0.0, 0.0, 1.0), keyframeRotate.roll);
+
+			// keep the neighbours on the same hemisphere so that the interpolation takes the short way
+			if (i > 0 && keyframe.dot(rotationKeyframes.back()) < 0.0)
+				keyframe = -keyframe;
+
+			rotationKeyframes.push_back(keyframe.normalized());
+		}
+	}
+
+	// scale and translation are linear in time, so without rotation the bounds at the ends cover the whole motion
+	// between the rotation keyframes a point can move at most 2 * radius * angle away from the keyframe bounds
+	Vector3 halfExtent = primitive->getAABB().getExtent() / 2.0;
+	Vector3 maxScale = Vector3::abs(scale);
+	Vector3 endScale = Vector3::abs(scale + scaleInTime);
+	maxScale = Vector3(std::max(maxScale.x, endScale.x), std::max(maxScale.y, endScale.y), std::max(maxScale.z, endScale.z));
+	double radius = (halfExtent * maxScale).length();
 
-	cachedTransformation = translation2 * rotation * scaling * translation1;
-	cachedTransformationInv = cachedTransformation.inverted();
-	cachedTransformationInvT = cachedTransformationInv.transposed();
+	uint64_t sampleCount = rotatesInTime ? ROTATION_KEYFRAME_COUNT : 2;
+	AABB previousAABB;
 
-	aabb = primitive->getAABB().transformed(scale, rotate, translate);
+	for (uint64_t i = 0; i < sampleCount; ++i)
+	{
+		Matrix4x4 transformation, transformationInv, transformationInvT;
+		calculateTransformation(double(i) / double(sampleCount - 1), transformation, transformationInv, transformationInvT);
+
+		AABB sampleAABB = getTransformedPrimitiveAABB(transformation);
+		aabb.expand(sampleAABB);
+
+		if (rotatesInTime && i > 0)
+		{
+			double angle = 2.0 * acos(std::min(std::abs(rotationKeyframes[i - 1].dot(rotationKeyframes[i])), 1.0));
+			Vector3 padding = Vector3(1.0, 1.0, 1.0) * (2.0 * radius * angle);
+
+			AABB segmentAABB = previousAABB;
+			segmentAABB.expand(sampleAABB);
+			aabb.expand(AABB::createFromMinMax(segmentAABB.getMin() - padding, segmentAABB.getMax() + padding));
+		}
+
+		previousAABB = sampleAABB;
+	}
 }
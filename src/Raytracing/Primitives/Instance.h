@@ -11,6 +11,7 @@
 #include "Math/Vector3.h"
 #include "Math/EulerAngle.h"
 #include "Math/Matrix4x4.h"
+#include "Math/Quaternion.h"
 
 namespace Raycer
 {
@@ -27,8 +28,11 @@ namespace Raycer
 
 		void initialize(const Scene& scene) override;
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
+		bool occluded(const Ray& ray) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		bool isUnbounded() const override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
 
 		uint64_t primitiveId = 0;
 
@@ -45,14 +49,31 @@ namespace Raycer
 
 	private:
 
+		void updateTransformation();
 		bool internalIntersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections, const Matrix4x4& transformation, const Matrix4x4& transformationInv, const Matrix4x4& transformationInvT);
+		bool internalOccluded(const Ray& ray, const Matrix4x4& transformationInv);
+		void internalComputeSurfaceData(const Ray& ray, Intersection& intersection, const Matrix4x4& transformation, const Matrix4x4& transformationInv, const Matrix4x4& transformationInvT) const;
+		Ray createInstanceRay(const Ray& ray, const Matrix4x4& transformationInv, double& distanceScale) const;
+		static void resolveSurfaceData(Intersection& instanceIntersection, const Matrix4x4& transformation, const Matrix4x4& transformationInvT);
+		void calculateTransformation(double time, Matrix4x4& transformation, Matrix4x4& transformationInv, Matrix4x4& transformationInvT) const;
+		void buildTransformation(const Vector3& newScale, const Matrix4x4& rotation, const Vector3& newTranslate, Matrix4x4& transformation, Matrix4x4& transformationInv, Matrix4x4& transformationInvT) const;
+		Quaternion interpolateRotation(double time) const;
+		AABB getTransformedPrimitiveAABB(const Matrix4x4& transformation) const;
+
+		static const uint64_t ROTATION_KEYFRAME_COUNT = 32;
 
 		Primitive* primitive = nullptr;
 
+		Vector3 pivot;
+		Matrix4x4 cachedRotation;
+
 		Matrix4x4 cachedTransformation;
 		Matrix4x4 cachedTransformationInv;
 		Matrix4x4 cachedTransformationInvT;
 
+		// time samples of the rotation over [0, 1], only when rotating in time
+		std::vector<Quaternion> rotationKeyframes;
+
 		friend class cereal::access;
 
 		template <class Archive>
@@ -55,12 +55,34 @@ bool Plane::intersect(const Ray& ray, Intersection& intersection, std::vector<In
 	if (t > intersection.distance)
 		return false;
 
-	// intersection position
-	Vector3 ip = ray.origin + (t * ray.direction);
-
 	intersection.wasFound = true;
 	intersection.distance = t;
 	intersection.primitive = this;
+	intersection.surfacePrimitive = this;
+
+	return true;
+}
+
+bool Plane::occluded(const Ray& ray)
+{
+	if (ray.isShadowRay && material->nonShadowing)
+		return false;
+
+	double denominator = ray.direction.dot(normal);
+
+	if (std::abs(denominator) < std::numeric_limits<double>::epsilon())
+		return false;
+
+	double t = (position - ray.origin).dot(normal) / denominator;
+
+	return (t >= 0.0 && t >= ray.minDistance && t <= ray.maxDistance);
+}
+
+void Plane::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	// intersection position
+	Vector3 ip = ray.origin + (intersection.distance * ray.direction);
+
 	intersection.position = ip;
 	intersection.normal = material->invertNormal ? -normal : normal;
 	intersection.onb = ONB::fromNormal(intersection.normal);
@@ -71,7 +93,10 @@ bool Plane::intersect(const Ray& ray, Intersection& intersection, std::vector<In
 
 	intersection.texcoord.x = u - floor(u);
 	intersection.texcoord.y = v - floor(v);
+}
 
+bool Plane::isUnbounded() const
+{
 	return true;
 }
 
@@ -26,8 +26,11 @@ namespace Raycer
 
 		void initialize(const Scene& scene) override;
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
+		bool occluded(const Ray& ray) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		bool isUnbounded() const override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
 
 		Vector3 position;
 		Vector3 normal;
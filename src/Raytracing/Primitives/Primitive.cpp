@@ -0,0 +1,35 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#include "Raytracing/Primitives/Primitive.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Utils/ScratchBuffer.h"
+
+using namespace Raycer;
+
+bool Primitive::occluded(const Ray& ray)
+{
+	Intersection intersection;
+	ScratchBuffer<Intersection> intersections;
+
+	return intersect(ray, intersection, intersections.get());
+}
+
+double Primitive::getArea() const
+{
+	return 0.0;
+}
+
+void Primitive::sampleSurface(std::mt19937& generator, Intersection& intersection) const
+{
+	(void)generator;
+	(void)intersection;
+}
+
+Vector3 Primitive::getGeometricNormal(const Intersection& intersection) const
+{
+	return intersection.normal;
+}
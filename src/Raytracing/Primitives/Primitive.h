@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <random>
 #include <vector>
 
 #include "cereal/cereal.hpp"
@@ -29,10 +30,36 @@ namespace Raycer
 		virtual AABB getAABB() const = 0;
 		virtual void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) = 0;
 
+		// any hit between ray.minDistance and ray.maxDistance, no hit data is written, the default falls back to intersect
+		virtual bool occluded(const Ray& ray);
+
+		// unbounded primitives are kept out of the root BVH
+		virtual bool isUnbounded() const
+		{
+			return false;
+		}
+
+		// called once for the closest hit after the traversal, the ray has to be the same that was intersected
+		virtual void computeSurfaceData(const Ray& ray, Intersection& intersection) const
+		{
+			(void)ray;
+			(void)intersection;
+		}
+
+		// area light sampling of the path tracer, primitives with a zero area are not sampled
+		virtual double getArea() const;
+
+		// uniformly distributed point on the surface, fills the position, geometric normal and texcoord
+		virtual void sampleSurface(std::mt19937& generator, Intersection& intersection) const;
+
+		// the normal the area pdf is measured against, differs from the hit normal if the normals are interpolated
+		virtual Vector3 getGeometricNormal(const Intersection& intersection) const;
+
 		uint64_t id = 0;
 		uint64_t materialId = 0;
 		bool invisible = false;
 		Material* material = nullptr;
+		int64_t emissiveIndex = -1; // to the emissive primitives of the scene, -1 -> not sampled as a light
 
 	protected:
 
@@ -8,6 +8,7 @@
 #include "Raytracing/Intersection.h"
 #include "Raytracing/AABB.h"
 #include "Raytracing/Material.h"
+#include "Math/Matrix4x4.h"
 
 using namespace Raycer;
 
@@ -26,7 +27,7 @@ void Raycer::PrimitiveGroup::initialize(const Scene& scene)
 	if (enableBVH)
 	{
 		if (bvh.hasBeenBuilt)
-			bvh.restore(scene);
+			bvh.restore(scene, bvhBuildInfo);
 		else
 			bvh.build(primitives, bvhBuildInfo);
 	}
@@ -61,6 +62,23 @@ bool PrimitiveGroup::intersect(const Ray& ray, Intersection& intersection, std::
 	}
 }
 
+bool PrimitiveGroup::occluded(const Ray& ray)
+{
+	if (ray.isShadowRay && material->nonShadowing)
+		return false;
+
+	if (enableBVH)
+		return bvh.occluded(ray);
+
+	for (Primitive* primitive : primitives)
+	{
+		if (primitive->occluded(ray))
+			return true;
+	}
+
+	return false;
+}
+
 AABB PrimitiveGroup::getAABB() const
 {
 	if (enableBVH)
@@ -69,6 +87,21 @@ AABB PrimitiveGroup::getAABB() const
 		return aabb;
 }
 
+AABB PrimitiveGroup::getTransformedAABB(const Matrix4x4& transformation) const
+{
+	if (enableBVH)
+		return bvh.getTransformedAABB(transformation);
+	else
+	{
+		AABB transformedAABB;
+
+		for (Primitive* primitive : primitives)
+			transformedAABB.expand(primitive->getAABB().transformed(transformation));
+
+		return transformedAABB;
+	}
+}
+
 void PrimitiveGroup::transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate)
 {
 	if (enableBVH)
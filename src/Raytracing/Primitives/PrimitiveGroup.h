@@ -17,6 +17,7 @@ namespace Raycer
 	class AABB;
 	class Vector3;
 	class EulerAngle;
+	class Matrix4x4;
 
 	class PrimitiveGroup : public Primitive
 	{
@@ -30,9 +31,12 @@ namespace Raycer
 
 		void initialize(const Scene& scene) override;
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
+		bool occluded(const Ray& ray) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
 
+		AABB getTransformedAABB(const Matrix4x4& transformation) const;
+
 		std::vector<uint64_t> primitiveIds;
 		bool enableBVH = true;
 		BVHBuildInfo bvhBuildInfo;
@@ -55,38 +55,12 @@ bool Sphere::intersect(const Ray& ray, Intersection& intersection, std::vector<I
 	{
 		Intersection tempIntersection;
 
-		Vector3 ip = ray.origin + (t * ray.direction);
-		Vector3 normal = (ip - position).normalized();
-
 		tempIntersection.wasFound = true;
 		tempIntersection.distance = t;
 		tempIntersection.primitive = this;
-		tempIntersection.position = ip;
-		tempIntersection.normal = material->invertNormal ? -normal : normal;
-		tempIntersection.onb = ONB::fromNormal(tempIntersection.normal);
+		tempIntersection.surfacePrimitive = this;
 		tempIntersection.direction = direction;
 
-		double u = 0.0;
-		double v = 0.0;
-
-		if (uvMapType == SphereUVMapType::SPHERICAL)
-		{
-			u = 0.5 - atan2(normal.z, normal.x) / (2.0 * M_PI);
-			v = 0.5 + asin(normal.y) / M_PI;
-		}
-		else if (uvMapType == SphereUVMapType::LIGHT_PROBE)
-		{
-			double r = (1.0 / M_PI) * acos(normal.z) / sqrt(normal.x * normal.x + normal.y * normal.y);
-			u = (r * normal.x + 1.0) / 2.0;
-			v = (r * normal.y + 1.0) / 2.0;
-		}
-
-		u *= material->texcoordScale.x;
-		v *= material->texcoordScale.y;
-
-		tempIntersection.texcoord.x = u - floor(u);
-		tempIntersection.texcoord.y = v - floor(v);
-
 		return tempIntersection;
 	};
 
@@ -113,6 +87,84 @@ bool Sphere::intersect(const Ray& ray, Intersection& intersection, std::vector<I
 	return true;
 }
 
+bool Sphere::occluded(const Ray& ray)
+{
+	if (ray.isShadowRay && material->nonShadowing)
+		return false;
+
+	Vector3 rayOriginToSphere = position - ray.origin;
+	double rayOriginToSphereDistance2 = rayOriginToSphere.lengthSquared();
+
+	double t1 = rayOriginToSphere.dot(ray.direction);
+	double sphereToRayDistance2 = rayOriginToSphereDistance2 - (t1 * t1);
+	double radius2 = radius * radius;
+
+	bool rayOriginIsOutside = (rayOriginToSphereDistance2 >= radius2);
+
+	if (rayOriginIsOutside && (t1 < 0.0 || sphereToRayDistance2 > radius2))
+		return false;
+
+	// same hit as the default intersection of intersect
+	double t2 = sqrt(radius2 - sphereToRayDistance2);
+	double t = (rayOriginIsOutside) ? (t1 - t2) : (t1 + t2);
+
+	return (t >= ray.minDistance && t <= ray.maxDistance);
+}
+
+void Sphere::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	Vector3 ip = ray.origin + (intersection.distance * ray.direction);
+	Vector3 normal = (ip - position).normalized();
+
+	intersection.position = ip;
+	intersection.normal = material->invertNormal ? -normal : normal;
+	intersection.onb = ONB::fromNormal(intersection.normal);
+	intersection.texcoord = getTexcoord(normal);
+}
+
+double Sphere::getArea() const
+{
+	return 4.0 * M_PI * radius * radius;
+}
+
+void Sphere::sampleSurface(std::mt19937& generator, Intersection& intersection) const
+{
+	std::uniform_real_distribution<double> random(0.0, 1.0);
+
+	double z = 1.0 - 2.0 * random(generator);
+	double r = sqrt(std::max(0.0, 1.0 - z * z));
+	double phi = 2.0 * M_PI * random(generator);
+
+	Vector3 normal(r * cos(phi), r * sin(phi), z);
+
+	intersection.position = position + normal * radius;
+	intersection.normal = normal;
+	intersection.texcoord = getTexcoord(normal);
+}
+
+Vector2 Sphere::getTexcoord(const Vector3& normal) const
+{
+	double u = 0.0;
+	double v = 0.0;
+
+	if (uvMapType == SphereUVMapType::SPHERICAL)
+	{
+		u = 0.5 - atan2(normal.z, normal.x) / (2.0 * M_PI);
+		v = 0.5 + asin(normal.y) / M_PI;
+	}
+	else if (uvMapType == SphereUVMapType::LIGHT_PROBE)
+	{
+		double r = (1.0 / M_PI) * acos(normal.z) / sqrt(normal.x * normal.x + normal.y * normal.y);
+		u = (r * normal.x + 1.0) / 2.0;
+		v = (r * normal.y + 1.0) / 2.0;
+	}
+
+	u *= material->texcoordScale.x;
+	v *= material->texcoordScale.y;
+
+	return Vector2(u - floor(u), v - floor(v));
+}
+
 AABB Sphere::getAABB() const
 {
 	return aabb;
@@ -16,6 +16,7 @@ namespace Raycer
 	struct Intersection;
 	class AABB;
 	class EulerAngle;
+	class Vector2;
 
 	enum class SphereUVMapType { SPHERICAL, LIGHT_PROBE };
 
@@ -28,8 +29,12 @@ namespace Raycer
 
 		void initialize(const Scene& scene) override;
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
+		bool occluded(const Ray& ray) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
+		double getArea() const override;
+		void sampleSurface(std::mt19937& generator, Intersection& intersection) const override;
 
 		Vector3 position;
 		double radius = 1.0;
@@ -37,6 +42,8 @@ namespace Raycer
 
 	private:
 
+		Vector2 getTexcoord(const Vector3& normal) const;
+
 		friend class cereal::access;
 
 		template <class Archive>
@@ -11,7 +11,8 @@
 #include "Raytracing/Material.h"
 #include "Math/ONB.h"
 #include "Math/EulerAngle.h"
-#include "Math/Polynomial.h"
+#include "Math/Matrix4x4.h"
+#include "Math/Solver.h"
 
 using namespace Raycer;
 
@@ -19,7 +20,7 @@ void Raycer::Torus::initialize(const Scene& scene)
 {
 	(void)scene;
 
-	aabb = AABB::createFromMinMax(Vector3(-outerRadius - innerRadius, -outerRadius - innerRadius, innerRadius), Vector3(outerRadius + innerRadius, outerRadius + innerRadius, -innerRadius));
+	updateLocalSpace();
 }
 
 bool Torus::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
@@ -32,24 +33,54 @@ bool Torus::intersect(const Ray& ray, Intersection& intersection, std::vector<In
 	if (ray.fastOcclusion && intersection.wasFound)
 		return true;
 
+	Vector3 positionToOrigin = ray.origin - position;
+	Vector3 origin = Vector3(positionToOrigin.dot(uAxis), positionToOrigin.dot(vAxis), positionToOrigin.dot(normal));
+	Vector3 direction = Vector3(ray.direction.dot(uAxis), ray.direction.dot(vAxis), ray.direction.dot(normal));
+
 	double innerRadius2 = innerRadius * innerRadius;
 	double outerRadius2 = outerRadius * outerRadius;
+	double boundingRadius = outerRadius + innerRadius;
+
+	double alpha = direction.dot(direction);
+	QuadraticResult boundingResult = Solver::findQuadraticRoots(alpha, 2.0 * origin.dot(direction), origin.dot(origin) - boundingRadius * boundingRadius);
 
-	double alpha = ray.direction.dot(ray.direction);
-	double beta = 2.0 * (ray.origin.dot(ray.direction));
-	double gamma = ray.origin.dot(ray.origin) - innerRadius2 - outerRadius2;
+	if (boundingResult.rootCount == 0 || boundingResult.roots[1] < 0.0)
+		return false;
+
+	if (boundingResult.roots[0] > std::min(ray.maxDistance, intersection.distance))
+		return false;
 
-	double coefficients[5];
-	coefficients[0] = alpha * alpha;
-	coefficients[1] = 2.0 * alpha * beta;
-	coefficients[2] = beta * beta + 2.0 * alpha * gamma + 4.0 * outerRadius2 * ray.direction.z * ray.direction.z;
-	coefficients[3] = 2.0 * beta * gamma + 8.0 * outerRadius2 * ray.origin.z * ray.direction.z;
-	coefficients[4] = gamma * gamma + 4.0 * outerRadius2 * ray.origin.z * ray.origin.z - 4.0 * outerRadius2 * innerRadius2;
+	// the quartic loses precision with a far away origin, start from the bounding sphere instead
+	double offset = std::max(boundingResult.roots[0], 0.0);
+	origin += offset * direction;
+
+	double beta = 2.0 * (origin.dot(direction));
+	double gamma = origin.dot(origin) - innerRadius2 - outerRadius2;
+
+	QuarticResult result = Solver::findQuarticRoots(
+		alpha * alpha,
+		2.0 * alpha * beta,
+		beta * beta + 2.0 * alpha * gamma + 4.0 * outerRadius2 * direction.z * direction.z,
+		2.0 * beta * gamma + 8.0 * outerRadius2 * origin.z * direction.z,
+		gamma * gamma + 4.0 * outerRadius2 * origin.z * origin.z - 4.0 * outerRadius2 * innerRadius2);
 
-	Polynomial<5> polynomial(coefficients);
 	double t = std::numeric_limits<double>::max();
+	bool wasFound = false;
+
+	for (uint64_t i = 0; i < result.rootCount; ++i)
+	{
+		double rootDistance = offset + result.roots[i];
+
+		if (rootDistance > 0.0 && rootDistance >= ray.minDistance)
+		{
+			t = rootDistance;
+			wasFound = true;
 
-	if (!polynomial.findSmallestPositiveRealRoot(t, 32, 0.0001, 0.01))
+			break;
+		}
+	}
+
+	if (!wasFound)
 		return false;
 
 	if (t < ray.minDistance || t > ray.maxDistance)
@@ -58,25 +89,35 @@ bool Torus::intersect(const Ray& ray, Intersection& intersection, std::vector<In
 	if (t > intersection.distance)
 		return false;
 
-	Vector3 ip = ray.origin + (t * ray.direction);
-	Vector3 normal;
+	intersection.wasFound = true;
+	intersection.distance = t;
+	intersection.primitive = this;
+	intersection.surfacePrimitive = this;
+
+	return true;
+}
+
+void Torus::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	double innerRadius2 = innerRadius * innerRadius;
+	double outerRadius2 = outerRadius * outerRadius;
 
-	double temp = 4.0 * (ip.x * ip.x + ip.y * ip.y + ip.z * ip.z - innerRadius2 - outerRadius2);
+	Vector3 ip = ray.origin + (intersection.distance * ray.direction);
+	Vector3 positionToIp = ip - position;
+	Vector3 localIp = Vector3(positionToIp.dot(uAxis), positionToIp.dot(vAxis), positionToIp.dot(normal));
 
-	normal.x = ip.x * temp;
-	normal.y = ip.y * temp;
-	normal.z = ip.z * temp + 8.0 * outerRadius2 * ip.z;
+	double temp = 4.0 * (localIp.x * localIp.x + localIp.y * localIp.y + localIp.z * localIp.z - innerRadius2 - outerRadius2);
 
-	normal.normalize();
+	Vector3 localNormal;
+	localNormal.x = localIp.x * temp;
+	localNormal.y = localIp.y * temp;
+	localNormal.z = localIp.z * temp + 8.0 * outerRadius2 * localIp.z;
+
+	Vector3 ipNormal = (localNormal.x * uAxis + localNormal.y * vAxis + localNormal.z * normal).normalized();
 
-	intersection.wasFound = true;
-	intersection.distance = t;
-	intersection.primitive = this;
 	intersection.position = ip;
-	intersection.normal = material->invertNormal ? -normal : normal;
+	intersection.normal = material->invertNormal ? -ipNormal : ipNormal;
 	intersection.onb = ONB::fromNormal(intersection.normal);
-
-	return true;
 }
 
 AABB Torus::getAABB() const
@@ -86,11 +127,29 @@ AABB Torus::getAABB() const
 
 void Torus::transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate)
 {
-	(void)rotate;
-	(void)translate;
+	Matrix4x4 rotation = Matrix4x4::rotateXYZ(rotate);
 
+	position += translate;
+	normal = rotation.transformDirection(normal);
 	outerRadius *= scale.x;
 	innerRadius *= scale.x;
 
-	aabb = AABB::createFromMinMax(Vector3(-outerRadius - innerRadius, -outerRadius - innerRadius, innerRadius), Vector3(outerRadius + innerRadius, outerRadius + innerRadius, -innerRadius));
+	updateLocalSpace();
+}
+
+void Torus::updateLocalSpace()
+{
+	normal.normalize();
+
+	ONB onb = ONB::fromNormal(normal);
+	uAxis = onb.u;
+	vAxis = onb.v;
+
+	// the ring spans the outer radius on the axes perpendicular to the normal
+	Vector3 extent;
+	extent.x = outerRadius * sqrt(std::max(0.0, 1.0 - normal.x * normal.x)) + innerRadius;
+	extent.y = outerRadius * sqrt(std::max(0.0, 1.0 - normal.y * normal.y)) + innerRadius;
+	extent.z = outerRadius * sqrt(std::max(0.0, 1.0 - normal.z * normal.z)) + innerRadius;
+
+	aabb = AABB::createFromMinMax(position - extent, position + extent);
 }
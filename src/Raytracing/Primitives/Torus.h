@@ -28,18 +28,29 @@ namespace Raycer
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
 
+		Vector3 position = Vector3(0.0, 0.0, 0.0);
+		Vector3 normal = Vector3(0.0, 0.0, 1.0);
 		double outerRadius = 1.0;
 		double innerRadius = 0.25;
 
 	private:
 
+		void updateLocalSpace();
+
+		// the local space has the torus at the origin and the normal along the z-axis
+		Vector3 uAxis;
+		Vector3 vAxis;
+
 		friend class cereal::access;
 
 		template <class Archive>
 		void serialize(Archive& ar)
 		{
 			ar(cereal::make_nvp("primitive", cereal::base_class<Primitive>(this)),
+				CEREAL_NVP(position),
+				CEREAL_NVP(normal),
 				CEREAL_NVP(outerRadius),
 				CEREAL_NVP(innerRadius));
 		}
@@ -43,11 +43,9 @@ void Raycer::Triangle::initialize(const Scene& scene)
 		bitangent = tangent.cross(normal).normalized();
 	}
 
-	aabb = AABB::createFromVertices(vertices[0], vertices[1], vertices[2]);
+	precalculate();
 }
 
-// Möller-Trumbore algorithm
-// http://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection
 bool Triangle::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
 {
 	(void)intersections;
@@ -58,31 +56,57 @@ bool Triangle::intersect(const Ray& ray, Intersection& intersection, std::vector
 	if (ray.fastOcclusion && intersection.wasFound)
 		return true;
 
-	Vector3 v0v1 = vertices[1] - vertices[0];
-	Vector3 v0v2 = vertices[2] - vertices[0];
+	double t, u, v;
 
-	Vector3 pvec = ray.direction.cross(v0v2);
-	double determinant = v0v1.dot(pvec);
+	if (!intersectDistance(ray, intersection.distance, t, u, v))
+		return false;
 
-	// ray and triangle are parallel -> no intersection
-	if (std::abs(determinant) < std::numeric_limits<double>::epsilon())
+	intersection.wasFound = true;
+	intersection.distance = t;
+	intersection.primitive = this;
+	intersection.surfacePrimitive = this;
+	intersection.barycentric = Vector2(u, v);
+
+	return true;
+}
+
+bool Triangle::occluded(const Ray& ray)
+{
+	if (ray.isShadowRay && material->nonShadowing)
 		return false;
 
-	double invDeterminant = 1.0 / determinant;
+	double t, u, v;
+
+	return intersectDistance(ray, std::numeric_limits<double>::max(), t, u, v);
+}
+
+void Triangle::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	double u = intersection.barycentric.x;
+	double v = intersection.barycentric.y;
+	double w = 1.0 - u - v;
 
-	Vector3 tvec = ray.origin - vertices[0];
-	double u = tvec.dot(pvec) * invDeterminant;
+	Vector3 finalNormal = material->normalInterpolation ? (w * normals[0] + u * normals[1] + v * normals[2]) : normal;
 
-	if (u < 0.0 || u > 1.0)
+	intersection.position = ray.origin + (intersection.distance * ray.direction);
+	intersection.normal = material->invertNormal ? -finalNormal : finalNormal;
+	intersection.onb = ONB(tangent, bitangent, intersection.normal);
+	intersection.texcoord = getTexcoord(u, v);
+}
+
+bool Triangle::intersectDistance(const Ray& ray, double maxDistance, double& t, double& u, double& v) const
+{
+	if (!intersectVertices(&intersectionVertices[0], &intersectionVertices[3], &intersectionVertices[6], ray, u, v))
 		return false;
 
-	Vector3 qvec = tvec.cross(v0v1);
-	double v = ray.direction.dot(qvec) * invDeterminant;
+	// the distance is solved again in double precision against the plane so that the hit point stays on the surface
+	double denominator = ray.direction.dot(normal);
 
-	if (v < 0.0 || (u + v) > 1.0)
+	// ray and triangle are parallel -> no intersection
+	if (std::abs(denominator) < std::numeric_limits<double>::epsilon())
 		return false;
 
-	double t = v0v2.dot(qvec) * invDeterminant;
+	t = (vertices[0] - ray.origin).dot(normal) / denominator;
 
 	if (t < 0.0)
 		return false;
@@ -90,34 +114,59 @@ bool Triangle::intersect(const Ray& ray, Intersection& intersection, std::vector
 	if (t < ray.minDistance || t > ray.maxDistance)
 		return false;
 
-	if (t > intersection.distance)
+	if (t > maxDistance)
 		return false;
 
-	double w = 1.0 - u - v;
+	if (material->maskMapTexture != nullptr)
+	{
+		Vector3 ip = ray.origin + (t * ray.direction);
 
-	Vector2 texcoord = (w * texcoords[0] + u * texcoords[1] + v * texcoords[2]) * material->texcoordScale;
-	Vector3 ip = ray.origin + (t * ray.direction);
+		if (material->maskMapTexture->getValue(getTexcoord(u, v), ip) < 0.5)
+			return false;
+	}
 
-	texcoord.x = texcoord.x - floor(texcoord.x);
-	texcoord.y = texcoord.y - floor(texcoord.y);
+	return true;
+}
 
-	if (material->maskMapTexture != nullptr)
+double Triangle::getArea() const
+{
+	return 0.5 * (vertices[1] - vertices[0]).cross(vertices[2] - vertices[0]).length();
+}
+
+void Triangle::sampleSurface(std::mt19937& generator, Intersection& intersection) const
+{
+	std::uniform_real_distribution<double> random(0.0, 1.0);
+
+	// folding the unit square to the triangle keeps the distribution uniform
+	double u = random(generator);
+	double v = random(generator);
+
+	if (u + v > 1.0)
 	{
-		if (material->maskMapTexture->getValue(texcoord, ip) < 0.5)
-			return false;
+		u = 1.0 - u;
+		v = 1.0 - v;
 	}
 
-	Vector3 finalNormal = material->normalInterpolation ? (w * normals[0] + u * normals[1] + v * normals[2]) : normal;
+	intersection.position = (1.0 - u - v) * vertices[0] + u * vertices[1] + v * vertices[2];
+	intersection.normal = normal;
+	intersection.texcoord = getTexcoord(u, v);
+}
 
-	intersection.wasFound = true;
-	intersection.distance = t;
-	intersection.primitive = this;
-	intersection.position = ip;
-	intersection.normal = material->invertNormal ? -finalNormal : finalNormal;
-	intersection.onb = ONB(tangent, bitangent, intersection.normal);
-	intersection.texcoord = texcoord;
+Vector3 Triangle::getGeometricNormal(const Intersection& intersection) const
+{
+	(void)intersection;
 
-	return true;
+	return normal;
+}
+
+Vector2 Triangle::getTexcoord(double u, double v) const
+{
+	Vector2 texcoord = ((1.0 - u - v) * texcoords[0] + u * texcoords[1] + v * texcoords[2]) * material->texcoordScale;
+
+	texcoord.x = texcoord.x - floor(texcoord.x);
+	texcoord.y = texcoord.y - floor(texcoord.y);
+
+	return texcoord;
 }
 
 AABB Triangle::getAABB() const
@@ -148,5 +197,71 @@ void Triangle::transform(const Vector3& scale, const EulerAngle& rotate, const V
 	tangent = transformationInvT.transformDirection(tangent).normalized();
 	bitangent = transformationInvT.transformDirection(bitangent).normalized();
 
+	precalculate();
+}
+
+// Woop, Benthin, Wald - Watertight Ray/Triangle Intersection
+// http://jcgt.org/published/0002/01/05/
+bool Triangle::intersectVertices(const float* vertex0, const float* vertex1, const float* vertex2, const Ray& ray, double& u, double& v)
+{
+	uint32_t axisX = ray.shearAxes[0];
+	uint32_t axisY = ray.shearAxes[1];
+	uint32_t axisZ = ray.shearAxes[2];
+
+	float origin[3] = { float(ray.origin.x), float(ray.origin.y), float(ray.origin.z) };
+
+	// vertices relative to the ray origin
+	float a[3] = { vertex0[0] - origin[0], vertex0[1] - origin[1], vertex0[2] - origin[2] };
+	float b[3] = { vertex1[0] - origin[0], vertex1[1] - origin[1], vertex1[2] - origin[2] };
+	float c[3] = { vertex2[0] - origin[0], vertex2[1] - origin[1], vertex2[2] - origin[2] };
+
+	// shear and scale so that the ray points along positive z
+	float ax = a[axisX] - ray.shearFactors[0] * a[axisZ];
+	float ay = a[axisY] - ray.shearFactors[1] * a[axisZ];
+	float bx = b[axisX] - ray.shearFactors[0] * b[axisZ];
+	float by = b[axisY] - ray.shearFactors[1] * b[axisZ];
+	float cx = c[axisX] - ray.shearFactors[0] * c[axisZ];
+	float cy = c[axisY] - ray.shearFactors[1] * c[axisZ];
+
+	// scaled barycentric coordinates from the 2D edge functions
+	double edge0 = double(cx * by - cy * bx);
+	double edge1 = double(ax * cy - ay * cx);
+	double edge2 = double(bx * ay - by * ax);
+
+	// exact zero can be a rounding artifact, the edge is recalculated in double precision
+	if (edge0 == 0.0 || edge1 == 0.0 || edge2 == 0.0)
+	{
+		edge0 = double(cx) * double(by) - double(cy) * double(bx);
+		edge1 = double(ax) * double(cy) - double(ay) * double(cx);
+		edge2 = double(bx) * double(ay) - double(by) * double(ax);
+	}
+
+	// both windings are accepted
+	if ((edge0 < 0.0 || edge1 < 0.0 || edge2 < 0.0) && (edge0 > 0.0 || edge1 > 0.0 || edge2 > 0.0))
+		return false;
+
+	double determinant = edge0 + edge1 + edge2;
+
+	if (determinant == 0.0)
+		return false;
+
+	u = edge1 / determinant;
+	v = edge2 / determinant;
+
+	return true;
+}
+
+void Triangle::precalculate()
+{
 	aabb = AABB::createFromVertices(vertices[0], vertices[1], vertices[2]);
+
+	for (uint64_t i = 0; i < 3; ++i)
+	{
+		intersectionVertices[i * 3] = float(vertices[i].x);
+		intersectionVertices[i * 3 + 1] = float(vertices[i].y);
+		intersectionVertices[i * 3 + 2] = float(vertices[i].z);
+
+		// the rounded vertices may be slightly outside of the original ones
+		aabb.expand(Vector3(intersectionVertices[i * 3], intersectionVertices[i * 3 + 1], intersectionVertices[i * 3 + 2]));
+	}
 }
@@ -24,11 +24,20 @@ namespace Raycer
 
 		friend class Scene;
 		friend class CLScene;
+		friend class FlatBVH;
 
 		void initialize(const Scene& scene) override;
 		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
+		bool occluded(const Ray& ray) override;
 		AABB getAABB() const override;
 		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
+		double getArea() const override;
+		void sampleSurface(std::mt19937& generator, Intersection& intersection) const override;
+		Vector3 getGeometricNormal(const Intersection& intersection) const override;
+
+		// watertight test (Woop et al. 2013) in float, u and v are the barycentric weights of the vertices 1 and 2
+		static bool intersectVertices(const float* vertex0, const float* vertex1, const float* vertex2, const Ray& ray, double& u, double& v);
 
 		Vector3 vertices[3];
 		Vector3 normals[3];
@@ -39,6 +48,12 @@ namespace Raycer
 
 	private:
 
+		void precalculate();
+		bool intersectDistance(const Ray& ray, double maxDistance, double& t, double& u, double& v) const;
+		Vector2 getTexcoord(double u, double v) const;
+
+		float intersectionVertices[9]; // float copy of the vertices for the intersection test
+
 		friend class cereal::access;
 
 		template <class Archive>
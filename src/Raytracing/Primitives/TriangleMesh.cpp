@@ -0,0 +1,435 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#include "Raytracing/Primitives/TriangleMesh.h"
+#include "Raytracing/Primitives/Triangle.h"
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Raytracing/AABB.h"
+#include "Raytracing/Material.h"
+#include "Raytracing/Textures/Texture.h"
+#include "Math/Vector2.h"
+#include "Math/Vector3.h"
+#include "Math/ONB.h"
+#include "Math/Matrix4x4.h"
+
+using namespace Raycer;
+
+void TriangleMesh::initialize(const Scene& scene)
+{
+	(void)scene;
+
+	uint64_t vertexCount = positionsX.size();
+
+	if (positionsY.size() != vertexCount || positionsZ.size() != vertexCount)
+		throw std::runtime_error(tfm::format("Triangle mesh %d has position arrays of different sizes", id));
+
+	if (!normalsX.empty() && (normalsX.size() != vertexCount || normalsY.size() != vertexCount || normalsZ.size() != vertexCount))
+		throw std::runtime_error(tfm::format("Triangle mesh %d has a normal count different from the vertex count", id));
+
+	if (!texcoordsU.empty() && (texcoordsU.size() != vertexCount || texcoordsV.size() != vertexCount))
+		throw std::runtime_error(tfm::format("Triangle mesh %d has a texcoord count different from the vertex count", id));
+
+	if (indices.empty() || indices.size() % 3 != 0)
+		throw std::runtime_error(tfm::format("Triangle mesh %d index count is zero or not a multiple of three", id));
+
+	for (uint32_t index : indices)
+	{
+		if (index >= vertexCount)
+			throw std::runtime_error(tfm::format("Triangle mesh %d has an index out of range (%d >= %d)", id, index, vertexCount));
+	}
+
+	buildBVH();
+}
+
+bool TriangleMesh::intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	if (ray.isShadowRay && material->nonShadowing)
+		return false;
+
+	if (ray.fastOcclusion && intersection.wasFound)
+		return true;
+
+	return bvh.traverse(*this, ray, intersection, intersections);
+}
+
+bool TriangleMesh::occluded(const Ray& ray)
+{
+	if (ray.isShadowRay && material->nonShadowing)
+		return false;
+
+	return bvh.traverseOcclusion(*this, ray);
+}
+
+bool TriangleMesh::intersectPrimitive(uint64_t index, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections)
+{
+	(void)intersections;
+
+	double t, u, v;
+
+	if (!intersectTriangle(index, ray, intersection.distance, t, u, v))
+		return false;
+
+	intersection.wasFound = true;
+	intersection.distance = t;
+	intersection.primitive = this;
+	intersection.surfacePrimitive = this;
+	intersection.barycentric = Vector2(u, v);
+	intersection.triangleIndex = index;
+
+	return true;
+}
+
+bool TriangleMesh::occludedPrimitive(uint64_t index, const Ray& ray)
+{
+	double t, u, v;
+
+	return intersectTriangle(index, ray, std::numeric_limits<double>::max(), t, u, v);
+}
+
+bool TriangleMesh::intersectTriangle(uint64_t index, const Ray& ray, double maxDistance, double& t, double& u, double& v) const
+{
+	uint32_t i0 = indices[index * 3];
+	uint32_t i1 = indices[index * 3 + 1];
+	uint32_t i2 = indices[index * 3 + 2];
+
+	// the float positions are used as is by the watertight test, see Triangle::intersect
+	float vertex0[3] = { positionsX[i0], positionsY[i0], positionsZ[i0] };
+	float vertex1[3] = { positionsX[i1], positionsY[i1], positionsZ[i1] };
+	float vertex2[3] = { positionsX[i2], positionsY[i2], positionsZ[i2] };
+
+	if (!Triangle::intersectVertices(vertex0, vertex1, vertex2, ray, u, v))
+		return false;
+
+	Vector3 position0 = getPosition(i0);
+	Vector3 v0v1 = getPosition(i1) - position0;
+	Vector3 v0v2 = getPosition(i2) - position0;
+	Vector3 normal = v0v1.cross(v0v2).normalized();
+	double denominator = ray.direction.dot(normal);
+
+	// ray and triangle are parallel -> no intersection
+	if (std::abs(denominator) < std::numeric_limits<double>::epsilon())
+		return false;
+
+	t = (position0 - ray.origin).dot(normal) / denominator;
+
+	if (t < 0.0)
+		return false;
+
+	if (t < ray.minDistance || t > ray.maxDistance)
+		return false;
+
+	if (t > maxDistance)
+		return false;
+
+	if (material->maskMapTexture != nullptr)
+	{
+		Vector2 texcoord = hasTexcoords() ? getTexcoord(i0, i1, i2, u, v) : Vector2();
+		Vector3 ip = ray.origin + (t * ray.direction);
+
+		if (material->maskMapTexture->getValue(texcoord, ip) < 0.5)
+			return false;
+	}
+
+	return true;
+}
+
+void TriangleMesh::computeSurfaceData(const Ray& ray, Intersection& intersection) const
+{
+	uint64_t index = intersection.triangleIndex;
+	uint32_t i0 = indices[index * 3];
+	uint32_t i1 = indices[index * 3 + 1];
+	uint32_t i2 = indices[index * 3 + 2];
+	double u = intersection.barycentric.x;
+	double v = intersection.barycentric.y;
+	double w = 1.0 - u - v;
+
+	Vector3 position0 = getPosition(i0);
+	Vector3 v0v1 = getPosition(i1) - position0;
+	Vector3 v0v2 = getPosition(i2) - position0;
+	Vector3 normal = v0v1.cross(v0v2).normalized();
+
+	Vector2 texcoord;
+	Vector2 t0tot1;
+	Vector2 t0tot2;
+
+	if (hasTexcoords())
+	{
+		Vector2 texcoord0 = getTexcoord(i0);
+
+		texcoord = getTexcoord(i0, i1, i2, u, v);
+		t0tot1 = getTexcoord(i1) - texcoord0;
+		t0tot2 = getTexcoord(i2) - texcoord0;
+	}
+
+	// the surface frame is not stored per triangle, it is derived only for the closest hit
+	Vector3 finalNormal = normal;
+
+	if (material->normalInterpolation && hasNormals())
+		finalNormal = (w * getNormal(i0) + u * getNormal(i1) + v * getNormal(i2)).normalized();
+
+	Vector3 tangent;
+	Vector3 bitangent;
+	double texcoordDenominator = t0tot1.x * t0tot2.y - t0tot1.y * t0tot2.x;
+
+	// tangent space aligned to texcoords
+	if (std::abs(texcoordDenominator) > std::numeric_limits<double>::epsilon())
+	{
+		double r = 1.0 / texcoordDenominator;
+		tangent = ((v0v1 * t0tot2.y - v0v2 * t0tot1.y) * r).normalized();
+		bitangent = ((v0v2 * t0tot1.x - v0v1 * t0tot2.x) * r).normalized();
+	}
+	else
+	{
+		tangent = normal.cross(Vector3::ALMOST_UP).normalized();
+		bitangent = tangent.cross(normal).normalized();
+	}
+
+	intersection.position = ray.origin + (intersection.distance * ray.direction);
+	intersection.normal = material->invertNormal ? -finalNormal : finalNormal;
+	intersection.onb = ONB(tangent, bitangent, intersection.normal);
+	intersection.texcoord = texcoord;
+}
+
+double TriangleMesh::getArea() const
+{
+	return area;
+}
+
+void TriangleMesh::sampleSurface(std::mt19937& generator, Intersection& intersection) const
+{
+	if (sampleTriangles.empty())
+		return;
+
+	std::uniform_real_distribution<double> random(0.0, 1.0);
+
+	// a triangle in proportion to its area and a uniform point on it -> uniform over the whole mesh
+	auto selection = std::upper_bound(cumulativeAreas.begin(), cumulativeAreas.end(), random(generator) * area);
+	uint64_t index = sampleTriangles[std::min(uint64_t(selection - cumulativeAreas.begin()), uint64_t(sampleTriangles.size() - 1))];
+
+	double u = random(generator);
+	double v = random(generator);
+
+	if (u + v > 1.0)
+	{
+		u = 1.0 - u;
+		v = 1.0 - v;
+	}
+
+	uint32_t i0 = indices[index * 3];
+	uint32_t i1 = indices[index * 3 + 1];
+	uint32_t i2 = indices[index * 3 + 2];
+
+	intersection.position = (1.0 - u - v) * getPosition(i0) + u * getPosition(i1) + v * getPosition(i2);
+	intersection.normal = getFaceNormal(index);
+	intersection.texcoord = hasTexcoords() ? getTexcoord(i0, i1, i2, u, v) : Vector2();
+	intersection.triangleIndex = index;
+}
+
+Vector3 TriangleMesh::getGeometricNormal(const Intersection& intersection) const
+{
+	return getFaceNormal(intersection.triangleIndex);
+}
+
+AABB TriangleMesh::getAABB() const
+{
+	return aabb;
+}
+
+AABB TriangleMesh::getTransformedAABB(const Matrix4x4& transformation) const
+{
+	return bvh.getTransformedAABB(transformation);
+}
+
+void TriangleMesh::transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate)
+{
+	Vector3 center = aabb.getCenter();
+
+	Matrix4x4 scaling = Matrix4x4::scale(scale);
+	Matrix4x4 rotation = Matrix4x4::rotateXYZ(rotate);
+	Matrix4x4 translation1 = Matrix4x4::translate(-center);
+	Matrix4x4 translation2 = Matrix4x4::translate(translate + center);
+	Matrix4x4 transformation = translation2 * rotation * scaling * translation1;
+	Matrix4x4 transformationInvT = transformation.inverted().transposed();
+
+	for (uint64_t i = 0; i < positionsX.size(); ++i)
+	{
+		Vector3 position = transformation.transformPosition(getPosition(i));
+
+		positionsX[i] = float(position.x);
+		positionsY[i] = float(position.y);
+		positionsZ[i] = float(position.z);
+	}
+
+	for (uint64_t i = 0; i < normalsX.size(); ++i)
+	{
+		Vector3 normal = transformationInvT.transformDirection(getNormal(i)).normalized();
+
+		normalsX[i] = float(normal.x);
+		normalsY[i] = float(normal.y);
+		normalsZ[i] = float(normal.z);
+	}
+
+	buildBVH();
+}
+
+uint32_t TriangleMesh::addVertex(const Vector3& position)
+{
+	if (positionsX.size() >= std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("Triangle mesh vertex count does not fit to 32-bit indices");
+
+	positionsX.push_back(float(position.x));
+	positionsY.push_back(float(position.y));
+	positionsZ.push_back(float(position.z));
+
+	return uint32_t(positionsX.size() - 1);
+}
+
+uint32_t TriangleMesh::addVertex(const Vector3& position, const Vector3& normal, const Vector2& texcoord)
+{
+	uint32_t index = addVertex(position);
+
+	normalsX.push_back(float(normal.x));
+	normalsY.push_back(float(normal.y));
+	normalsZ.push_back(float(normal.z));
+	texcoordsU.push_back(float(texcoord.x));
+	texcoordsV.push_back(float(texcoord.y));
+
+	return index;
+}
+
+void TriangleMesh::addTriangle(uint32_t index0, uint32_t index1, uint32_t index2)
+{
+	indices.push_back(index0);
+	indices.push_back(index1);
+	indices.push_back(index2);
+}
+
+uint64_t TriangleMesh::getVertexCount() const
+{
+	return positionsX.size();
+}
+
+uint64_t TriangleMesh::getTriangleCount() const
+{
+	return indices.size() / 3;
+}
+
+bool TriangleMesh::hasNormals() const
+{
+	return !normalsX.empty();
+}
+
+bool TriangleMesh::hasTexcoords() const
+{
+	return !texcoordsU.empty();
+}
+
+void TriangleMesh::buildBVH()
+{
+	uint64_t triangleCount = indices.size() / 3;
+
+	// spatial splits duplicate the index triples of the split triangles, only the unique ones are rebuilt
+	if (bvhBuildInfo.useSpatialSplits && bvh.hasBeenBuilt)
+	{
+		std::vector<std::array<uint32_t, 3>> triangles(triangleCount);
+
+		for (uint64_t i = 0; i < triangleCount; ++i)
+			triangles[i] = { { indices[i * 3], indices[i * 3 + 1], indices[i * 3 + 2] } };
+
+		std::sort(triangles.begin(), triangles.end());
+		triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+		triangleCount = triangles.size();
+		indices.resize(triangleCount * 3);
+
+		for (uint64_t i = 0; i < triangleCount; ++i)
+			std::copy(triangles[i].begin(), triangles[i].end(), indices.begin() + int64_t(i * 3));
+	}
+
+	std::vector<AABB> aabbs(triangleCount);
+
+	for (uint64_t i = 0; i < triangleCount; ++i)
+		aabbs[i] = AABB::createFromVertices(getPosition(indices[i * 3]), getPosition(indices[i * 3 + 1]), getPosition(indices[i * 3 + 2]));
+
+	std::vector<uint64_t> order;
+	bvh.build(std::move(aabbs), bvhBuildInfo, order);
+
+	// store the triangles in the leaf order so that the leafs index them directly
+	std::vector<uint32_t> orderedIndices(order.size() * 3);
+
+	for (uint64_t i = 0; i < order.size(); ++i)
+	{
+		orderedIndices[i * 3] = indices[order[i] * 3];
+		orderedIndices[i * 3 + 1] = indices[order[i] * 3 + 1];
+		orderedIndices[i * 3 + 2] = indices[order[i] * 3 + 2];
+	}
+
+	indices.swap(orderedIndices);
+	aabb = bvh.getAABB();
+
+	buildSampling(order, triangleCount);
+}
+
+void TriangleMesh::buildSampling(const std::vector<uint64_t>& order, uint64_t uniqueTriangleCount)
+{
+	area = 0.0;
+	sampleTriangles.clear();
+	cumulativeAreas.clear();
+
+	bool isEmissive = (material != nullptr && material->isEmissive);
+
+	// spatial splits reference some triangles more than once, each is counted only once
+	std::vector<bool> isCounted(uniqueTriangleCount, false);
+
+	for (uint64_t i = 0; i < order.size(); ++i)
+	{
+		if (isCounted[order[i]])
+			continue;
+
+		isCounted[order[i]] = true;
+
+		Vector3 position0 = getPosition(indices[i * 3]);
+		area += 0.5 * (getPosition(indices[i * 3 + 1]) - position0).cross(getPosition(indices[i * 3 + 2]) - position0).length();
+
+		if (isEmissive)
+		{
+			sampleTriangles.push_back(i);
+			cumulativeAreas.push_back(area);
+		}
+	}
+}
+
+Vector3 TriangleMesh::getFaceNormal(uint64_t index) const
+{
+	Vector3 position0 = getPosition(indices[index * 3]);
+	return (getPosition(indices[index * 3 + 1]) - position0).cross(getPosition(indices[index * 3 + 2]) - position0).normalized();
+}
+
+Vector3 TriangleMesh::getPosition(uint64_t vertexIndex) const
+{
+	return Vector3(positionsX[vertexIndex], positionsY[vertexIndex], positionsZ[vertexIndex]);
+}
+
+Vector3 TriangleMesh::getNormal(uint64_t vertexIndex) const
+{
+	return Vector3(normalsX[vertexIndex], normalsY[vertexIndex], normalsZ[vertexIndex]);
+}
+
+Vector2 TriangleMesh::getTexcoord(uint64_t vertexIndex) const
+{
+	return Vector2(texcoordsU[vertexIndex], texcoordsV[vertexIndex]);
+}
+
+Vector2 TriangleMesh::getTexcoord(uint32_t i0, uint32_t i1, uint32_t i2, double u, double v) const
+{
+	Vector2 texcoord = ((1.0 - u - v) * getTexcoord(i0) + u * getTexcoord(i1) + v * getTexcoord(i2)) * material->texcoordScale;
+
+	texcoord.x = texcoord.x - floor(texcoord.x);
+	texcoord.y = texcoord.y - floor(texcoord.y);
+
+	return texcoord;
+}
@@ -0,0 +1,100 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+#include "cereal/cereal.hpp"
+
+#include "Raytracing/Primitives/Primitive.h"
+#include "Raytracing/Primitives/FlatBVH.h"
+
+namespace Raycer
+{
+	class Ray;
+	struct Intersection;
+	class AABB;
+	class Vector2;
+	class Vector3;
+	class EulerAngle;
+	class Matrix4x4;
+
+	// triangles with shared vertex data in SoA layout and a 32-bit index buffer
+	// normals and texcoords are optional, if present they have one element per vertex
+	class TriangleMesh : public Primitive
+	{
+	public:
+
+		friend class Scene;
+
+		void initialize(const Scene& scene) override;
+		bool intersect(const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections) override;
+		bool occluded(const Ray& ray) override;
+		AABB getAABB() const override;
+		void transform(const Vector3& scale, const EulerAngle& rotate, const Vector3& translate) override;
+		void computeSurfaceData(const Ray& ray, Intersection& intersection) const override;
+		double getArea() const override;
+		void sampleSurface(std::mt19937& generator, Intersection& intersection) const override;
+		Vector3 getGeometricNormal(const Intersection& intersection) const override;
+
+		AABB getTransformedAABB(const Matrix4x4& transformation) const;
+		bool intersectPrimitive(uint64_t index, const Ray& ray, Intersection& intersection, std::vector<Intersection>& intersections);
+		bool occludedPrimitive(uint64_t index, const Ray& ray);
+
+		uint32_t addVertex(const Vector3& position);
+		uint32_t addVertex(const Vector3& position, const Vector3& normal, const Vector2& texcoord);
+		void addTriangle(uint32_t index0, uint32_t index1, uint32_t index2);
+
+		uint64_t getVertexCount() const;
+		uint64_t getTriangleCount() const;
+		bool hasNormals() const;
+		bool hasTexcoords() const;
+
+		std::vector<float> positionsX;
+		std::vector<float> positionsY;
+		std::vector<float> positionsZ;
+		std::vector<float> normalsX;
+		std::vector<float> normalsY;
+		std::vector<float> normalsZ;
+		std::vector<float> texcoordsU;
+		std::vector<float> texcoordsV;
+		std::vector<uint32_t> indices; // three per triangle, in the BVH leaf order after initialization
+
+		BVHBuildInfo bvhBuildInfo;
+		FlatBVH bvh;
+
+	private:
+
+		void buildBVH();
+		void buildSampling(const std::vector<uint64_t>& order, uint64_t uniqueTriangleCount);
+		Vector3 getFaceNormal(uint64_t index) const;
+		bool intersectTriangle(uint64_t index, const Ray& ray, double maxDistance, double& t, double& u, double& v) const;
+		Vector3 getPosition(uint64_t vertexIndex) const;
+		Vector3 getNormal(uint64_t vertexIndex) const;
+		Vector2 getTexcoord(uint64_t vertexIndex) const;
+		Vector2 getTexcoord(uint32_t i0, uint32_t i1, uint32_t i2, double u, double v) const;
+
+		double area = 0.0;
+		std::vector<uint64_t> sampleTriangles; // each triangle once in the leaf order, only for the emissive meshes
+		std::vector<double> cumulativeAreas;
+
+		friend class cereal::access;
+
+		template <class Archive>
+		void serialize(Archive& ar)
+		{
+			ar(cereal::make_nvp("primitive", cereal::base_class<Primitive>(this)),
+				CEREAL_NVP(positionsX),
+				CEREAL_NVP(positionsY),
+				CEREAL_NVP(positionsZ),
+				CEREAL_NVP(normalsX),
+				CEREAL_NVP(normalsY),
+				CEREAL_NVP(normalsZ),
+				CEREAL_NVP(texcoordsU),
+				CEREAL_NVP(texcoordsV),
+				CEREAL_NVP(indices),
+				CEREAL_NVP(bvhBuildInfo));
+		}
+	};
+}
@@ -10,4 +10,27 @@ using namespace Raycer;
 void Ray::precalculate()
 {
 	inverseDirection = direction.inversed();
+
+	// the dominant direction axis becomes z, swapping x and y preserves the winding
+	uint32_t axisZ = 0;
+
+	if (std::abs(direction.y) > std::abs(direction.get(axisZ)))
+		axisZ = 1;
+
+	if (std::abs(direction.z) > std::abs(direction.get(axisZ)))
+		axisZ = 2;
+
+	uint32_t axisX = (axisZ + 1) % 3;
+	uint32_t axisY = (axisX + 1) % 3;
+
+	if (direction.get(axisZ) < 0.0)
+		std::swap(axisX, axisY);
+
+	shearAxes[0] = axisX;
+	shearAxes[1] = axisY;
+	shearAxes[2] = axisZ;
+
+	shearFactors[0] = float(direction.get(axisX) / direction.get(axisZ));
+	shearFactors[1] = float(direction.get(axisY) / direction.get(axisZ));
+	shearFactors[2] = float(1.0 / direction.get(axisZ));
 }
@@ -19,6 +19,10 @@ namespace Raycer
 		Vector3 direction;
 		Vector3 inverseDirection;
 
+		// axis permutation and shear of the watertight triangle test
+		uint32_t shearAxes[3] = { 0, 1, 2 };
+		float shearFactors[3] = { 0.0f, 0.0f, 1.0f };
+
 		double minDistance = std::numeric_limits<double>::lowest();
 		double maxDistance = std::numeric_limits<double>::max();
 
@@ -26,5 +30,6 @@ namespace Raycer
 
 		bool isShadowRay = false;
 		bool fastOcclusion = false;
+		bool collectAllIntersections = false; // disables closest hit culling (CSG needs all hits)
 	};
 }
@@ -15,11 +15,14 @@
 
 #include "Raytracing/Scene.h"
 #include "Raytracing/Primitives/Primitive.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
 #include "Raytracing/Textures/Texture.h"
 #include "Raytracing/AABB.h"
 #include "App.h"
 #include "Utils/Log.h"
 #include "Utils/StringUtils.h"
+#include "Utils/ScratchBuffer.h"
 
 using namespace Raycer;
 
@@ -187,6 +190,9 @@ void Scene::addModel(const ModelLoaderResult& result)
 	for (const Triangle& triangle : result.triangles)
 		primitives.triangles.push_back(triangle);
 
+	for (const TriangleMesh& triangleMesh : result.triangleMeshes)
+		primitives.triangleMeshes.push_back(triangleMesh);
+
 	for (const Material& material : result.materials)
 		materials.push_back(material);
 
@@ -272,6 +278,9 @@ void Scene::initialize()
 	for (Triangle& triangle : primitives.triangles)
 		sortPrimitive(&triangle);
 
+	for (TriangleMesh& triangleMesh : primitives.triangleMeshes)
+		sortPrimitive(&triangleMesh);
+
 	for (Plane& plane : primitives.planes)
 		sortPrimitive(&plane);
 
@@ -427,6 +436,9 @@ void Scene::initialize()
 	for (Triangle& triangle : primitives.triangles)
 		triangle.initialize(*this);
 
+	for (TriangleMesh& triangleMesh : primitives.triangleMeshes)
+		triangleMesh.initialize(*this);
+
 	for (Plane& plane : primitives.planes)
 		plane.initialize(*this);
 
@@ -454,6 +466,65 @@ void Scene::initialize()
 	for (Instance& instance : primitives.instances)
 		instance.initialize(*this);
 
+	// EMISSIVE PRIMITIVES
+
+	for (Primitive* primitive : primitives.invisible)
+		primitive->emissiveIndex = -1;
+
+	for (Primitive* primitive : primitives.visible)
+		primitive->emissiveIndex = -1;
+
+	double totalEmittedPower = 0.0;
+
+	// instances are not sampled, their primitive is only transformed at the hit and has no world space surface to sample from
+	std::function<void(Primitive*)> addEmissivePrimitive = [&](Primitive* primitive)
+	{
+		PrimitiveGroup* primitiveGroup = dynamic_cast<PrimitiveGroup*>(primitive);
+
+		// the group members are in world space and are hit directly
+		if (primitiveGroup != nullptr)
+		{
+			for (Primitive* groupPrimitive : primitiveGroup->primitives)
+				addEmissivePrimitive(groupPrimitive);
+
+			return;
+		}
+
+		// a primitive can be in more than one group
+		if (primitive->emissiveIndex >= 0 || !primitive->material->isEmissive || primitive->getArea() <= 0.0)
+			return;
+
+		double emittance = primitive->material->emittance.getLuminance();
+
+		if (primitive->material->emittanceMapTexture != nullptr)
+			emittance = primitive->material->emittanceMapTexture->intensity;
+
+		double emittedPower = primitive->getArea() * emittance;
+
+		if (emittedPower <= 0.0)
+			return;
+
+		totalEmittedPower += emittedPower;
+
+		primitive->emissiveIndex = int64_t(emissivePrimitives.primitives.size());
+		emissivePrimitives.primitives.push_back(primitive);
+		emissivePrimitives.cumulativeProbabilities.push_back(totalEmittedPower);
+		emissivePrimitives.probabilities.push_back(emittedPower);
+	};
+
+	for (Primitive* primitive : primitives.visible)
+		addEmissivePrimitive(primitive);
+
+	for (double& cumulativeProbability : emissivePrimitives.cumulativeProbabilities)
+		cumulativeProbability /= totalEmittedPower;
+
+	for (double& probability : emissivePrimitives.probabilities)
+		probability /= totalEmittedPower;
+
+	// LIGHT BVH
+
+	lightBVH.build(lights.pointLights, lights.spotLights);
+
 	// CAMERA
 
 	camera.initialize();
@@ -482,16 +553,14 @@ void Scene::initialize()
 
 	primitives.visibleOriginal = primitives.visible;
 
-	if (rootBVH.enabled)
+	if (rootBVH.bvh.hasBeenBuilt)
 	{
-		if (rootBVH.bvh.hasBeenBuilt)
-			rootBVH.bvh.restore(*this);
-		else
-			rootBVH.bvh.build(primitives.visible, rootBVH.buildInfo);
-
-		primitives.visible.clear();
+		separateUnboundedPrimitives();
+		rootBVH.bvh.restore(*this, rootBVH.buildInfo);
 		primitives.visible.push_back(&rootBVH.bvh);
 	}
+	else
+		rebuildRootBVH();
 
 	auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
 	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsedTime).count();
@@ -499,13 +568,71 @@ void Scene::initialize()
 	log.logInfo("Scene initialization finished (time: %d ms)", milliseconds);
 }
 
+void Scene::refitRootBVH()
+{
+	if (!rootBVH.bvh.hasBeenBuilt)
+		return;
+
+	rootBVH.bvh.refit();
+
+	if (rootBVH.bvh.calculateSAHCost() > rootBVH.bvh.builtSAHCost * (1.0 + rootBVH.buildInfo.refitRebuildThreshold))
+		rebuildRootBVH();
+}
+
 void Scene::rebuildRootBVH()
 {
-	if (!rootBVH.enabled)
+	std::vector<Primitive*> boundedPrimitives = separateUnboundedPrimitives();
+
+	// a scene of planes only has nothing to build
+	if (boundedPrimitives.empty())
 		return;
 
-	rootBVH.bvh.build(primitives.visibleOriginal, rootBVH.buildInfo);
+	rootBVH.bvh.build(boundedPrimitives, rootBVH.buildInfo);
+	primitives.visible.push_back(&rootBVH.bvh);
+}
+
+bool Scene::intersect(const Ray& ray, Intersection& intersection) const
+{
+	ScratchBuffer<Intersection> intersectionBuffer;
+	std::vector<Intersection>& intersections = intersectionBuffer.get();
+
+	for (Primitive* primitive : primitives.visible)
+	{
+		intersections.clear();
+		primitive->intersect(ray, intersection, intersections);
+	}
+
+	if (intersection.wasFound)
+		intersection.surfacePrimitive->computeSurfaceData(ray, intersection);
+
+	return intersection.wasFound;
+}
+
+bool Scene::occluded(const Ray& ray) const
+{
+	for (Primitive* primitive : primitives.visible)
+	{
+		if (primitive->occluded(ray))
+			return true;
+	}
+
+	return false;
+}
+
+// the unbounded primitives are left to the visible list, the rest are returned for the root BVH
+std::vector<Primitive*> Scene::separateUnboundedPrimitives()
+{
+	std::vector<Primitive*> boundedPrimitives;
 
 	primitives.visible.clear();
-	primitives.visible.push_back(&rootBVH.bvh);
+
+	for (Primitive* primitive : primitives.visibleOriginal)
+	{
+		if (primitive->isUnbounded())
+			primitives.visible.push_back(primitive);
+		else
+			boundedPrimitives.push_back(primitive);
+	}
+
+	return boundedPrimitives;
 }
@@ -23,10 +23,12 @@
 #include "Raytracing/Textures/VoronoiTexture.h"
 #include "Raytracing/Material.h"
 #include "Raytracing/Lights.h"
+#include "Raytracing/LightBVH.h"
 #include "Raytracing/Primitives/Plane.h"
 #include "Raytracing/Primitives/Sphere.h"
 #include "Raytracing/Primitives/Box.h"
 #include "Raytracing/Primitives/Triangle.h"
+#include "Raytracing/Primitives/TriangleMesh.h"
 #include "Raytracing/Primitives/Cylinder.h"
 #include "Raytracing/Primitives/Torus.h"
 #include "Raytracing/Primitives/Instance.h"
@@ -44,6 +46,8 @@
 namespace Raycer
 {
 	class Primitive;
+	class Ray;
+	struct Intersection;
 
 	class Scene
 	{
@@ -63,6 +67,13 @@ namespace Raycer
 		void addModel(const ModelLoaderResult& result);
 		void initialize();
 		void rebuildRootBVH();
+		void refitRootBVH();
+
+		// closest visible hit with its surface data, the single entry point of the tracers
+		bool intersect(const Ray& ray, Intersection& intersection) const;
+
+		// any visible primitive between ray.minDistance and ray.maxDistance, for shadow and occlusion rays
+		bool occluded(const Ray& ray) const;
 
 		static Scene createTestScene1();
 		static Scene createTestScene2();
@@ -92,6 +103,7 @@ namespace Raycer
 			uint64_t maxRayIterations = 3;
 			uint64_t maxPathLength = 3;
 			uint64_t pathSampleCount = 1;
+			uint64_t russianRouletteStartLength = 3; // shorter paths are never terminated early
 			double rayStartOffset = 0.00001;
 			Color backgroundColor = Color(0.0, 0.0, 0.0);
 			Color offLensColor = Color(0.0, 0.0, 0.0);
@@ -105,6 +117,8 @@ namespace Raycer
 			bool visualizeDepth = false;
 			double visualizeDepthMaxDistance = 25.0;
 			bool enableNormalMapping = true;
+			uint64_t tileSize = 32; // in pixels, a tile is rendered by one thread at a time
+			TileOrder tileOrder = TileOrder::HILBERT;
 
 			template <class Archive>
 			void serialize(Archive& ar)
@@ -113,6 +127,7 @@ namespace Raycer
 					CEREAL_NVP(maxRayIterations),
 					CEREAL_NVP(maxPathLength),
 					CEREAL_NVP(pathSampleCount),
+					CEREAL_NVP(russianRouletteStartLength),
 					CEREAL_NVP(rayStartOffset),
 					CEREAL_NVP(backgroundColor),
 					CEREAL_NVP(offLensColor),
@@ -125,7 +140,9 @@ namespace Raycer
 					CEREAL_NVP(cameraSampleCountSqrt),
 					CEREAL_NVP(visualizeDepth),
 					CEREAL_NVP(visualizeDepthMaxDistance),
-					CEREAL_NVP(enableNormalMapping));
+					CEREAL_NVP(enableNormalMapping),
+					CEREAL_NVP(tileSize),
+					CEREAL_NVP(tileOrder));
 			}
 
 		} general;
@@ -200,17 +217,16 @@ namespace Raycer
 
 		} volumetricFog;
 
+		// built always over the bounded visible primitives, the unbounded ones are intersected next to it
 		struct RootBVH
 		{
-			bool enabled = false;
 			BVHBuildInfo buildInfo;
 			FlatBVH bvh;
 
 			template <class Archive>
 			void serialize(Archive& ar)
 			{
-				ar(CEREAL_NVP(enabled),
-					CEREAL_NVP(buildInfo),
+				ar(CEREAL_NVP(buildInfo),
 					CEREAL_NVP(bvh));
 			}
 
@@ -275,6 +291,8 @@ namespace Raycer
 			std::vector<DirectionalLight> directionalLights;
 			std::vector<PointLight> pointLights;
 			std::vector<SpotLight> spotLights;
+			bool enableLightCulling = false; // point and spot lights beyond their maxDistance are skipped through the light BVH
+			uint64_t lightSampleCount = 0; // point and spot lights picked from the light BVH per shading point, zero uses all of them
 
 			template <class Archive>
 			void serialize(Archive& ar)
@@ -282,16 +300,21 @@ namespace Raycer
 				ar(CEREAL_NVP(ambientLight),
 					CEREAL_NVP(directionalLights),
 					CEREAL_NVP(pointLights),
-					CEREAL_NVP(spotLights));
+					CEREAL_NVP(spotLights),
+					CEREAL_NVP(enableLightCulling),
+					CEREAL_NVP(lightSampleCount));
 			}
 
 		} lights;
 
+		LightBVH lightBVH;
+
 		std::vector<ModelLoaderInfo> models;
 
 		struct Primitives
 		{
 			std::vector<Triangle> triangles;
+			std::vector<TriangleMesh> triangleMeshes;
 			std::vector<Plane> planes;
 			std::vector<Sphere> spheres;
 			std::vector<Box> boxes;
@@ -302,7 +325,7 @@ namespace Raycer
 			std::vector<PrimitiveGroup> primitiveGroups;
 			std::vector<Instance> instances;
 			std::vector<Box> boundingBoxes;
-			std::vector<Primitive*> visible;
+			std::vector<Primitive*> visible; // root BVH and the unbounded primitives after initialization
 			std::vector<Primitive*> invisible;
 			std::vector<Primitive*> visibleOriginal;
 
@@ -310,6 +333,7 @@ namespace Raycer
 			void serialize(Archive& ar)
 			{
 				ar(CEREAL_NVP(triangles),
+					CEREAL_NVP(triangleMeshes),
 					CEREAL_NVP(planes),
 					CEREAL_NVP(spheres),
 					CEREAL_NVP(boxes),
@@ -327,8 +351,19 @@ namespace Raycer
 		std::map<uint64_t, Material*> materialsMap;
 		std::map<uint64_t, Texture*> texturesMap;
 
+		// area lights of the path tracer, selected in proportion to their emitted power
+		struct EmissivePrimitives
+		{
+			std::vector<Primitive*> primitives;
+			std::vector<double> cumulativeProbabilities;
+			std::vector<double> probabilities; // indexed by Primitive::emissiveIndex
+
+		} emissivePrimitives;
+
 	private:
 
+		std::vector<Primitive*> separateUnboundedPrimitives();
+
 		friend class cereal::access;
 
 		template <class Archive>
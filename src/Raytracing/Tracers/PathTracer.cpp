@@ -7,6 +7,8 @@
 #include "Raytracing/Scene.h"
 #include "Raytracing/Ray.h"
 #include "Raytracing/Intersection.h"
+#include "Raytracing/LightBVH.h"
+#include "Utils/ScratchBuffer.h"
 
 using namespace Raycer;
 
@@ -17,59 +19,280 @@ Color PathTracer::trace(const Scene& scene, const Ray& ray, std::mt19937& genera
 	Color sampledPixelColor;
 
 	for (uint64_t i = 0; i < scene.general.pathSampleCount; ++i)
-		sampledPixelColor += traceRecursive(scene, ray, 0, generator, interrupted);
+		sampledPixelColor += tracePath(scene, ray, generator, interrupted);
 
 	return sampledPixelColor / double(scene.general.pathSampleCount);
 }
 
-Color PathTracer::traceRecursive(const Scene& scene, const Ray& ray, uint64_t iteration, std::mt19937& generator, const std::atomic<bool>& interrupted)
+Color PathTracer::tracePath(const Scene& scene, const Ray& ray, std::mt19937& generator, const std::atomic<bool>& interrupted)
 {
-	if (interrupted)
-		return Color::BLACK;
+	Sampler* sampler = samplers[SamplerType::RANDOM].get();
+	std::uniform_real_distribution<double> randomTermination(0.0, 1.0);
+
+	Color pathColor;
+	Color throughput(1.0, 1.0, 1.0);
+	Ray pathRay = ray;
+	double bsdfPdf = 0.0; // of the direction of pathRay, zero for the camera ray
+
+	for (uint64_t iteration = 0; iteration < scene.general.maxPathLength; ++iteration)
+	{
+		if (interrupted)
+			break;
+
+		Intersection intersection;
+
+		if (!scene.intersect(pathRay, intersection))
+			break;
+
+		Material* material = intersection.primitive->material;
+
+		if (material->isEmissive)
+		{
+			double misWeight = 1.0;
+
+			// the same light could also have been reached by the light sampling of the previous bounce
+			if (bsdfPdf > 0.0)
+				misWeight = getPowerHeuristic(bsdfPdf, getEmissivePrimitivePdf(scene, pathRay, intersection));
+
+			pathColor += throughput * getEmittance(material, intersection) * misWeight;
+			break;
+		}
+
+		// the last segment of the path was traced only for the emissive hits
+		if (iteration + 1 == scene.general.maxPathLength)
+			break;
+
+		Color reflectance = material->diffuseReflectance;
+
+		if (material->diffuseMapTexture != nullptr)
+			reflectance = material->diffuseMapTexture->getColor(intersection.texcoord, intersection.position) * material->diffuseMapTexture->intensity;
+
+		pathColor += throughput * reflectance * (sampleEmissivePrimitives(scene, pathRay, intersection, generator) + sampleLights(scene, pathRay, intersection, generator));
+
+		Vector3 newDirection = sampler->getHemisphereSample(intersection.onb, 1.0, 0, 0, 1, 1, 0, generator);
+		bsdfPdf = std::max(0.0, newDirection.dot(intersection.onb.w)) / M_PI;
+
+		// the directions are cosine distributed, so the cosine and the pdf cancel out from the diffuse brdf
+		throughput = throughput * reflectance;
+
+		// russian roulette, the surviving paths are weighted up so that the estimate stays unbiased
+		if (iteration + 1 >= scene.general.russianRouletteStartLength)
+		{
+			double continueProbability = std::min(1.0, std::max(throughput.r, std::max(throughput.g, throughput.b)));
+
+			if (randomTermination(generator) >= continueProbability)
+				break;
+
+			throughput /= continueProbability;
+		}
+
+		pathRay = Ray();
+		pathRay.origin = intersection.position + newDirection * scene.general.rayStartOffset;
+		pathRay.direction = newDirection;
+		pathRay.time = ray.time;
+		pathRay.precalculate();
+	}
+
+	return pathColor;
+}
+
+// one emissive primitive is picked in proportion to its power and a point on it is sampled, the result is without the reflectance
+Color PathTracer::sampleEmissivePrimitives(const Scene& scene, const Ray& ray, const Intersection& intersection, std::mt19937& generator)
+{
+	const Scene::EmissivePrimitives& emissivePrimitives = scene.emissivePrimitives;
+
+	if (emissivePrimitives.primitives.empty())
+		return Color();
+
+	std::uniform_real_distribution<double> randomSelection(0.0, 1.0);
+	auto selection = std::upper_bound(emissivePrimitives.cumulativeProbabilities.begin(), emissivePrimitives.cumulativeProbabilities.end(), randomSelection(generator));
+	uint64_t index = std::min(uint64_t(selection - emissivePrimitives.cumulativeProbabilities.begin()), uint64_t(emissivePrimitives.primitives.size() - 1));
+	const Primitive* emissivePrimitive = emissivePrimitives.primitives[index];
+
+	Intersection lightIntersection;
+	emissivePrimitive->sampleSurface(generator, lightIntersection);
+
+	Vector3 directionToLight = lightIntersection.position - intersection.position;
+	double distanceToLight2 = directionToLight.lengthSquared();
+	double distanceToLight = sqrt(distanceToLight2);
+
+	if (distanceToLight <= 2.0 * scene.general.rayStartOffset)
+		return Color();
 
-	if (iteration >= scene.general.maxPathLength)
-		return Color::BLACK;
+	directionToLight /= distanceToLight;
 
-	Intersection intersection;
-	std::vector<Intersection> intersections;
+	double cosine = directionToLight.dot(intersection.onb.w);
+	double lightCosine = std::abs(directionToLight.dot(lightIntersection.normal));
 
-	for (Primitive* primitive : scene.primitives.visible)
+	if (cosine <= 0.0 || lightCosine <= 0.0)
+		return Color();
+
+	Ray shadowRay;
+	shadowRay.origin = intersection.position + directionToLight * scene.general.rayStartOffset;
+	shadowRay.direction = directionToLight;
+	shadowRay.isShadowRay = true;
+	shadowRay.maxDistance = distanceToLight - 2.0 * scene.general.rayStartOffset;
+	shadowRay.time = ray.time;
+	shadowRay.precalculate();
+
+	if (scene.occluded(shadowRay))
+		return Color();
+
+	// area pdf converted to solid angle
+	double lightPdf = emissivePrimitives.probabilities[index] * distanceToLight2 / (emissivePrimitive->getArea() * lightCosine);
+	double bsdfPdf = cosine / M_PI;
+
+	return getEmittance(emissivePrimitive->material, lightIntersection) * (cosine / M_PI) * getPowerHeuristic(lightPdf, bsdfPdf) / lightPdf;
+}
+
+// the point like lights cannot be hit by the bounces, they have the same falloff as in the raytracer
+// color * intensity is the irradiance at normal incidence, so they get the same lambertian 1 / pi as the area lights and are dimmer than in the raytracer
+Color PathTracer::sampleLights(const Scene& scene, const Ray& ray, const Intersection& intersection, std::mt19937& generator)
+{
+	Color lightColor;
+
+	for (const DirectionalLight& light : scene.lights.directionalLights)
 	{
-		intersections.clear();
-		primitive->intersect(ray, intersection, intersections);
+		Vector3 directionToLight = -light.direction;
+		double cosine = directionToLight.dot(intersection.onb.w);
+
+		if (cosine <= 0.0)
+			continue;
+
+		if (!isOccluded(scene, ray, intersection, directionToLight, std::numeric_limits<double>::max()))
+			lightColor += light.color * light.intensity * cosine;
 	}
 
-	if (!intersection.wasFound)
-		return Color::BLACK;
+	if (scene.lights.lightSampleCount > 0)
+	{
+		uint64_t n = scene.lights.lightSampleCount;
+
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			LightBVHSample lightSample;
+
+			if (!scene.lightBVH.sample(intersection.position, intersection.onb.w, generator, lightSample))
+				continue;
 
-	Material* material = intersection.primitive->material;
+			Color sampledLightColor = lightSample.isSpotLight ?
+				getSpotLightColor(scene, ray, intersection, static_cast<const SpotLight&>(*lightSample.light), generator) :
+				getPointLightColor(scene, ray, intersection, *lightSample.light, generator);
 
-	if (material->isEmissive)
+			lightColor += sampledLightColor / (lightSample.probability * double(n));
+		}
+	}
+	else if (scene.lights.enableLightCulling)
 	{
-		Color emittance = material->emittance;
+		ScratchBuffer<LightBVHLight> lightsInRangeBuffer;
+		std::vector<LightBVHLight>& lightsInRange = lightsInRangeBuffer.get();
+		scene.lightBVH.getLightsInRange(intersection.position, lightsInRange);
 
-		if (material->emittanceMapTexture != nullptr)
-			emittance = material->emittanceMapTexture->getColor(intersection.texcoord, intersection.position) * material->emittanceMapTexture->intensity;
+		for (const LightBVHLight& light : lightsInRange)
+		{
+			if (light.isSpotLight)
+				lightColor += getSpotLightColor(scene, ray, intersection, static_cast<const SpotLight&>(*light.light), generator);
+			else
+				lightColor += getPointLightColor(scene, ray, intersection, *light.light, generator);
+		}
+	}
+	else
+	{
+		for (const PointLight& light : scene.lights.pointLights)
+			lightColor += getPointLightColor(scene, ray, intersection, light, generator);
 
-		return emittance;
+		for (const SpotLight& light : scene.lights.spotLights)
+			lightColor += getSpotLightColor(scene, ray, intersection, light, generator);
 	}
 
-	Sampler* sampler = samplers[SamplerType::RANDOM].get();
-	Vector3 newDirection = sampler->getHemisphereSample(intersection.onb, 1.0, 0, 0, 1, 1, 0, generator);
+	return lightColor / M_PI;
+}
+
+// area lights get one random position on the disc per path
+Color PathTracer::getPointLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const PointLight& light, std::mt19937& generator)
+{
+	Vector3 lightPosition = light.position;
 
-	Ray newRay;
-	newRay.origin = intersection.position + newDirection * scene.general.rayStartOffset;
-	newRay.direction = newDirection;
-	newRay.precalculate();
+	if (light.enableAreaLight)
+	{
+		Vector3 directionToLight = (light.position - intersection.position).normalized();
+		Vector3 lightRight = directionToLight.cross(Vector3::ALMOST_UP).normalized();
+		Vector3 lightUp = lightRight.cross(directionToLight).normalized();
+		Vector2 jitter = samplers[SamplerType::RANDOM]->getDiscSample(0, 0, 1, 1, 0, generator) * light.areaLightRadius;
+
+		lightPosition += jitter.x * lightRight + jitter.y * lightUp;
+	}
+
+	Vector3 directionToLight = lightPosition - intersection.position;
+	double distanceToLight = directionToLight.length();
+	directionToLight /= distanceToLight;
+
+	double cosine = directionToLight.dot(intersection.onb.w);
 
-	Color reflectance = material->diffuseReflectance;
+	if (cosine <= 0.0 || distanceToLight >= light.maxDistance)
+		return Color();
 
-	if (material->diffuseMapTexture != nullptr)
-		reflectance = material->diffuseMapTexture->getColor(intersection.texcoord, intersection.position) * material->diffuseMapTexture->intensity;
+	if (isOccluded(scene, ray, intersection, directionToLight, distanceToLight))
+		return Color();
+
+	double distanceAttenuation = 1.0 - pow(distanceToLight / light.maxDistance, light.attenuation);
+
+	return light.color * light.intensity * cosine * distanceAttenuation;
+}
+
+Color PathTracer::getSpotLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const SpotLight& light, std::mt19937& generator)
+{
+	Vector3 directionToLight = (light.position - intersection.position).normalized();
+	double sideAttenuation = light.direction.dot(-directionToLight);
 
-	double alpha = std::abs(newDirection.dot(intersection.normal));
-	Color brdf = 2.0 * reflectance * alpha;
-	Color reflected = traceRecursive(scene, newRay, iteration + 1, generator, interrupted);
+	if (sideAttenuation <= 0.0)
+		return Color();
+
+	sideAttenuation = std::min(1.0, (1.0 - sideAttenuation) / (light.angle / 180.0));
+	sideAttenuation = 1.0 - pow(sideAttenuation, light.sideAttenuation);
+
+	return getPointLightColor(scene, ray, intersection, light, generator) * sideAttenuation;
+}
+
+bool PathTracer::isOccluded(const Scene& scene, const Ray& ray, const Intersection& intersection, const Vector3& directionToLight, double distanceToLight)
+{
+	Ray shadowRay;
+	shadowRay.origin = intersection.position + directionToLight * scene.general.rayStartOffset;
+	shadowRay.direction = directionToLight;
+	shadowRay.isShadowRay = true;
+	shadowRay.maxDistance = distanceToLight;
+	shadowRay.time = ray.time;
+	shadowRay.precalculate();
+
+	return scene.occluded(shadowRay);
+}
+
+// solid angle pdf of reaching the hit point with the light sampling, zero if the primitive is not sampled
+double PathTracer::getEmissivePrimitivePdf(const Scene& scene, const Ray& ray, const Intersection& intersection)
+{
+	// instanced copies are not in the light list even if the original primitive is
+	if (intersection.instancePrimitive != nullptr || intersection.primitive->emissiveIndex < 0)
+		return 0.0;
+
+	double lightCosine = std::abs(ray.direction.dot(intersection.primitive->getGeometricNormal(intersection)));
+
+	if (lightCosine <= 0.0)
+		return 0.0;
+
+	return scene.emissivePrimitives.probabilities[uint64_t(intersection.primitive->emissiveIndex)] * intersection.distance * intersection.distance / (intersection.primitive->getArea() * lightCosine);
+}
+
+Color PathTracer::getEmittance(const Material* material, const Intersection& intersection)
+{
+	if (material->emittanceMapTexture != nullptr)
+		return material->emittanceMapTexture->getColor(intersection.texcoord, intersection.position) * material->emittanceMapTexture->intensity;
+
+	return material->emittance;
+}
+
+double PathTracer::getPowerHeuristic(double pdf1, double pdf2)
+{
+	double pdf1Squared = pdf1 * pdf1;
+	double pdf2Squared = pdf2 * pdf2;
 
-	return brdf * reflected;
+	return pdf1Squared / (pdf1Squared + pdf2Squared);
 }
@@ -11,8 +11,13 @@
 namespace Raycer
 {
 	struct TracerState;
+	struct Intersection;
+	struct PointLight;
+	struct SpotLight;
 	class Color;
 	class Ray;
+	class Vector3;
+	class Material;
 	
 	class PathTracer : public Tracer
 	{
@@ -22,6 +27,15 @@ namespace Raycer
 
 	private:
 
-		Color traceRecursive(const Scene& scene, const Ray& ray, uint64_t iteration, std::mt19937& generator, const std::atomic<bool>& interrupted);
+		Color tracePath(const Scene& scene, const Ray& ray, std::mt19937& generator, const std::atomic<bool>& interrupted);
+		Color sampleEmissivePrimitives(const Scene& scene, const Ray& ray, const Intersection& intersection, std::mt19937& generator);
+		Color sampleLights(const Scene& scene, const Ray& ray, const Intersection& intersection, std::mt19937& generator);
+		Color getPointLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const PointLight& light, std::mt19937& generator);
+		Color getSpotLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const SpotLight& light, std::mt19937& generator);
+
+		bool isOccluded(const Scene& scene, const Ray& ray, const Intersection& intersection, const Vector3& directionToLight, double distanceToLight);
+		double getEmissivePrimitivePdf(const Scene& scene, const Ray& ray, const Intersection& intersection);
+		Color getEmittance(const Material* material, const Intersection& intersection);
+		double getPowerHeuristic(double pdf1, double pdf2);
 	};
 }
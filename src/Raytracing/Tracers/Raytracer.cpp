@@ -9,12 +9,14 @@
 #include "Raytracing/Intersection.h"
 #include "Raytracing/Material.h"
 #include "Raytracing/Lights.h"
+#include "Raytracing/LightBVH.h"
 #include "Raytracing/Primitives/Primitive.h"
 #include "Raytracing/Textures/Texture.h"
 #include "Math/Vector2.h"
 #include "Math/Vector3.h"
 #include "Math/Color.h"
 #include "Math/ONB.h"
+#include "Utils/ScratchBuffer.h"
 
 using namespace Raycer;
 
@@ -31,15 +33,7 @@ Color Raytracer::traceRecursive(const Scene& scene, const Ray& ray, Intersection
 	if (interrupted)
 		return finalColor;
 
-	std::vector<Intersection> intersections;
-
-	for (Primitive* primitive : scene.primitives.visible)
-	{
-		intersections.clear();
-		primitive->intersect(ray, intersection, intersections);
-	}
-
-	if (!intersection.wasFound)
+	if (!scene.intersect(ray, intersection))
 		return finalColor;
 
 	if (scene.general.visualizeDepth)
@@ -346,43 +340,84 @@ Color Raytracer::calculateLightColor(const Scene& scene, const Ray& ray, const I
 		lightColor += directionalLightColor * (1.0 - shadowAmount);
 	}
 
-	for (const PointLight& light : scene.lights.pointLights)
+	// the light BVH either picks a few lights by their estimated contribution or leaves out the ones that cannot reach the point
+	if (scene.lights.lightSampleCount > 0)
 	{
-		Vector3 directionToLight = (light.position - intersection.position);
-		double distanceToLight = directionToLight.length();
-		directionToLight.normalize();
+		uint64_t n = scene.lights.lightSampleCount;
 
-		Color pointLightColor = calculatePhongShadingColor(intersection.normal, directionToLight, directionToCamera, light, finalDiffuseReflectance, finalSpecularReflectance, material->specularShininess);
-		double shadowAmount = calculateShadowAmount(scene, ray, intersection, light, generator);
-		double distanceAttenuation = std::min(1.0, distanceToLight / light.maxDistance);
-		distanceAttenuation = 1.0 - pow(distanceAttenuation, light.attenuation);
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			LightBVHSample lightSample;
 
-		lightColor += pointLightColor * distanceAttenuation * (1.0 - shadowAmount);
-	}
+			if (!scene.lightBVH.sample(intersection.position, intersection.normal, generator, lightSample))
+				continue;
 
-	for (const SpotLight& light : scene.lights.spotLights)
-	{
-		Vector3 directionToLight = (light.position - intersection.position);
-		double distanceToLight = directionToLight.length();
-		directionToLight.normalize();
+			Color sampledLightColor = lightSample.isSpotLight ?
+				calculateSpotLightColor(scene, ray, intersection, static_cast<const SpotLight&>(*lightSample.light), finalDiffuseReflectance, finalSpecularReflectance, generator) :
+				calculatePointLightColor(scene, ray, intersection, *lightSample.light, finalDiffuseReflectance, finalSpecularReflectance, generator);
 
-		Color spotLightColor = calculatePhongShadingColor(intersection.normal, directionToLight, directionToCamera, light, finalDiffuseReflectance, finalSpecularReflectance, material->specularShininess);
-		double shadowAmount = calculateShadowAmount(scene, ray, intersection, light, generator);
-		double distanceAttenuation = std::min(1.0, distanceToLight / light.maxDistance);
-		distanceAttenuation = 1.0 - pow(distanceAttenuation, light.attenuation);
-		double sideAttenuation = light.direction.dot(-directionToLight);
+			lightColor += sampledLightColor / (lightSample.probability * double(n));
+		}
+	}
+	else if (scene.lights.enableLightCulling)
+	{
+		ScratchBuffer<LightBVHLight> lightsInRangeBuffer;
+		std::vector<LightBVHLight>& lightsInRange = lightsInRangeBuffer.get();
+		scene.lightBVH.getLightsInRange(intersection.position, lightsInRange);
 
-		if (sideAttenuation > 0.0)
+		for (const LightBVHLight& light : lightsInRange)
 		{
-			sideAttenuation = std::min(1.0, (1.0 - sideAttenuation) / (light.angle / 180.0));
-			sideAttenuation = 1.0 - pow(sideAttenuation, light.sideAttenuation);
-			lightColor += spotLightColor * distanceAttenuation * sideAttenuation * (1.0 - shadowAmount);
+			if (light.isSpotLight)
+				lightColor += calculateSpotLightColor(scene, ray, intersection, static_cast<const SpotLight&>(*light.light), finalDiffuseReflectance, finalSpecularReflectance, generator);
+			else
+				lightColor += calculatePointLightColor(scene, ray, intersection, *light.light, finalDiffuseReflectance, finalSpecularReflectance, generator);
 		}
 	}
+	else
+	{
+		for (const PointLight& light : scene.lights.pointLights)
+			lightColor += calculatePointLightColor(scene, ray, intersection, light, finalDiffuseReflectance, finalSpecularReflectance, generator);
+
+		for (const SpotLight& light : scene.lights.spotLights)
+			lightColor += calculateSpotLightColor(scene, ray, intersection, light, finalDiffuseReflectance, finalSpecularReflectance, generator);
+	}
 
 	return lightColor;
 }
 
+Color Raytracer::calculatePointLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const PointLight& light, const Color& diffuseReflectance, const Color& specularReflectance, std::mt19937& generator)
+{
+	Vector3 directionToLight = (light.position - intersection.position);
+	double distanceToLight = directionToLight.length();
+	directionToLight.normalize();
+
+	double distanceAttenuation = std::min(1.0, distanceToLight / light.maxDistance);
+	distanceAttenuation = 1.0 - pow(distanceAttenuation, light.attenuation);
+
+	// no shadow rays for the lights that are attenuated out
+	if (distanceAttenuation <= 0.0 || directionToLight.dot(intersection.normal) <= 0.0)
+		return Color();
+
+	Color pointLightColor = calculatePhongShadingColor(intersection.normal, directionToLight, -ray.direction, light, diffuseReflectance, specularReflectance, intersection.primitive->material->specularShininess);
+	double shadowAmount = calculateShadowAmount(scene, ray, intersection, light, generator);
+
+	return pointLightColor * distanceAttenuation * (1.0 - shadowAmount);
+}
+
+Color Raytracer::calculateSpotLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const SpotLight& light, const Color& diffuseReflectance, const Color& specularReflectance, std::mt19937& generator)
+{
+	Vector3 directionToLight = (light.position - intersection.position).normalized();
+	double sideAttenuation = light.direction.dot(-directionToLight);
+
+	if (sideAttenuation <= 0.0)
+		return Color();
+
+	sideAttenuation = std::min(1.0, (1.0 - sideAttenuation) / (light.angle / 180.0));
+	sideAttenuation = 1.0 - pow(sideAttenuation, light.sideAttenuation);
+
+	return calculatePointLightColor(scene, ray, intersection, light, diffuseReflectance, specularReflectance, generator) * sideAttenuation;
+}
+
 Color Raytracer::calculatePhongShadingColor(const Vector3& normal, const Vector3& directionToLight, const Vector3& directionToCamera, const Light& light, const Color& diffuseReflectance, const Color& specularReflectance, double shininess)
 {
 	Color phongColor;
@@ -469,25 +504,14 @@ double Raytracer::calculateAmbientOcclusionAmount(const Scene& scene, const Inte
 			Vector3 sampleDirection = sampler->getHemisphereSample(intersection.onb, distribution, x, y, n, n, permutation, generator);
 
 			Ray sampleRay;
-			Intersection sampleIntersection;
-			std::vector<Intersection> sampleIntersections;
 
 			sampleRay.origin = intersection.position + sampleDirection * scene.general.rayStartOffset;
 			sampleRay.direction = sampleDirection;
-			sampleRay.fastOcclusion = true;
 			sampleRay.maxDistance = scene.lights.ambientLight.ambientOcclusionMaxSampleDistance;
 			sampleRay.precalculate();
 
-			for (Primitive* primitive : scene.primitives.visible)
-			{
-				sampleIntersections.clear();
-
-				if (primitive->intersect(sampleRay, sampleIntersection, sampleIntersections))
-				{
-					ambientOcclusion += 1.0;
-					break;
-				}
-			}
+			if (scene.occluded(sampleRay))
+				ambientOcclusion += 1.0;
 		}
 	}
 
@@ -499,26 +523,15 @@ double Raytracer::calculateShadowAmount(const Scene& scene, const Ray& ray, cons
 	Vector3 directionToLight = -light.direction;
 
 	Ray shadowRay;
-	Intersection shadowIntersection;
-	std::vector<Intersection> shadowIntersections;
 
 	shadowRay.origin = intersection.position + directionToLight * scene.general.rayStartOffset;
 	shadowRay.direction = directionToLight;
 	shadowRay.isShadowRay = true;
-	shadowRay.fastOcclusion = true;
 	shadowRay.maxDistance = std::numeric_limits<double>::max();
 	shadowRay.time = ray.time;
 	shadowRay.precalculate();
 
-	for (Primitive* primitive : scene.primitives.visible)
-	{
-		shadowIntersections.clear();
-
-		if (primitive->intersect(shadowRay, shadowIntersection, shadowIntersections))
-			return 1.0;
-	}
-
-	return 0.0;
+	return scene.occluded(shadowRay) ? 1.0 : 0.0;
 }
 
 double Raytracer::calculateShadowAmount(const Scene& scene, const Ray& ray, const Intersection& intersection, const PointLight& light, std::mt19937& generator)
@@ -528,26 +541,15 @@ double Raytracer::calculateShadowAmount(const Scene& scene, const Ray& ray, cons
 	if (!light.enableAreaLight)
 	{
 		Ray shadowRay;
-		Intersection shadowIntersection;
-		std::vector<Intersection> shadowIntersections;
 
 		shadowRay.origin = intersection.position + directionToLight * scene.general.rayStartOffset;
 		shadowRay.direction = directionToLight;
 		shadowRay.isShadowRay = true;
-		shadowRay.fastOcclusion = true;
 		shadowRay.maxDistance = (light.position - intersection.position).length();
 		shadowRay.time = ray.time;
 		shadowRay.precalculate();
 
-		for (Primitive* primitive : scene.primitives.visible)
-		{
-			shadowIntersections.clear();
-
-			if (primitive->intersect(shadowRay, shadowIntersection, shadowIntersections))
-				return 1.0;
-		}
-
-		return 0.0;
+		return scene.occluded(shadowRay) ? 1.0 : 0.0;
 	}
 
 	Vector3 lightRight = directionToLight.cross(Vector3::ALMOST_UP).normalized();
@@ -569,27 +571,16 @@ double Raytracer::calculateShadowAmount(const Scene& scene, const Ray& ray, cons
 			Vector3 newDirectionToLight = (newLightPosition - intersection.position).normalized();
 
 			Ray shadowRay;
-			Intersection shadowIntersection;
-			std::vector<Intersection> shadowIntersections;
 
 			shadowRay.origin = intersection.position + newDirectionToLight * scene.general.rayStartOffset;
 			shadowRay.direction = newDirectionToLight;
 			shadowRay.isShadowRay = true;
-			shadowRay.fastOcclusion = true;
 			shadowRay.maxDistance = (newLightPosition - intersection.position).length();
 			shadowRay.time = ray.time;
 			shadowRay.precalculate();
 
-			for (Primitive* primitive : scene.primitives.visible)
-			{
-				shadowIntersections.clear();
-
-				if (primitive->intersect(shadowRay, shadowIntersection, shadowIntersections))
-				{
-					shadowAmount += 1.0;
-					break;
-				}
-			}
+			if (scene.occluded(shadowRay))
+				shadowAmount += 1.0;
 		}
 	}
 
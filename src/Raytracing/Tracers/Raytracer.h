@@ -18,6 +18,7 @@ namespace Raycer
 	struct Light;
 	struct DirectionalLight;
 	struct PointLight;
+	struct SpotLight;
 
 	class Raytracer : public Tracer
 	{
@@ -34,6 +35,8 @@ namespace Raycer
 		Color calculateReflectedColor(const Scene& scene, const Ray& ray, const Intersection& intersection, double rayReflectance, uint64_t iteration, std::mt19937& generator, const std::atomic<bool>& interrupted);
 		Color calculateTransmittedColor(const Scene& scene, const Ray& ray, const Intersection& intersection, double rayTransmittance, uint64_t iteration, std::mt19937& generator, const std::atomic<bool>& interrupted);
 		Color calculateLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, std::mt19937& generator);
+		Color calculatePointLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const PointLight& light, const Color& diffuseReflectance, const Color& specularReflectance, std::mt19937& generator);
+		Color calculateSpotLightColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const SpotLight& light, const Color& diffuseReflectance, const Color& specularReflectance, std::mt19937& generator);
 		Color calculatePhongShadingColor(const Vector3& normal, const Vector3& directionToLight, const Vector3& directionToCamera, const Light& light, const Color& diffuseReflectance, const Color& specularReflectance, double shininess);
 		Color calculateSimpleFogColor(const Scene& scene, const Intersection& intersection, const Color& pixelColor);
 		Color calculateVolumetricFogColor(const Scene& scene, const Ray& ray, const Intersection& intersection, const Color& pixelColor, std::mt19937& generator);
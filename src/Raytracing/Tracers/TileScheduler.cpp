@@ -0,0 +1,182 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#include "Raytracing/Tracers/TileScheduler.h"
+
+using namespace Raycer;
+
+void TileScheduler::initialize(uint64_t filmWidth, uint64_t filmHeight, uint64_t pixelStartOffset, uint64_t pixelCount, uint64_t tileSize, TileOrder order, uint64_t threadCount)
+{
+	assert(tileSize >= 1 && threadCount >= 1);
+
+	tiles.clear();
+	queues.clear();
+
+	for (uint64_t i = 0; i < threadCount; ++i)
+		queues.push_back(std::make_unique<TileQueue>());
+
+	if (pixelCount == 0 || filmWidth == 0)
+		return;
+
+	// the tile grid covers the rows of the pixel range, the pixels outside of the range are skipped when tracing
+	uint64_t startRow = pixelStartOffset / filmWidth;
+	uint64_t endRow = std::min(filmHeight, (pixelStartOffset + pixelCount - 1) / filmWidth + 1);
+	uint64_t tileCountX = (filmWidth + tileSize - 1) / tileSize;
+	uint64_t tileCountY = (endRow - startRow + tileSize - 1) / tileSize;
+
+	std::vector<std::pair<double, Tile>> orderedTiles;
+
+	uint64_t hilbertSize = 1;
+
+	while (hilbertSize < std::max(tileCountX, tileCountY))
+		hilbertSize *= 2;
+
+	double centerX = double(filmWidth) / 2.0;
+	double centerY = double(startRow + endRow) / 2.0;
+
+	for (uint64_t tileY = 0; tileY < tileCountY; ++tileY)
+	{
+		for (uint64_t tileX = 0; tileX < tileCountX; ++tileX)
+		{
+			Tile tile;
+			tile.x = tileX * tileSize;
+			tile.y = startRow + tileY * tileSize;
+			tile.width = std::min(tileSize, filmWidth - tile.x);
+			tile.height = std::min(tileSize, endRow - tile.y);
+
+			double key = 0.0;
+
+			switch (order)
+			{
+				case TileOrder::LINEAR: key = double(tileY * tileCountX + tileX); break;
+				case TileOrder::MORTON: key = double(getMortonIndex(tileX, tileY)); break;
+				case TileOrder::HILBERT: key = double(getHilbertIndex(hilbertSize, tileX, tileY)); break;
+				case TileOrder::CENTER_OUT:
+				{
+					double dx = double(tile.x) + double(tile.width) / 2.0 - centerX;
+					double dy = double(tile.y) + double(tile.height) / 2.0 - centerY;
+					key = dx * dx + dy * dy;
+				} break;
+				default: throw std::runtime_error("Invalid tile order");
+			}
+
+			orderedTiles.push_back(std::make_pair(key, tile));
+		}
+	}
+
+	std::stable_sort(orderedTiles.begin(), orderedTiles.end(), [](const std::pair<double, Tile>& t1, const std::pair<double, Tile>& t2)
+	{
+		return t1.first < t2.first;
+	});
+
+	for (const auto& orderedTile : orderedTiles)
+		tiles.push_back(orderedTile.second);
+
+	// the space filling orders are split to contiguous runs so that every thread stays in its own region of the film
+	// center out is dealt round robin so that all the threads work near the center first
+	for (uint64_t i = 0; i < tiles.size(); ++i)
+	{
+		uint64_t queueIndex = (order == TileOrder::CENTER_OUT) ? (i % threadCount) : (i * threadCount / tiles.size());
+		queues[queueIndex]->tiles.push_back(tiles[i]);
+	}
+}
+
+bool TileScheduler::getNextTile(uint64_t threadIndex, Tile& tile)
+{
+	assert(threadIndex < queues.size());
+
+	{
+		TileQueue& queue = *queues[threadIndex];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (!queue.tiles.empty())
+		{
+			tile = queue.tiles.front();
+			queue.tiles.pop_front();
+
+			return true;
+		}
+	}
+
+	// steal from the end of the longest queue, the tiles there are the furthest away from where its owner is working
+	for (;;)
+	{
+		uint64_t victimIndex = 0;
+		uint64_t victimTileCount = 0;
+
+		for (uint64_t i = 0; i < queues.size(); ++i)
+		{
+			std::lock_guard<std::mutex> lock(queues[i]->mutex);
+
+			if (queues[i]->tiles.size() > victimTileCount)
+			{
+				victimIndex = i;
+				victimTileCount = queues[i]->tiles.size();
+			}
+		}
+
+		if (victimTileCount == 0)
+			return false;
+
+		TileQueue& victim = *queues[victimIndex];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		// the owner may have emptied the queue in between
+		if (!victim.tiles.empty())
+		{
+			tile = victim.tiles.back();
+			victim.tiles.pop_back();
+
+			return true;
+		}
+	}
+}
+
+const std::vector<Tile>& TileScheduler::getTiles() const
+{
+	return tiles;
+}
+
+uint64_t TileScheduler::getMortonIndex(uint64_t x, uint64_t y)
+{
+	uint64_t index = 0;
+
+	for (uint64_t bit = 0; bit < 32; ++bit)
+	{
+		index |= ((x >> bit) & 1) << (2 * bit);
+		index |= ((y >> bit) & 1) << (2 * bit + 1);
+	}
+
+	return index;
+}
+
+// size is a power of two that covers both x and y
+// https://en.wikipedia.org/wiki/Hilbert_curve
+uint64_t TileScheduler::getHilbertIndex(uint64_t size, uint64_t x, uint64_t y)
+{
+	uint64_t index = 0;
+
+	for (uint64_t s = size / 2; s > 0; s /= 2)
+	{
+		uint64_t rx = (x & s) > 0 ? 1 : 0;
+		uint64_t ry = (y & s) > 0 ? 1 : 0;
+
+		index += s * s * ((3 * rx) ^ ry);
+
+		// rotate the quadrant
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = size - 1 - x;
+				y = size - 1 - y;
+			}
+
+			std::swap(x, y);
+		}
+	}
+
+	return index;
+}
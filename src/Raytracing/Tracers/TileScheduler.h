@@ -0,0 +1,48 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Raycer
+{
+	enum class TileOrder { LINEAR, MORTON, HILBERT, CENTER_OUT };
+
+	struct Tile
+	{
+		uint64_t x;
+		uint64_t y;
+		uint64_t width;
+		uint64_t height;
+	};
+
+	// splits the pixel range of the film to tiles, every thread works through its own queue and an idle thread steals from the end of the others
+	class TileScheduler
+	{
+	public:
+
+		void initialize(uint64_t filmWidth, uint64_t filmHeight, uint64_t pixelStartOffset, uint64_t pixelCount, uint64_t tileSize, TileOrder order, uint64_t threadCount);
+		bool getNextTile(uint64_t threadIndex, Tile& tile);
+
+		// all the tiles in the render order
+		const std::vector<Tile>& getTiles() const;
+
+		static uint64_t getMortonIndex(uint64_t x, uint64_t y);
+		static uint64_t getHilbertIndex(uint64_t size, uint64_t x, uint64_t y);
+
+	private:
+
+		struct TileQueue
+		{
+			std::mutex mutex;
+			std::deque<Tile> tiles;
+		};
+
+		std::vector<Tile> tiles;
+		std::vector<std::unique_ptr<TileQueue>> queues;
+	};
+}
@@ -71,37 +71,52 @@ void Tracer::run(TracerState& state, std::atomic<bool>& interrupted)
 			generator.seed(rd());
 	}
 
+	const Scene& scene = *state.scene;
+	tileScheduler.initialize(state.filmWidth, state.filmHeight, state.pixelStartOffset, state.pixelCount, std::max(uint64_t(1), scene.general.tileSize), scene.general.tileOrder, maxThreads);
+
 	std::mutex ompThreadExceptionMutex;
 	std::exception_ptr ompThreadException = nullptr;
 
-	#pragma omp parallel for schedule(dynamic, 1000)
-	for (int64_t pixelIndex = 0; pixelIndex < int64_t(state.pixelCount); ++pixelIndex)
+	#pragma omp parallel
 	{
-		try
-		{
-			if (interrupted)
-				continue;
+		uint64_t threadIndex = uint64_t(omp_get_thread_num());
+		std::mt19937& generator = generators[threadIndex];
+		uint64_t pixelEndOffset = state.pixelStartOffset + state.pixelCount;
+		Tile tile;
 
-			uint64_t offsetPixelIndex = uint64_t(pixelIndex) + state.pixelStartOffset;
-			double x = double(offsetPixelIndex % state.filmWidth);
-			double y = double(offsetPixelIndex / state.filmWidth);
-			Vector2 pixelCoordinate = Vector2(x, y);
-			std::mt19937& generator = generators[omp_get_thread_num()];
-
-			generateMultiSamples(*state.scene, *state.film, pixelCoordinate, uint64_t(pixelIndex), generator, interrupted);
-			
-			// progress reporting to another thread
-			if ((pixelIndex + 1) % 100 == 0)
-				state.pixelsProcessed += 100;
-		}
-		catch (...)
+		while (!interrupted && tileScheduler.getNextTile(threadIndex, tile))
 		{
-			std::lock_guard<std::mutex> lock(ompThreadExceptionMutex);
+			try
+			{
+				for (uint64_t y = tile.y; y < tile.y + tile.height && !interrupted; ++y)
+				{
+					uint64_t pixelsProcessed = 0;
+
+					for (uint64_t x = tile.x; x < tile.x + tile.width; ++x)
+					{
+						uint64_t offsetPixelIndex = y * state.filmWidth + x;
 
-			if (ompThreadException == nullptr)
-				ompThreadException = std::current_exception();
+						// the first and the last row of the pixel range can be partial
+						if (offsetPixelIndex < state.pixelStartOffset || offsetPixelIndex >= pixelEndOffset)
+							continue;
 
-			interrupted = true;
+						generateMultiSamples(scene, *state.film, Vector2(double(x), double(y)), offsetPixelIndex - state.pixelStartOffset, generator, interrupted);
+						pixelsProcessed++;
+					}
+
+					// progress reporting to another thread
+					state.pixelsProcessed += pixelsProcessed;
+				}
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(ompThreadExceptionMutex);
+
+				if (ompThreadException == nullptr)
+					ompThreadException = std::current_exception();
+
+				interrupted = true;
+			}
 		}
 	}
 
@@ -10,6 +10,7 @@
 
 #include "Rendering/Samplers/Sampler.h"
 #include "Rendering/Filters/Filter.h"
+#include "Raytracing/Tracers/TileScheduler.h"
 
 namespace Raycer
 {
@@ -47,5 +48,6 @@ namespace Raycer
 		Color generateCameraSamples(const Scene& scene, const Vector2& pixelCoordinate, double time, std::mt19937& generator, const std::atomic<bool>& interrupted);
 		
 		std::vector<std::mt19937> generators;
+		TileScheduler tileScheduler;
 	};
 }
@@ -247,6 +247,9 @@ void DefaultState::update(double timeStep)
 	}
 
 	scene.camera.update(scene, timeStep);
+
+	if (scene.camera.hasMovedPrimitive())
+		scene.refitRootBVH();
 }
 
 void DefaultState::render(double timeStep, double interpolation)
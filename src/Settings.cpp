@@ -15,6 +15,10 @@ void Settings::load(const std::string& fileName)
 
 	general.interactive = iniReader.getValue<bool>("general", "interactive");
 	general.maxThreadCount = iniReader.getValue<int32_t>("general", "maxThreadCount");
+	general.bvhBuildThreadCount = iniReader.getValue<int32_t>("general", "bvhBuildThreadCount");
+	general.bvhCacheEnabled = iniReader.getValue<bool>("general", "bvhCacheEnabled");
+	general.bvhCacheDirectory = iniReader.getValue("general", "bvhCacheDirectory");
+	general.bvhCacheMaxSize = iniReader.getValue<uint64_t>("general", "bvhCacheMaxSize");
 	general.checkGLErrors = iniReader.getValue<bool>("general", "checkGLErrors");
 	general.checkCLErrors = iniReader.getValue<bool>("general", "checkCLErrors");
 
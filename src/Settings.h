@@ -15,6 +15,10 @@ namespace Raycer
 		{
 			bool interactive;
 			int32_t maxThreadCount;
+			int32_t bvhBuildThreadCount;
+			bool bvhCacheEnabled;
+			std::string bvhCacheDirectory;
+			uint64_t bvhCacheMaxSize;
 			bool checkGLErrors;
 			bool checkCLErrors;
 		} general;
@@ -12,7 +12,6 @@ Scene Scene::createTestScene1()
 {
 	Scene scene;
 
-	scene.rootBVH.enabled = true;
 	scene.rootBVH.buildInfo.maxLeafSize = 1;
 
 	// CAMERA //
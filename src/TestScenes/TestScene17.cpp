@@ -12,8 +12,6 @@ Scene Scene::createTestScene17()
 {
 	Scene scene;
 
-	scene.rootBVH.enabled = true;
-
 	// CAMERA //
 
 	scene.camera.position = Vector3(0.0, 3.8, 0.0);
@@ -12,8 +12,6 @@ Scene Scene::createTestScene18()
 {
 	Scene scene;
 
-	scene.rootBVH.enabled = true;
-
 	// CAMERA //
 
 	scene.camera.position = Vector3(8.92, 0.68, -2.02);
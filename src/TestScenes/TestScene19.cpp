@@ -15,8 +15,6 @@ Scene Scene::createTestScene19()
 	scene.general.tracerType = TracerType::RAY;
 	scene.general.pathSampleCount = 1;
 
-	scene.rootBVH.enabled = true;
-
 	// CAMERA //
 
 	scene.camera.position = Vector3(0.0, 5.0, 5.0);
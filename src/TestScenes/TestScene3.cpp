@@ -12,8 +12,6 @@ Scene Scene::createTestScene3()
 {
 	Scene scene;
 
-	scene.rootBVH.enabled = true;
-
 	// CAMERA //
 
 	scene.camera.position = Vector3(0.0, 1.0, 3.5);
@@ -15,8 +15,6 @@ Scene Scene::createTestScene5()
 	scene.general.backgroundColor = Color(0.8, 0.8, 0.8);
 	scene.general.maxRayIterations = 4;
 
-	scene.rootBVH.enabled = true;
-
 	scene.simpleFog.enabled = true;
 	scene.simpleFog.color = Color(0.8, 0.8, 0.8);
 	scene.simpleFog.distance = 200.0;
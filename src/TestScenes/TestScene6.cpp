@@ -12,8 +12,6 @@ Scene Scene::createTestScene6()
 {
 	Scene scene;
 
-	scene.rootBVH.enabled = true;
-
 	scene.simpleFog.enabled = true;
 	scene.simpleFog.distance = 200.0;
 	scene.simpleFog.steepness = 2.0;
@@ -0,0 +1,123 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Math/Vector3.h"
+
+using namespace Raycer;
+
+TEST_CASE("BlinnBlob functionality", "[blinnblob]")
+{
+	std::mt19937 generator(3307);
+	std::uniform_real_distribution<double> randomPosition(-2.0, 2.0);
+	std::uniform_real_distribution<double> randomRadius(0.2, 0.6);
+	std::uniform_real_distribution<double> randomBlobbiness(2.0, 6.0);
+
+	Scene scene;
+
+	BlinnBlob blinnBlob;
+	blinnBlob.id = 1;
+	blinnBlob.solverIterations = 32;
+
+	for (uint64_t i = 0; i < 60; ++i)
+	{
+		BlinnBlobDescription blob;
+		blob.position = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+		blob.radius = randomRadius(generator);
+		blob.blobbiness = randomBlobbiness(generator);
+		blob.isNegative = (i % 6 == 0);
+
+		blinnBlob.blobs.push_back(blob);
+	}
+
+	scene.primitives.blinnBlobs.push_back(blinnBlob);
+	scene.initialize();
+
+	// the whole field with the same cutoff
+	auto evaluate = [&](const Vector3& point)
+	{
+		double sum = 0.0;
+
+		for (const BlinnBlobDescription& blob : blinnBlob.blobs)
+		{
+			double influenceRadius = blob.radius * (1.0 + log(1.0 / BlinnBlob::INFLUENCE_THRESHOLD) / blob.blobbiness);
+			double distance = (point - blob.position).length();
+
+			if (distance <= influenceRadius)
+				sum += exp(-blob.blobbiness / blob.radius * distance + blob.blobbiness) * (blob.isNegative ? -1.0 : 1.0);
+		}
+
+		return sum - 1.0;
+	};
+
+	uint64_t hitCount = 0;
+
+	for (uint64_t i = 0; i < 300; ++i)
+	{
+		// some of the rays start inside
+		Ray ray;
+		ray.origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * ((i % 3 == 0) ? 1.0 : 4.0);
+		ray.direction = (Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 0.5 - ray.origin).normalized();
+		ray.precalculate();
+
+		Intersection blobIntersection;
+		scene.intersect(ray, blobIntersection);
+
+		// march to the first change of sign and bisect it
+		bool originIsInside = (evaluate(ray.origin) > 0.0);
+		double stepSize = 0.0005;
+		double referenceDistance = -1.0;
+		double closestValue = std::abs(evaluate(ray.origin));
+
+		for (double t = stepSize; t < 20.0; t += stepSize)
+		{
+			double value = evaluate(ray.origin + t * ray.direction);
+			closestValue = std::min(closestValue, std::abs(value));
+
+			if ((value > 0.0) != originIsInside)
+			{
+				double t0 = t - stepSize;
+				double t1 = t;
+
+				for (uint64_t j = 0; j < 50; ++j)
+				{
+					double tm = (t0 + t1) / 2.0;
+
+					if ((evaluate(ray.origin + tm * ray.direction) > 0.0) != originIsInside)
+						t1 = tm;
+					else
+						t0 = tm;
+				}
+
+				referenceDistance = t1;
+				break;
+			}
+		}
+
+		// grazing rays are ambiguous for both
+		if (referenceDistance < 0.0 && closestValue < 1.0e-3)
+			continue;
+
+		REQUIRE(blobIntersection.wasFound == (referenceDistance >= 0.0));
+
+		if (blobIntersection.wasFound)
+		{
+			hitCount++;
+
+			REQUIRE(blobIntersection.distance == Approx(referenceDistance).epsilon(1.0e-5));
+			REQUIRE(blobIntersection.normal.length() == Approx(1.0));
+		}
+	}
+
+	REQUIRE(hitCount > 50);
+}
+
+#endif
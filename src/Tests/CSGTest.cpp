@@ -0,0 +1,141 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Math/Vector3.h"
+
+using namespace Raycer;
+
+TEST_CASE("CSG functionality", "[csg]")
+{
+	std::mt19937 generator(7193);
+	std::uniform_real_distribution<double> randomPosition(-1.0, 1.0);
+	std::uniform_real_distribution<double> randomSize(0.5, 1.5);
+
+	for (uint64_t sceneIndex = 0; sceneIndex < 10; ++sceneIndex)
+	{
+		Scene scene;
+
+		Material material;
+		material.id = 1;
+		material.enableCSG = true;
+		scene.materials.push_back(material);
+
+		Box box;
+		box.id = 1;
+		box.invisible = true;
+		box.materialId = material.id;
+		box.position = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+		box.extent = Vector3(randomSize(generator), randomSize(generator), randomSize(generator)) * 2.0;
+		scene.primitives.boxes.push_back(box);
+
+		Sphere spheres[3];
+
+		for (uint64_t i = 0; i < 3; ++i)
+		{
+			spheres[i].id = i + 2;
+			spheres[i].invisible = true;
+			spheres[i].materialId = material.id;
+			spheres[i].position = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+			spheres[i].radius = randomSize(generator);
+			scene.primitives.spheres.push_back(spheres[i]);
+		}
+
+		// (box - sphere1) + (sphere2 * sphere3)
+		CSG difference;
+		difference.id = 10;
+		difference.invisible = true;
+		difference.materialId = material.id;
+		difference.operation = CSGOperation::DIFFERENCE;
+		difference.leftPrimitiveId = box.id;
+		difference.rightPrimitiveId = spheres[0].id;
+
+		CSG intersection;
+		intersection.id = 11;
+		intersection.invisible = true;
+		intersection.materialId = material.id;
+		intersection.operation = CSGOperation::INTERSECTION;
+		intersection.leftPrimitiveId = spheres[1].id;
+		intersection.rightPrimitiveId = spheres[2].id;
+
+		CSG csgUnion;
+		csgUnion.id = 12;
+		csgUnion.materialId = material.id;
+		csgUnion.operation = CSGOperation::UNION;
+		csgUnion.leftPrimitiveId = difference.id;
+		csgUnion.rightPrimitiveId = intersection.id;
+
+		scene.primitives.csgs.push_back(difference);
+		scene.primitives.csgs.push_back(intersection);
+		scene.primitives.csgs.push_back(csgUnion);
+		scene.initialize();
+
+		auto isInsideSphere = [&](const Sphere& sphere, const Vector3& point)
+		{
+			return (point - sphere.position).length() < sphere.radius;
+		};
+
+		auto isInside = [&](const Vector3& point)
+		{
+			Vector3 min = box.position - box.extent / 2.0;
+			Vector3 max = box.position + box.extent / 2.0;
+			bool isInsideBox = point.x > min.x && point.y > min.y && point.z > min.z && point.x < max.x && point.y < max.y && point.z < max.z;
+
+			return (isInsideBox && !isInsideSphere(spheres[0], point)) || (isInsideSphere(spheres[1], point) && isInsideSphere(spheres[2], point));
+		};
+
+		for (uint64_t i = 0; i < 200; ++i)
+		{
+			// half of the rays start inside the bounds
+			Ray ray;
+			ray.origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * ((i % 2 == 0) ? 6.0 : 1.0);
+			ray.direction = (Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) - ray.origin).normalized();
+			ray.precalculate();
+
+			Intersection csgIntersection;
+			scene.intersect(ray, csgIntersection);
+
+			// march to the first change of the inside state and bisect it
+			bool originIsInside = isInside(ray.origin);
+			double stepSize = 0.001;
+			double referenceDistance = -1.0;
+
+			for (double t = stepSize; t < 20.0; t += stepSize)
+			{
+				if (isInside(ray.origin + t * ray.direction) != originIsInside)
+				{
+					double t0 = t - stepSize;
+					double t1 = t;
+
+					for (uint64_t j = 0; j < 50; ++j)
+					{
+						double tm = (t0 + t1) / 2.0;
+
+						if (isInside(ray.origin + tm * ray.direction) != originIsInside)
+							t1 = tm;
+						else
+							t0 = tm;
+					}
+
+					referenceDistance = t1;
+					break;
+				}
+			}
+
+			REQUIRE(csgIntersection.wasFound == (referenceDistance >= 0.0));
+
+			if (csgIntersection.wasFound)
+				REQUIRE(csgIntersection.distance == Approx(referenceDistance).epsilon(1.0e-6));
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,513 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Raytracing/Primitives/Primitive.h"
+#include "Math/Vector3.h"
+#include "App.h"
+#include "Settings.h"
+
+using namespace Raycer;
+
+namespace
+{
+	// vertices within offsetSize of a random center, the centers are within [-10, 10] * centerScale
+	Triangle createRandomTriangle(uint64_t id, double centerScale, double offsetSize, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<double> randomPosition(-10.0, 10.0);
+		std::uniform_real_distribution<double> randomOffset(-offsetSize, offsetSize);
+
+		Vector3 center = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * centerScale;
+
+		Triangle triangle;
+		triangle.id = id;
+		triangle.vertices[0] = center + Vector3(randomOffset(generator), randomOffset(generator), randomOffset(generator));
+		triangle.vertices[1] = center + Vector3(randomOffset(generator), randomOffset(generator), randomOffset(generator));
+		triangle.vertices[2] = center + Vector3(randomOffset(generator), randomOffset(generator), randomOffset(generator));
+
+		return triangle;
+	}
+
+	// initialized triangles with ids starting from 1 for building BVHs directly
+	void createRandomTriangles(std::vector<Triangle>& triangles, std::vector<Primitive*>& primitives, Material* material, double offsetSize, std::mt19937& generator)
+	{
+		Scene scene;
+
+		for (uint64_t i = 0; i < triangles.size(); ++i)
+		{
+			triangles[i] = createRandomTriangle(i + 1, 1.0, offsetSize, generator);
+			triangles[i].material = material;
+			triangles[i].initialize(scene);
+
+			primitives.push_back(&triangles[i]);
+		}
+	}
+
+	// from around the primitives through a random point among them
+	Ray createRandomRay(std::mt19937& generator)
+	{
+		std::uniform_real_distribution<double> randomPosition(-10.0, 10.0);
+
+		Ray ray;
+		ray.origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 1.5;
+		ray.direction = (Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) - ray.origin).normalized();
+		ray.precalculate();
+
+		return ray;
+	}
+
+	// the closest and any hits of the accelerated primitives match the brute force search
+	void checkIntersections(const std::vector<Primitive*>& primitives, const std::vector<Primitive*>& referencePrimitives, uint64_t rayCount, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<double> randomDistance(5.0, 25.0);
+
+		for (uint64_t i = 0; i < rayCount; ++i)
+		{
+			Ray ray = createRandomRay(generator);
+
+			Intersection intersection;
+			Intersection referenceIntersection;
+			std::vector<Intersection> intersections;
+
+			for (Primitive* primitive : primitives)
+				primitive->intersect(ray, intersection, intersections);
+
+			for (Primitive* primitive : referencePrimitives)
+				primitive->intersect(ray, referenceIntersection, intersections);
+
+			REQUIRE(intersection.wasFound == referenceIntersection.wasFound);
+			REQUIRE(intersection.distance == referenceIntersection.distance);
+			REQUIRE(intersection.primitive == referenceIntersection.primitive);
+
+			ray.maxDistance = randomDistance(generator);
+
+			bool occluded = std::any_of(primitives.begin(), primitives.end(), [&ray](Primitive* primitive) { return primitive->occluded(ray); });
+			REQUIRE(occluded == (referenceIntersection.wasFound && referenceIntersection.distance <= ray.maxDistance));
+		}
+	}
+}
+
+TEST_CASE("FlatBVH functionality", "[flatbvh]")
+{
+	std::mt19937 generator(4857);
+	std::uniform_real_distribution<double> randomOffset(-1.0, 1.0);
+
+	Scene scene;
+
+	for (uint64_t i = 0; i < 2000; ++i)
+		scene.primitives.triangles.push_back(createRandomTriangle(i + 1, 1.0, 1.0, generator));
+
+	scene.initialize();
+
+	auto checkSceneIntersections = [&]()
+	{
+		checkIntersections(scene.primitives.visible, scene.primitives.visibleOriginal, 1000, generator);
+	};
+
+	checkSceneIntersections();
+
+	scene.rootBVH.buildInfo.useBinnedSAH = true;
+	scene.rebuildRootBVH();
+	checkSceneIntersections();
+
+	scene.rootBVH.buildInfo.useSAH = false;
+	scene.rebuildRootBVH();
+	checkSceneIntersections();
+
+	scene.rootBVH.buildInfo.useQBVH = true;
+	scene.rebuildRootBVH();
+	checkSceneIntersections();
+
+	scene.rootBVH.buildInfo.useQBVH = false;
+	scene.rootBVH.buildInfo.useSpatialSplits = true;
+	scene.rebuildRootBVH();
+	checkSceneIntersections();
+
+	// leafs only reference primitives in the tree
+	for (const FlatBVHNode& flatNode : scene.rootBVH.bvh.flatNodes)
+	{
+		if (flatNode.rightOffset == 0)
+			REQUIRE(flatNode.startOffset + flatNode.primitiveCount <= scene.rootBVH.bvh.orderedPrimitives.size());
+	}
+
+	REQUIRE(scene.rootBVH.bvh.orderedPrimitives.size() <= uint64_t(double(scene.primitives.triangles.size()) * (1.0 + scene.rootBVH.buildInfo.spatialSplitBudget)));
+
+	std::uniform_int_distribution<uint64_t> randomIndex(0, scene.primitives.triangles.size() - 1);
+
+	// small moves are refitted, large ones eventually trigger a rebuild
+	for (bool useQBVH : { false, true })
+	{
+		scene.rootBVH.buildInfo.useQBVH = useQBVH;
+		scene.rebuildRootBVH();
+
+		for (double moveDistance : { 0.5, 5.0, 50.0 })
+		{
+			for (uint64_t i = 0; i < 20; ++i)
+				scene.primitives.triangles[randomIndex(generator)].transform(Vector3(1.0, 1.0, 1.0), EulerAngle(), Vector3(randomOffset(generator), randomOffset(generator), randomOffset(generator)) * moveDistance);
+
+			scene.refitRootBVH();
+			REQUIRE(scene.rootBVH.bvh.calculateSAHCost() <= scene.rootBVH.bvh.builtSAHCost * (1.0 + scene.rootBVH.buildInfo.refitRebuildThreshold));
+			checkSceneIntersections();
+		}
+	}
+}
+
+TEST_CASE("FlatBVH parallel build", "[flatbvh]")
+{
+	std::mt19937 generator(9235);
+	std::vector<Triangle> triangles(20000);
+	std::vector<Primitive*> primitives;
+	createRandomTriangles(triangles, primitives, nullptr, 0.5, generator);
+
+	BVHBuildInfo buildInfo;
+	buildInfo.useBinnedSAH = true;
+
+	Settings& settings = App::getSettings();
+	int32_t originalThreadCount = settings.general.bvhBuildThreadCount;
+
+	FlatBVH serialBVH;
+	settings.general.bvhBuildThreadCount = 1;
+	serialBVH.build(primitives, buildInfo);
+
+	FlatBVH parallelBVH;
+	settings.general.bvhBuildThreadCount = 4;
+	parallelBVH.build(primitives, buildInfo);
+
+	// random splits are seeded per subtree
+	BVHBuildInfo randomBuildInfo;
+	randomBuildInfo.useSAH = false;
+	randomBuildInfo.axisSelection = BVHAxisSelection::RANDOM;
+	randomBuildInfo.axisSplit = BVHAxisSplit::RANDOM;
+
+	FlatBVH randomBVH1;
+	randomBVH1.build(primitives, randomBuildInfo);
+
+	FlatBVH randomBVH2;
+	randomBVH2.build(primitives, randomBuildInfo);
+
+	settings.general.bvhBuildThreadCount = originalThreadCount;
+
+	auto checkLayout = [](const FlatBVH& bvh1, const FlatBVH& bvh2)
+	{
+		REQUIRE(bvh1.flatNodes.size() == bvh2.flatNodes.size());
+		REQUIRE(bvh1.orderedPrimitiveIds == bvh2.orderedPrimitiveIds);
+
+		for (uint64_t i = 0; i < bvh1.flatNodes.size(); ++i)
+		{
+			REQUIRE(bvh1.flatNodes[i].rightOffset == bvh2.flatNodes[i].rightOffset);
+			REQUIRE(bvh1.flatNodes[i].startOffset == bvh2.flatNodes[i].startOffset);
+			REQUIRE(bvh1.flatNodes[i].primitiveCount == bvh2.flatNodes[i].primitiveCount);
+		}
+	};
+
+	// the layout does not depend on the task scheduling
+	checkLayout(serialBVH, parallelBVH);
+	checkLayout(randomBVH1, randomBVH2);
+}
+
+TEST_CASE("FlatBVH linear build", "[flatbvh]")
+{
+	std::mt19937 generator(5521);
+	Material material;
+	std::vector<Triangle> triangles(20000);
+	std::vector<Primitive*> primitives;
+	createRandomTriangles(triangles, primitives, &material, 0.5, generator);
+
+	BVHBuildInfo buildInfo;
+	buildInfo.useLinearBuild = true;
+
+	FlatBVH linearBVH;
+	linearBVH.build(primitives, buildInfo);
+
+	buildInfo.treeletRestructurePasses = 2;
+
+	FlatBVH restructuredBVH;
+	restructuredBVH.build(primitives, buildInfo);
+
+	REQUIRE(restructuredBVH.calculateSAHCost() < linearBVH.calculateSAHCost());
+
+	// every primitive is referenced exactly once
+	std::vector<uint64_t> primitiveIds = restructuredBVH.orderedPrimitiveIds;
+	std::sort(primitiveIds.begin(), primitiveIds.end());
+
+	for (uint64_t i = 0; i < primitiveIds.size(); ++i)
+		REQUIRE(primitiveIds[i] == i + 1);
+
+	checkIntersections({ &linearBVH }, primitives, 200, generator);
+	checkIntersections({ &restructuredBVH }, primitives, 200, generator);
+}
+
+TEST_CASE("FlatBVH triangle packets", "[flatbvh]")
+{
+	std::mt19937 generator(7193);
+	std::uniform_real_distribution<double> randomPosition(-10.0, 10.0);
+
+	Scene scene;
+	Material material;
+	std::vector<Triangle> triangles(3000);
+	std::vector<Sphere> spheres(300);
+	std::vector<Primitive*> primitives;
+	createRandomTriangles(triangles, primitives, &material, 1.0, generator);
+
+	for (uint64_t i = 0; i < spheres.size(); ++i)
+	{
+		spheres[i].id = triangles.size() + i + 1;
+		spheres[i].position = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+		spheres[i].radius = 0.3;
+		spheres[i].material = &material;
+		spheres[i].initialize(scene);
+
+		primitives.push_back(&spheres[i]);
+	}
+
+	BVHBuildInfo buildInfo;
+	buildInfo.maxLeafSize = 8;
+
+	// mixed leafs have the triangles packed first and the spheres after them
+	for (bool useQBVH : { false, true })
+	{
+		buildInfo.useQBVH = useQBVH;
+
+		FlatBVH bvh;
+		bvh.build(primitives, buildInfo);
+
+		REQUIRE(bvh.trianglePackets.size() > 0);
+
+		checkIntersections({ &bvh }, primitives, 500, generator);
+	}
+}
+
+TEST_CASE("FlatBVH instanced groups", "[flatbvh]")
+{
+	std::mt19937 generator(3481);
+	std::uniform_real_distribution<double> randomPosition(-10.0, 10.0);
+	std::uniform_real_distribution<double> randomOffset(-1.0, 1.0);
+	std::uniform_real_distribution<double> randomAngle(0.0, 360.0);
+
+	Scene scene;
+
+	PrimitiveGroup primitiveGroup;
+	primitiveGroup.id = 1;
+	primitiveGroup.invisible = true;
+
+	for (uint64_t i = 0; i < 500; ++i)
+	{
+		Triangle triangle = createRandomTriangle(i + 2, 0.2, 1.0, generator);
+		triangle.invisible = true;
+
+		scene.primitives.triangles.push_back(triangle);
+		primitiveGroup.primitiveIds.push_back(triangle.id);
+	}
+
+	scene.primitives.primitiveGroups.push_back(primitiveGroup);
+
+	for (uint64_t i = 0; i < 100; ++i)
+	{
+		Instance instance;
+		instance.id = 1000 + i;
+		instance.primitiveId = primitiveGroup.id;
+		instance.scale = Vector3(1.0, 1.0, 1.0) * (0.5 + randomOffset(generator) * 0.25);
+		instance.rotate = EulerAngle(randomAngle(generator), randomAngle(generator), randomAngle(generator));
+		instance.translate = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+
+		scene.primitives.instances.push_back(instance);
+	}
+
+	scene.initialize();
+
+	for (Instance& instance : scene.primitives.instances)
+	{
+		AABB groupBounds = scene.primitives.primitiveGroups[0].getAABB().transformed(instance.scale, instance.rotate, instance.translate);
+		REQUIRE(instance.getAABB().getSurfaceArea() <= groupBounds.getSurfaceArea() * (1.0 + 1.0e-9));
+	}
+
+	for (uint64_t i = 0; i < 1000; ++i)
+	{
+		Ray ray = createRandomRay(generator);
+
+		Intersection bvhIntersection;
+		Intersection linearIntersection;
+		std::vector<Intersection> intersections;
+
+		for (Primitive* primitive : scene.primitives.visible)
+			primitive->intersect(ray, bvhIntersection, intersections);
+
+		for (Primitive* primitive : scene.primitives.visibleOriginal)
+			primitive->intersect(ray, linearIntersection, intersections);
+
+		REQUIRE(bvhIntersection.wasFound == linearIntersection.wasFound);
+		REQUIRE(bvhIntersection.distance == Approx(linearIntersection.distance));
+
+		Ray occlusionRay = ray;
+		occlusionRay.maxDistance = randomPosition(generator) + 15.0;
+
+		// the range ends close to a hit are ambiguous between the float and double paths
+		if (!linearIntersection.wasFound || std::abs(linearIntersection.distance - occlusionRay.maxDistance) > 1.0e-6)
+			REQUIRE(scene.occluded(occlusionRay) == (linearIntersection.wasFound && linearIntersection.distance <= occlusionRay.maxDistance));
+
+		if (bvhIntersection.wasFound)
+		{
+			bvhIntersection.surfacePrimitive->computeSurfaceData(ray, bvhIntersection);
+			Vector3 position = ray.origin + bvhIntersection.distance * ray.direction;
+
+			REQUIRE(bvhIntersection.position.x == Approx(position.x));
+			REQUIRE(bvhIntersection.position.y == Approx(position.y));
+			REQUIRE(bvhIntersection.position.z == Approx(position.z));
+			REQUIRE(bvhIntersection.normal.length() == Approx(1.0));
+		}
+	}
+}
+
+TEST_CASE("FlatBVH unbounded primitives", "[flatbvh]")
+{
+	std::mt19937 generator(2719);
+	std::uniform_real_distribution<double> randomPosition(-10.0, 10.0);
+
+	Scene scene;
+
+	for (uint64_t i = 0; i < 200; ++i)
+	{
+		Sphere sphere;
+		sphere.id = i + 1;
+		sphere.position = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+		sphere.radius = 0.5;
+
+		scene.primitives.spheres.push_back(sphere);
+	}
+
+	Plane floorPlane;
+	floorPlane.id = 1000;
+	floorPlane.position = Vector3(0.0, -12.0, 0.0);
+	floorPlane.normal = Vector3(0.0, 1.0, 0.0);
+
+	Plane wallPlane;
+	wallPlane.id = 1001;
+	wallPlane.position = Vector3(0.0, 0.0, -12.0);
+	wallPlane.normal = Vector3(0.0, 0.0, 1.0);
+
+	scene.primitives.planes.push_back(floorPlane);
+	scene.primitives.planes.push_back(wallPlane);
+	scene.initialize();
+
+	// the planes are intersected next to the root BVH
+	REQUIRE(scene.primitives.visible.size() == 3);
+	REQUIRE(scene.rootBVH.bvh.orderedPrimitives.size() == 200);
+
+	for (uint64_t i = 0; i < 1000; ++i)
+	{
+		Ray ray;
+		ray.origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+		ray.direction = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)).normalized();
+		ray.precalculate();
+
+		Intersection sceneIntersection;
+		Intersection linearIntersection;
+		std::vector<Intersection> intersections;
+
+		scene.intersect(ray, sceneIntersection);
+
+		for (Primitive* primitive : scene.primitives.visibleOriginal)
+			primitive->intersect(ray, linearIntersection, intersections);
+
+		REQUIRE(sceneIntersection.wasFound == linearIntersection.wasFound);
+		REQUIRE(sceneIntersection.distance == linearIntersection.distance);
+		REQUIRE(sceneIntersection.primitive == linearIntersection.primitive);
+		REQUIRE(scene.occluded(ray) == linearIntersection.wasFound);
+	}
+}
+
+TEST_CASE("FlatBVH cache", "[flatbvh]")
+{
+	std::mt19937 generator(6113);
+
+	Scene scene;
+	std::vector<Triangle> triangles(5000);
+	std::vector<Primitive*> primitives;
+	createRandomTriangles(triangles, primitives, nullptr, 0.5, generator);
+
+	Settings& settings = App::getSettings();
+	Settings::General originalGeneral = settings.general;
+
+	boost::filesystem::path cacheDirectory = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+	settings.general.bvhCacheEnabled = true;
+	settings.general.bvhCacheDirectory = cacheDirectory.string();
+	settings.general.bvhCacheMaxSize = 1024;
+
+	BVHBuildInfo buildInfo;
+
+	FlatBVH builtBVH;
+	builtBVH.build(primitives, buildInfo);
+
+	REQUIRE(std::distance(boost::filesystem::directory_iterator(cacheDirectory), boost::filesystem::directory_iterator()) == 1);
+
+	FlatBVH cachedBVH;
+	cachedBVH.build(primitives, buildInfo);
+
+	REQUIRE(cachedBVH.orderedPrimitiveIds == builtBVH.orderedPrimitiveIds);
+	REQUIRE(cachedBVH.flatNodes.size() == builtBVH.flatNodes.size());
+	REQUIRE(cachedBVH.compactNodes.size() == builtBVH.compactNodes.size());
+
+	for (uint64_t i = 0; i < cachedBVH.flatNodes.size(); ++i)
+	{
+		REQUIRE(cachedBVH.flatNodes[i].rightOffset == builtBVH.flatNodes[i].rightOffset);
+		REQUIRE(cachedBVH.flatNodes[i].aabb.getMin() == builtBVH.flatNodes[i].aabb.getMin());
+		REQUIRE(cachedBVH.flatNodes[i].aabb.getMax() == builtBVH.flatNodes[i].aabb.getMax());
+	}
+
+	// moved geometry gets a new cache file
+	triangles[0].transform(Vector3(1.0, 1.0, 1.0), EulerAngle(), Vector3(1.0, 0.0, 0.0));
+
+	FlatBVH movedBVH;
+	movedBVH.build(primitives, buildInfo);
+
+	REQUIRE(std::distance(boost::filesystem::directory_iterator(cacheDirectory), boost::filesystem::directory_iterator()) == 2);
+
+	// spatial splits clip the triangles, so a vertex move inside the same bounds also gets a new cache file
+	Vector3 center = triangles[0].vertices[0];
+	triangles[0].vertices[0] = center;
+	triangles[0].vertices[1] = center + Vector3(0.5, 0.5, 0.5);
+	triangles[0].vertices[2] = center + Vector3(0.5, 0.0, 0.0);
+	triangles[0].initialize(scene);
+
+	buildInfo.useSpatialSplits = true;
+
+	FlatBVH spatialBVH;
+	spatialBVH.build(primitives, buildInfo);
+
+	REQUIRE(std::distance(boost::filesystem::directory_iterator(cacheDirectory), boost::filesystem::directory_iterator()) == 3);
+
+	triangles[0].vertices[2] = center + Vector3(0.0, 0.5, 0.0);
+	triangles[0].initialize(scene);
+
+	FlatBVH editedBVH;
+	editedBVH.build(primitives, buildInfo);
+
+	REQUIRE(std::distance(boost::filesystem::directory_iterator(cacheDirectory), boost::filesystem::directory_iterator()) == 4);
+
+	// only the file just saved fits in the cache
+	settings.general.bvhCacheMaxSize = 0;
+	triangles[0].transform(Vector3(1.0, 1.0, 1.0), EulerAngle(), Vector3(1.0, 0.0, 0.0));
+
+	FlatBVH trimmedBVH;
+	trimmedBVH.build(primitives, buildInfo);
+
+	REQUIRE(std::distance(boost::filesystem::directory_iterator(cacheDirectory), boost::filesystem::directory_iterator()) == 1);
+
+	FlatBVH trimmedCachedBVH;
+	trimmedCachedBVH.build(primitives, buildInfo);
+
+	REQUIRE(trimmedCachedBVH.orderedPrimitiveIds == trimmedBVH.orderedPrimitiveIds);
+
+	boost::filesystem::remove_all(cacheDirectory);
+	settings.general = originalGeneral;
+}
+
+#endif
@@ -0,0 +1,142 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Math/Vector3.h"
+#include "Math/EulerAngle.h"
+
+using namespace Raycer;
+
+TEST_CASE("Instance motion blur", "[instance]")
+{
+	std::mt19937 generator(6143);
+	std::uniform_real_distribution<double> randomPosition(-10.0, 10.0);
+	std::uniform_real_distribution<double> randomOffset(-1.0, 1.0);
+	std::uniform_real_distribution<double> randomAngle(0.0, 360.0);
+	std::uniform_real_distribution<double> randomTime(0.0, 1.0);
+
+	// both scenes get the same primitives
+	auto createScene = [&](Scene& scene)
+	{
+		std::mt19937 sceneGenerator(8219);
+
+		PrimitiveGroup primitiveGroup;
+		primitiveGroup.id = 1;
+		primitiveGroup.invisible = true;
+
+		for (uint64_t i = 0; i < 100; ++i)
+		{
+			Vector3 center = Vector3(randomPosition(sceneGenerator), randomPosition(sceneGenerator), randomPosition(sceneGenerator)) * 0.2;
+
+			Triangle triangle;
+			triangle.id = i + 2;
+			triangle.invisible = true;
+			triangle.vertices[0] = center + Vector3(randomOffset(sceneGenerator), randomOffset(sceneGenerator), randomOffset(sceneGenerator));
+			triangle.vertices[1] = center + Vector3(randomOffset(sceneGenerator), randomOffset(sceneGenerator), randomOffset(sceneGenerator));
+			triangle.vertices[2] = center + Vector3(randomOffset(sceneGenerator), randomOffset(sceneGenerator), randomOffset(sceneGenerator));
+
+			scene.primitives.triangles.push_back(triangle);
+			primitiveGroup.primitiveIds.push_back(triangle.id);
+		}
+
+		scene.primitives.primitiveGroups.push_back(primitiveGroup);
+
+		for (uint64_t i = 0; i < 50; ++i)
+		{
+			Instance instance;
+			instance.id = 1000 + i;
+			instance.primitiveId = primitiveGroup.id;
+			instance.isTimeVariant = true;
+			instance.scale = Vector3(1.0, 1.0, 1.0) * (0.5 + randomOffset(sceneGenerator) * 0.25);
+			instance.rotate = EulerAngle(randomAngle(sceneGenerator), randomAngle(sceneGenerator), randomAngle(sceneGenerator));
+			instance.translate = Vector3(randomPosition(sceneGenerator), randomPosition(sceneGenerator), randomPosition(sceneGenerator));
+			instance.scaleInTime = Vector3(randomOffset(sceneGenerator), randomOffset(sceneGenerator), randomOffset(sceneGenerator)) * 0.2;
+			instance.translateInTime = Vector3(randomOffset(sceneGenerator), randomOffset(sceneGenerator), randomOffset(sceneGenerator)) * 5.0;
+
+			// every other one only moves
+			if (i % 2 == 0)
+				instance.rotateInTime = EulerAngle(randomAngle(sceneGenerator), randomAngle(sceneGenerator), randomAngle(sceneGenerator)) * 0.5;
+
+			scene.primitives.instances.push_back(instance);
+		}
+	};
+
+	Scene scene;
+	createScene(scene);
+	scene.initialize();
+
+	// the bounds have to cover the whole motion for the root BVH to agree with the linear search
+	for (uint64_t i = 0; i < 2000; ++i)
+	{
+		Ray ray;
+		ray.origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 1.5;
+		ray.direction = (Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) - ray.origin).normalized();
+		ray.time = randomTime(generator);
+		ray.precalculate();
+
+		Intersection sceneIntersection;
+		Intersection linearIntersection;
+		std::vector<Intersection> intersections;
+
+		scene.intersect(ray, sceneIntersection);
+
+		for (Primitive* primitive : scene.primitives.visibleOriginal)
+			primitive->intersect(ray, linearIntersection, intersections);
+
+		REQUIRE(sceneIntersection.wasFound == linearIntersection.wasFound);
+		REQUIRE(sceneIntersection.distance == Approx(linearIntersection.distance));
+		REQUIRE(scene.occluded(ray) == linearIntersection.wasFound);
+
+		if (sceneIntersection.wasFound)
+		{
+			Vector3 position = ray.origin + sceneIntersection.distance * ray.direction;
+
+			REQUIRE(sceneIntersection.position.x == Approx(position.x));
+			REQUIRE(sceneIntersection.position.y == Approx(position.y));
+			REQUIRE(sceneIntersection.position.z == Approx(position.z));
+		}
+	}
+
+	// at the rotation keyframes the motion matches static instances transformed to that time
+	double time = 10.0 / 31.0;
+	Scene staticScene;
+	createScene(staticScene);
+
+	for (Instance& instance : staticScene.primitives.instances)
+	{
+		instance.isTimeVariant = false;
+		instance.scale += time * instance.scaleInTime;
+		instance.rotate += time * instance.rotateInTime;
+		instance.translate += time * instance.translateInTime;
+	}
+
+	staticScene.initialize();
+
+	for (uint64_t i = 0; i < 1000; ++i)
+	{
+		Ray ray;
+		ray.origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 1.5;
+		ray.direction = (Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) - ray.origin).normalized();
+		ray.time = time;
+		ray.precalculate();
+
+		Intersection motionIntersection;
+		Intersection staticIntersection;
+
+		scene.intersect(ray, motionIntersection);
+		staticScene.intersect(ray, staticIntersection);
+
+		REQUIRE(motionIntersection.wasFound == staticIntersection.wasFound);
+		REQUIRE(motionIntersection.distance == Approx(staticIntersection.distance));
+	}
+}
+
+#endif
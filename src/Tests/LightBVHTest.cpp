@@ -0,0 +1,229 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/LightBVH.h"
+#include "Raytracing/Tracers/Raytracer.h"
+#include "Math/Color.h"
+
+using namespace Raycer;
+
+namespace
+{
+	class TestRaytracer : public Raytracer
+	{
+	public:
+
+		using Raytracer::trace;
+	};
+
+	void createRandomLights(std::vector<PointLight>& pointLights, std::vector<SpotLight>& spotLights, uint64_t count, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<double> random(0.0, 1.0);
+
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			SpotLight light;
+			light.position = Vector3(random(generator) * 100.0 - 50.0, random(generator) * 10.0, random(generator) * 100.0 - 50.0);
+			light.color = Color(random(generator), random(generator), random(generator));
+			light.intensity = 0.5 + random(generator);
+			light.maxDistance = 2.0 + random(generator) * 10.0;
+			light.attenuation = 0.5 + random(generator) * 2.0;
+			light.enableAreaLight = (i % 5 == 0);
+			light.areaLightSampleCountSqrt = 2;
+			light.areaLightRadius = random(generator);
+			light.direction = Vector3(random(generator) - 0.5, -1.0, random(generator) - 0.5).normalized();
+
+			if (i % 3 == 0)
+				spotLights.push_back(light);
+			else
+				pointLights.push_back(light);
+		}
+	}
+
+	// unshadowed contribution of a light without the reflectance, same as in the shading
+	double getContribution(const PointLight& light, bool isSpotLight, const Vector3& position, const Vector3& normal)
+	{
+		Vector3 directionToLight = light.position - position;
+		double distanceToLight = directionToLight.length();
+		directionToLight.normalize();
+
+		double cosine = directionToLight.dot(normal);
+
+		if (cosine <= 0.0 || distanceToLight >= light.maxDistance)
+			return 0.0;
+
+		double contribution = light.color.getLuminance() * light.intensity * cosine * (1.0 - pow(distanceToLight / light.maxDistance, light.attenuation));
+
+		if (isSpotLight)
+		{
+			const SpotLight& spotLight = static_cast<const SpotLight&>(light);
+			double sideAttenuation = spotLight.direction.dot(-directionToLight);
+
+			if (sideAttenuation <= 0.0)
+				return 0.0;
+
+			sideAttenuation = std::min(1.0, (1.0 - sideAttenuation) / (spotLight.angle / 180.0));
+			contribution *= 1.0 - pow(sideAttenuation, spotLight.sideAttenuation);
+		}
+
+		return contribution;
+	}
+}
+
+TEST_CASE("LightBVH functionality", "[lightbvh]")
+{
+	std::mt19937 generator(8812);
+	std::uniform_real_distribution<double> random(0.0, 1.0);
+
+	std::vector<PointLight> pointLights;
+	std::vector<SpotLight> spotLights;
+	createRandomLights(pointLights, spotLights, 5000, generator);
+
+	LightBVH lightBVH;
+	lightBVH.build(pointLights, spotLights);
+
+	REQUIRE(lightBVH.getLightCount() == 5000);
+
+	std::vector<LightBVHLight> lightsInRange;
+
+	// culling keeps exactly the lights that reach the point
+	for (uint64_t i = 0; i < 200; ++i)
+	{
+		Vector3 position(random(generator) * 120.0 - 60.0, random(generator) * 12.0 - 1.0, random(generator) * 120.0 - 60.0);
+		lightBVH.getLightsInRange(position, lightsInRange);
+
+		std::vector<const PointLight*> culled;
+
+		for (const LightBVHLight& light : lightsInRange)
+			culled.push_back(light.light);
+
+		std::sort(culled.begin(), culled.end());
+		REQUIRE(std::unique(culled.begin(), culled.end()) == culled.end());
+
+		uint64_t expectedCount = 0;
+
+		auto checkLight = [&](const PointLight& light)
+		{
+			double reach = light.maxDistance + (light.enableAreaLight ? light.areaLightRadius : 0.0);
+
+			if ((light.position - position).length() < reach)
+			{
+				expectedCount++;
+				REQUIRE(std::binary_search(culled.begin(), culled.end(), &light));
+			}
+		};
+
+		for (const PointLight& light : pointLights)
+			checkLight(light);
+
+		for (const SpotLight& light : spotLights)
+			checkLight(light);
+
+		REQUIRE(lightsInRange.size() == expectedCount);
+	}
+
+	// dividing by the sampling probability gives the sum over all the lights
+	for (uint64_t i = 0; i < 20; ++i)
+	{
+		Vector3 position(random(generator) * 80.0 - 40.0, 0.0, random(generator) * 80.0 - 40.0);
+		Vector3 normal = Vector3(random(generator) - 0.5, 1.0, random(generator) - 0.5).normalized();
+
+		double expected = 0.0;
+
+		for (const PointLight& light : pointLights)
+			expected += getContribution(light, false, position, normal);
+
+		for (const SpotLight& light : spotLights)
+			expected += getContribution(light, true, position, normal);
+
+		double estimate = 0.0;
+		double minProbability = 1.0;
+		double maxProbability = 0.0;
+		uint64_t sampleCount = 100000;
+
+		for (uint64_t j = 0; j < sampleCount; ++j)
+		{
+			LightBVHSample lightSample;
+
+			if (!lightBVH.sample(position, normal, generator, lightSample))
+				continue;
+
+			minProbability = std::min(minProbability, lightSample.probability);
+			maxProbability = std::max(maxProbability, lightSample.probability);
+			estimate += getContribution(*lightSample.light, lightSample.isSpotLight, position, normal) / lightSample.probability;
+		}
+
+		estimate /= double(sampleCount);
+
+		REQUIRE(minProbability > 0.0);
+		REQUIRE(maxProbability <= 1.0);
+		REQUIRE(estimate == Approx(expected).epsilon(0.03));
+	}
+}
+
+TEST_CASE("LightBVH raytracer shading", "[lightbvh]")
+{
+	std::mt19937 generator(4411);
+	std::uniform_real_distribution<double> random(0.0, 1.0);
+
+	Scene scene;
+	scene.lights.ambientLight.intensity = 0.0;
+	createRandomLights(scene.lights.pointLights, scene.lights.spotLights, 500, generator);
+
+	Material floorMaterial;
+	floorMaterial.id = 1;
+	floorMaterial.diffuseReflectance = Color(0.8, 0.8, 0.8);
+
+	Plane floor;
+	floor.id = 1;
+	floor.materialId = floorMaterial.id;
+	floor.position = Vector3(0.0, 0.0, 0.0);
+	floor.normal = Vector3(0.0, 1.0, 0.0);
+
+	scene.materials.push_back(floorMaterial);
+	scene.primitives.planes.push_back(floor);
+	scene.initialize();
+
+	TestRaytracer tracer;
+	std::atomic<bool> interrupted(false);
+
+	for (uint64_t i = 0; i < 20; ++i)
+	{
+		Ray ray;
+		ray.origin = Vector3(random(generator) * 80.0 - 40.0, 20.0, random(generator) * 80.0 - 40.0);
+		ray.direction = Vector3(random(generator) - 0.5, -1.0, random(generator) - 0.5).normalized();
+		ray.precalculate();
+
+		scene.lights.enableLightCulling = false;
+		scene.lights.lightSampleCount = 0;
+		Color expected = tracer.trace(scene, ray, generator, interrupted);
+
+		scene.lights.enableLightCulling = true;
+		Color culled = tracer.trace(scene, ray, generator, interrupted);
+
+		REQUIRE(culled.r == Approx(expected.r));
+		REQUIRE(culled.g == Approx(expected.g));
+		REQUIRE(culled.b == Approx(expected.b));
+
+		scene.lights.lightSampleCount = 4;
+		Color sampled;
+		uint64_t sampleCount = 5000;
+
+		for (uint64_t j = 0; j < sampleCount; ++j)
+			sampled += tracer.trace(scene, ray, generator, interrupted);
+
+		sampled /= double(sampleCount);
+
+		REQUIRE(sampled.getLuminance() == Approx(expected.getLuminance()).epsilon(0.03));
+	}
+}
+
+#endif
@@ -10,6 +10,7 @@
 #include "Math/Matrix4x4.h"
 #include "Math/Vector3.h"
 #include "Math/EulerAngle.h"
+#include "Math/Quaternion.h"
 
 using namespace Raycer;
 
@@ -156,6 +157,10 @@ TEST_CASE("Matrix4x4 functionality", "[matrix4x4]")
 
 	REQUIRE(transformationInv == transformationInv2);
 
+	Quaternion quaternion = Quaternion(Vector3(1.0, 0.0, 0.0), rotate.pitch) * Quaternion(Vector3(0.0, 1.0, 0.0), rotate.yaw) * Quaternion(Vector3(0.0, 0.0, 1.0), rotate.roll);
+
+	REQUIRE(quaternion.toMatrix4x4() == Matrix4x4::rotateXYZ(rotate));
+
 	Vector3 from(0.0, 22.0, 0.0);
 	Vector3 to(0.0, 0.0, 1.0);
 	rotation = Matrix4x4::rotate(from.normalized(), to.normalized());
@@ -8,6 +8,10 @@
 #include "catch/catch.hpp"
 
 #include "Utils/ModelLoader.h"
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Utils/StringUtils.h"
 
 using namespace Raycer;
 
@@ -47,4 +51,88 @@ TEST_CASE("ModelLoader functionality", "[modelloader]")
 	REQUIRE(result.triangles.size() == 12);
 }
 
+TEST_CASE("ModelLoader triangle meshes", "[modelloader]")
+{
+	std::vector<std::string> modelFilePaths = { "data/meshes/cube1.obj", "data/meshes/cube2.obj", "data/meshes/cube3.obj", "data/meshes/cube4.obj", "data/meshes/cube5.obj", "data/meshes/cube1.ply", "data/meshes/cube2.ply", "data/meshes/cube3.ply" };
+
+	std::mt19937 generator(2281);
+	std::uniform_real_distribution<double> randomPosition(-3.0, 3.0);
+
+	Scene scene;
+	Material material;
+
+	for (const std::string& modelFilePath : modelFilePaths)
+	{
+		bool isObj = StringUtils::endsWith(modelFilePath, ".obj");
+
+		ModelLoaderInfo info;
+		info.modelFilePath = modelFilePath;
+		info.ignoreMaterials = true;
+		ModelLoaderResult triangleResult = isObj ? ModelLoader::readObjFile(info) : ModelLoader::readPlyFile(info);
+
+		info.enableTriangleMeshes = true;
+		ModelLoaderResult meshResult = isObj ? ModelLoader::readObjFile(info) : ModelLoader::readPlyFile(info);
+
+		REQUIRE(meshResult.triangles.size() == 0);
+		REQUIRE(meshResult.triangleMeshes.size() > 0);
+
+		uint64_t triangleCount = 0;
+		uint64_t vertexCount = 0;
+
+		for (TriangleMesh& triangleMesh : meshResult.triangleMeshes)
+		{
+			triangleMesh.material = &material;
+			triangleMesh.initialize(scene);
+			triangleCount += triangleMesh.getTriangleCount();
+			vertexCount += triangleMesh.getVertexCount();
+		}
+
+		REQUIRE(triangleCount == 12);
+		REQUIRE(vertexCount < 36);
+
+		for (Triangle& triangle : triangleResult.triangles)
+		{
+			triangle.material = &material;
+			triangle.initialize(scene);
+		}
+
+		for (uint64_t i = 0; i < 100; ++i)
+		{
+			Ray ray;
+			ray.origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 2.0;
+			ray.direction = (Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 0.2 - ray.origin).normalized();
+			ray.precalculate();
+
+			Intersection meshIntersection;
+			Intersection triangleIntersection;
+			std::vector<Intersection> intersections;
+
+			for (TriangleMesh& triangleMesh : meshResult.triangleMeshes)
+				triangleMesh.intersect(ray, meshIntersection, intersections);
+
+			for (Triangle& triangle : triangleResult.triangles)
+				triangle.intersect(ray, triangleIntersection, intersections);
+
+			REQUIRE(meshIntersection.wasFound == triangleIntersection.wasFound);
+
+			bool meshOccluded = false;
+
+			for (TriangleMesh& triangleMesh : meshResult.triangleMeshes)
+				meshOccluded = meshOccluded || triangleMesh.occluded(ray);
+
+			REQUIRE(meshOccluded == meshIntersection.wasFound);
+
+			if (meshIntersection.wasFound)
+			{
+				meshIntersection.surfacePrimitive->computeSurfaceData(ray, meshIntersection);
+				triangleIntersection.surfacePrimitive->computeSurfaceData(ray, triangleIntersection);
+
+				REQUIRE(meshIntersection.position.x == Approx(triangleIntersection.position.x));
+				REQUIRE(meshIntersection.distance == Approx(triangleIntersection.distance));
+				REQUIRE(meshIntersection.normal.dot(triangleIntersection.normal) == Approx(1.0));
+			}
+		}
+	}
+}
+
 #endif
@@ -0,0 +1,254 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Raytracing/Tracers/PathTracer.h"
+#include "Math/Color.h"
+
+using namespace Raycer;
+
+namespace
+{
+	class TestPathTracer : public PathTracer
+	{
+	public:
+
+		using PathTracer::trace;
+	};
+
+	// diffuse floor at y = 0 with the given emitters, lights and lighting set up by the caller
+	Scene createFloorScene()
+	{
+		Scene scene;
+		scene.general.tracerType = TracerType::PATH;
+		scene.general.maxPathLength = 2;
+
+		Material floorMaterial;
+		floorMaterial.id = 1;
+		floorMaterial.diffuseReflectance = Color(0.5, 0.5, 0.5);
+
+		Material lightMaterial;
+		lightMaterial.id = 2;
+		lightMaterial.emittance = Color(10.0, 10.0, 10.0);
+		lightMaterial.isEmissive = true;
+
+		scene.materials.push_back(floorMaterial);
+		scene.materials.push_back(lightMaterial);
+
+		Plane floor;
+		floor.id = 1;
+		floor.materialId = floorMaterial.id;
+		floor.position = Vector3(0.0, 0.0, 0.0);
+		floor.normal = Vector3(0.0, 1.0, 0.0);
+
+		scene.primitives.planes.push_back(floor);
+
+		return scene;
+	}
+
+	// camera ray looking at the origin of the floor
+	double traceFloor(Scene& scene, uint64_t sampleCount)
+	{
+		scene.initialize();
+
+		TestPathTracer tracer;
+		std::mt19937 generator(1234);
+		std::atomic<bool> interrupted(false);
+
+		Ray ray;
+		ray.origin = Vector3(0.5, 0.5, 0.0);
+		ray.direction = -ray.origin.normalized();
+		ray.precalculate();
+
+		Color color;
+
+		for (uint64_t i = 0; i < sampleCount; ++i)
+			color += tracer.trace(scene, ray, generator, interrupted);
+
+		color /= double(sampleCount);
+
+		REQUIRE(color.r == Approx(color.g));
+		REQUIRE(color.r == Approx(color.b));
+
+		return color.r;
+	}
+}
+
+TEST_CASE("PathTracer direct lighting", "[pathtracer]")
+{
+	SECTION("emissive sphere")
+	{
+		Scene scene = createFloorScene();
+
+		Sphere sphere;
+		sphere.id = 2;
+		sphere.materialId = 2;
+		sphere.position = Vector3(0.0, 1.0, 0.0);
+		sphere.radius = 0.1;
+
+		scene.primitives.spheres.push_back(sphere);
+
+		// irradiance of a sphere is pi * L * (r / h)^2
+		REQUIRE(traceFloor(scene, 20000) == Approx(0.5 * 10.0 * 0.01).epsilon(0.03));
+		REQUIRE(scene.emissivePrimitives.primitives.size() == 1);
+	}
+
+	SECTION("emissive triangles")
+	{
+		Scene scene = createFloorScene();
+
+		// a large triangle (with an inscribed disc of radius 2000) covers nearly the whole hemisphere and a small one is inside it
+		for (uint64_t i = 0; i < 2; ++i)
+		{
+			double size = (i == 0) ? 2000.0 : 0.1;
+			double height = (i == 0) ? 1.0 : 0.25;
+
+			Triangle triangle;
+			triangle.id = 2 + i;
+			triangle.materialId = 2;
+			triangle.vertices[0] = Vector3(-size * sqrt(3.0), height, -size);
+			triangle.vertices[1] = Vector3(size * sqrt(3.0), height, -size);
+			triangle.vertices[2] = Vector3(0.0, height, 2.0 * size);
+
+			scene.primitives.triangles.push_back(triangle);
+		}
+
+		REQUIRE(traceFloor(scene, 20000) == Approx(0.5 * 10.0).epsilon(0.03));
+		REQUIRE(scene.emissivePrimitives.primitives.size() == 2);
+	}
+
+	SECTION("emissive triangle mesh and group")
+	{
+		Scene scene = createFloorScene();
+
+		// the same large triangle as a mesh, split in two of different areas
+		double size = 2000.0;
+		Vector3 vertex0(-size * sqrt(3.0), 1.0, -size);
+		Vector3 vertex1(size * sqrt(3.0), 1.0, -size);
+		Vector3 vertex2(0.0, 1.0, 2.0 * size);
+
+		TriangleMesh triangleMesh;
+		triangleMesh.id = 2;
+		triangleMesh.materialId = 2;
+		Vector3 splitVertex = vertex0 + (vertex1 - vertex0) * 0.25;
+
+		triangleMesh.addVertex(vertex0);
+		triangleMesh.addVertex(splitVertex);
+		triangleMesh.addVertex(vertex1);
+		triangleMesh.addVertex(vertex2);
+		triangleMesh.addTriangle(0, 1, 3);
+		triangleMesh.addTriangle(1, 2, 3);
+
+		scene.primitives.triangleMeshes.push_back(triangleMesh);
+
+		// the small triangle inside a group
+		Triangle triangle;
+		triangle.id = 3;
+		triangle.materialId = 2;
+		triangle.invisible = true;
+		triangle.vertices[0] = Vector3(-0.1 * sqrt(3.0), 0.25, -0.1);
+		triangle.vertices[1] = Vector3(0.1 * sqrt(3.0), 0.25, -0.1);
+		triangle.vertices[2] = Vector3(0.0, 0.25, 0.2);
+
+		PrimitiveGroup primitiveGroup;
+		primitiveGroup.id = 4;
+		primitiveGroup.materialId = 1;
+		primitiveGroup.primitiveIds.push_back(triangle.id);
+
+		scene.primitives.triangles.push_back(triangle);
+		scene.primitives.primitiveGroups.push_back(primitiveGroup);
+
+		REQUIRE(traceFloor(scene, 20000) == Approx(0.5 * 10.0).epsilon(0.03));
+		REQUIRE(scene.emissivePrimitives.primitives.size() == 2);
+		REQUIRE(scene.primitives.triangleMeshes[0].getArea() == Approx(3.0 * sqrt(3.0) * size * size));
+
+		// the mesh triangles are picked in proportion to their area
+		std::mt19937 generator(4321);
+		uint64_t firstTriangleCount = 0;
+
+		for (uint64_t i = 0; i < 10000; ++i)
+		{
+			Intersection intersection;
+			scene.primitives.triangleMeshes[0].sampleSurface(generator, intersection);
+
+			if ((splitVertex - vertex2).cross(intersection.position - vertex2).y * (splitVertex - vertex2).cross(vertex0 - vertex2).y > 0.0)
+				firstTriangleCount++;
+		}
+
+		REQUIRE(double(firstTriangleCount) / 10000.0 == Approx(0.25).epsilon(0.05));
+	}
+
+	SECTION("point and directional lights")
+	{
+		Scene scene = createFloorScene();
+
+		PointLight pointLight;
+		pointLight.position = Vector3(0.0, 2.0, 0.0);
+		pointLight.intensity = 2.0;
+		pointLight.maxDistance = 4.0;
+		pointLight.attenuation = 1.0;
+
+		DirectionalLight directionalLight;
+		directionalLight.direction = Vector3(1.0, -1.0, 0.0).normalized();
+		directionalLight.intensity = 1.0;
+
+		scene.lights.pointLights.push_back(pointLight);
+		scene.lights.directionalLights.push_back(directionalLight);
+
+		// no emitters, so the bounces add nothing, the diffuse brdf is reflectance / pi
+		REQUIRE(traceFloor(scene, 10) == Approx(0.5 / M_PI * (2.0 * 0.5 + 1.0 / sqrt(2.0))));
+	}
+}
+
+TEST_CASE("PathTracer russian roulette", "[pathtracer]")
+{
+	// light bounces between the floor and a ceiling, so most of the radiance comes from the long paths
+	auto createScene = [](uint64_t russianRouletteStartLength)
+	{
+		Scene scene = createFloorScene();
+		scene.general.maxPathLength = 16;
+		scene.general.russianRouletteStartLength = russianRouletteStartLength;
+		scene.materials[0].diffuseReflectance = Color(0.8, 0.8, 0.8);
+
+		Plane ceiling;
+		ceiling.id = 2;
+		ceiling.materialId = 1;
+		ceiling.position = Vector3(0.0, 1.0, 0.0);
+		ceiling.normal = Vector3(0.0, -1.0, 0.0);
+
+		PointLight pointLight;
+		pointLight.position = Vector3(0.0, 0.5, 0.0);
+		pointLight.intensity = 1.0;
+		pointLight.maxDistance = 4.0;
+		pointLight.attenuation = 1.0;
+
+		scene.primitives.planes.push_back(ceiling);
+		scene.lights.pointLights.push_back(pointLight);
+
+		return scene;
+	};
+
+	Scene shortScene = createScene(16);
+	shortScene.general.maxPathLength = 3;
+
+	Scene fullScene = createScene(16);
+	Scene rouletteScene = createScene(1);
+
+	double shortColor = traceFloor(shortScene, 20000);
+	double fullColor = traceFloor(fullScene, 20000);
+	double rouletteColor = traceFloor(rouletteScene, 20000);
+
+	// the terminated paths are compensated by weighting up the surviving ones
+	REQUIRE(fullColor > 1.2 * shortColor);
+	REQUIRE(rouletteColor == Approx(fullColor).epsilon(0.02));
+}
+
+#endif
@@ -0,0 +1,98 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Utils/ScratchBuffer.h"
+
+using namespace Raycer;
+
+TEST_CASE("ScratchBuffer functionality", "[scratchbuffer]")
+{
+	{
+		ScratchBuffer<int> outerBuffer;
+		outerBuffer.get().push_back(1);
+
+		{
+			ScratchBuffer<int> innerBuffer;
+
+			REQUIRE(&innerBuffer.get() != &outerBuffer.get());
+			REQUIRE(innerBuffer.get().empty());
+
+			innerBuffer.get().push_back(2);
+		}
+
+		REQUIRE(outerBuffer.get().size() == 1);
+	}
+
+	uint64_t growthCount = ScratchBufferStats::getGrowthCount();
+
+	// the capacity is kept for the next user
+	{
+		ScratchBuffer<int> buffer;
+		REQUIRE(buffer.get().empty());
+		buffer.get().push_back(3);
+	}
+
+	REQUIRE(ScratchBufferStats::getGrowthCount() == growthCount);
+}
+
+TEST_CASE("ScratchBuffer intersection path", "[scratchbuffer]")
+{
+	std::mt19937 generator(5521);
+	std::uniform_real_distribution<double> random(-1.0, 1.0);
+
+	// instances, blobs and CSG
+	for (uint64_t sceneNumber : { 1, 13 })
+	{
+		Scene scene = Scene::createTestScene(sceneNumber);
+		scene.initialize();
+
+		AABB sceneAABB = scene.rootBVH.bvh.getAABB();
+		Vector3 center = sceneAABB.getCenter();
+		double size = sceneAABB.getExtent().length();
+
+		std::vector<Ray> rays(2000);
+
+		for (Ray& ray : rays)
+		{
+			ray.origin = center + Vector3(random(generator), random(generator), random(generator)) * size;
+			ray.direction = (center + Vector3(random(generator), random(generator), random(generator)) * size * 0.25 - ray.origin).normalized();
+			ray.precalculate();
+		}
+
+		auto traceRays = [&]()
+		{
+			uint64_t hitCount = 0;
+
+			for (const Ray& ray : rays)
+			{
+				Intersection intersection;
+
+				if (scene.intersect(ray, intersection))
+					hitCount++;
+
+				scene.occluded(ray);
+			}
+
+			return hitCount;
+		};
+
+		// the first pass warms up the buffers, after that no scratch buffer is created or grown
+		REQUIRE(traceRays() > 0);
+
+		uint64_t growthCount = ScratchBufferStats::getGrowthCount();
+		traceRays();
+
+		REQUIRE(ScratchBufferStats::getGrowthCount() == growthCount);
+	}
+}
+
+#endif
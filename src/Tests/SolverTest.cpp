@@ -24,6 +24,43 @@ TEST_CASE("Solver functionality", "[solver]")
 	double result2 = Solver::findRoot(f1, -2.0, 2.0, 32);
 
 	REQUIRE(MathUtils::almostSame(result2, 0.86547378345385151));
+
+	// (x - 1)(x + 2)(x - 3)
+	CubicResult result3 = Solver::findCubicRoots(1.0, -2.0, -5.0, 6.0);
+
+	REQUIRE(result3.rootCount == 3);
+	REQUIRE(result3.roots[0] == Approx(-2.0));
+	REQUIRE(result3.roots[1] == Approx(1.0));
+	REQUIRE(result3.roots[2] == Approx(3.0));
+
+	// (x - 1)(x - 2)(x - 3)(x - 4)
+	QuarticResult result4 = Solver::findQuarticRoots(2.0, -20.0, 70.0, -100.0, 48.0);
+
+	REQUIRE(result4.rootCount == 4);
+	REQUIRE(result4.roots[0] == Approx(1.0));
+	REQUIRE(result4.roots[1] == Approx(2.0));
+	REQUIRE(result4.roots[2] == Approx(3.0));
+	REQUIRE(result4.roots[3] == Approx(4.0));
+
+	// (x^2 - 1)(x^2 - 4)
+	QuarticResult result5 = Solver::findQuarticRoots(1.0, 0.0, -5.0, 0.0, 4.0);
+
+	REQUIRE(result5.rootCount == 4);
+	REQUIRE(result5.roots[0] == Approx(-2.0));
+	REQUIRE(result5.roots[1] == Approx(-1.0));
+	REQUIRE(result5.roots[2] == Approx(1.0));
+	REQUIRE(result5.roots[3] == Approx(2.0));
+
+	// (x^2 + 1)(x - 0.5)(x + 3)
+	QuarticResult result6 = Solver::findQuarticRoots(1.0, 2.5, -0.5, 2.5, -1.5);
+
+	REQUIRE(result6.rootCount == 2);
+	REQUIRE(result6.roots[0] == Approx(-3.0));
+	REQUIRE(result6.roots[1] == Approx(0.5));
+
+	QuarticResult result7 = Solver::findQuarticRoots(1.0, 0.0, 0.0, 0.0, 1.0);
+
+	REQUIRE(result7.rootCount == 0);
 }
 
 #endif
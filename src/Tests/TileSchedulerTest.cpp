@@ -0,0 +1,178 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Tracers/TileScheduler.h"
+
+using namespace Raycer;
+
+TEST_CASE("TileScheduler functionality", "[tilescheduler]")
+{
+	REQUIRE(TileScheduler::getMortonIndex(0, 0) == 0);
+	REQUIRE(TileScheduler::getMortonIndex(1, 0) == 1);
+	REQUIRE(TileScheduler::getMortonIndex(0, 1) == 2);
+	REQUIRE(TileScheduler::getMortonIndex(3, 3) == 15);
+	REQUIRE(TileScheduler::getMortonIndex(4, 0) == 16);
+
+	// consecutive hilbert indices are neighbours
+	for (uint64_t size : { 2, 4, 16, 64 })
+	{
+		std::vector<std::pair<uint64_t, uint64_t>> curve(size * size);
+
+		for (uint64_t y = 0; y < size; ++y)
+		{
+			for (uint64_t x = 0; x < size; ++x)
+			{
+				uint64_t index = TileScheduler::getHilbertIndex(size, x, y);
+				REQUIRE(index < size * size);
+				curve[index] = std::make_pair(x + 1, y + 1);
+			}
+		}
+
+		for (uint64_t i = 1; i < curve.size(); ++i)
+		{
+			REQUIRE(curve[i].first != 0);
+
+			int64_t dx = int64_t(curve[i].first) - int64_t(curve[i - 1].first);
+			int64_t dy = int64_t(curve[i].second) - int64_t(curve[i - 1].second);
+
+			REQUIRE(std::abs(dx) + std::abs(dy) == 1);
+		}
+	}
+
+	// every pixel of the range is covered by exactly one tile regardless of which threads fetch the tiles
+	struct Job { uint64_t width, height, start, count, tileSize, threadCount; };
+
+	std::vector<Job> jobs = {
+		{ 100, 80, 0, 8000, 16, 4 },
+		{ 100, 80, 0, 8000, 1000, 3 },
+		{ 97, 61, 1234, 2500, 8, 5 },
+		{ 97, 61, 5000, 917, 32, 2 },
+		{ 10, 10, 55, 1, 4, 8 },
+		{ 64, 64, 64, 128, 16, 1 }
+	};
+
+	for (const Job& job : jobs)
+	{
+		for (TileOrder order : { TileOrder::LINEAR, TileOrder::MORTON, TileOrder::HILBERT, TileOrder::CENTER_OUT })
+		{
+			TileScheduler scheduler;
+			scheduler.initialize(job.width, job.height, job.start, job.count, job.tileSize, order, job.threadCount);
+
+			std::vector<uint64_t> coverage(job.width * job.height, 0);
+			uint64_t tileCount = 0;
+			Tile tile;
+
+			// the first thread takes a few tiles, then one thread is left alone to steal the rest
+			for (uint64_t i = 0; i < 3; ++i)
+			{
+				for (uint64_t threadIndex = 0; threadIndex < job.threadCount; ++threadIndex)
+				{
+					if (!scheduler.getNextTile(threadIndex, tile))
+						continue;
+
+					for (uint64_t y = tile.y; y < tile.y + tile.height; ++y)
+						for (uint64_t x = tile.x; x < tile.x + tile.width; ++x)
+							coverage[y * job.width + x]++;
+
+					tileCount++;
+				}
+			}
+
+			while (scheduler.getNextTile(job.threadCount - 1, tile))
+			{
+				REQUIRE(tile.x + tile.width <= job.width);
+				REQUIRE(tile.y + tile.height <= job.height);
+
+				for (uint64_t y = tile.y; y < tile.y + tile.height; ++y)
+					for (uint64_t x = tile.x; x < tile.x + tile.width; ++x)
+						coverage[y * job.width + x]++;
+
+				tileCount++;
+			}
+
+			REQUIRE(tileCount == scheduler.getTiles().size());
+
+			for (uint64_t i = job.start; i < job.start + job.count; ++i)
+				REQUIRE(coverage[i] == 1);
+
+			for (uint64_t i = 0; i < coverage.size(); ++i)
+				REQUIRE(coverage[i] <= 1);
+		}
+	}
+
+	// the tiles nearest to the center come first
+	TileScheduler scheduler;
+	scheduler.initialize(200, 100, 0, 200 * 100, 10, TileOrder::CENTER_OUT, 4);
+
+	double previousDistance = 0.0;
+
+	for (const Tile& tile : scheduler.getTiles())
+	{
+		double dx = double(tile.x) + double(tile.width) / 2.0 - 100.0;
+		double dy = double(tile.y) + double(tile.height) / 2.0 - 50.0;
+		double distance = sqrt(dx * dx + dy * dy);
+
+		REQUIRE(distance >= previousDistance);
+		previousDistance = distance;
+	}
+
+	// the first tiles dealt to the threads are all from the center
+	Tile tile;
+
+	for (uint64_t threadIndex = 0; threadIndex < 4; ++threadIndex)
+	{
+		REQUIRE(scheduler.getNextTile(threadIndex, tile));
+		REQUIRE(std::abs(double(tile.x) + 5.0 - 100.0) <= 5.0);
+		REQUIRE(std::abs(double(tile.y) + 5.0 - 50.0) <= 5.0);
+	}
+}
+
+TEST_CASE("TileScheduler threads", "[tilescheduler]")
+{
+	TileScheduler scheduler;
+	scheduler.initialize(640, 480, 0, 640 * 480, 16, TileOrder::HILBERT, 8);
+
+	std::vector<std::atomic<uint64_t>> coverage(640 * 480);
+
+	for (std::atomic<uint64_t>& value : coverage)
+		value = 0;
+
+	std::vector<std::thread> threads;
+
+	// one of the queues is never served by its owner
+	for (uint64_t threadIndex = 0; threadIndex < 7; ++threadIndex)
+	{
+		threads.push_back(std::thread([&scheduler, &coverage, threadIndex]()
+		{
+			Tile tile;
+
+			while (scheduler.getNextTile(threadIndex, tile))
+			{
+				for (uint64_t y = tile.y; y < tile.y + tile.height; ++y)
+					for (uint64_t x = tile.x; x < tile.x + tile.width; ++x)
+						coverage[y * 640 + x]++;
+			}
+		}));
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	uint64_t wrongCount = 0;
+
+	for (std::atomic<uint64_t>& value : coverage)
+	{
+		if (value != 1)
+			wrongCount++;
+	}
+
+	REQUIRE(wrongCount == 0);
+}
+
+#endif
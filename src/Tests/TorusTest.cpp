@@ -0,0 +1,175 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#include "stdafx.h"
+
+#ifdef RUN_UNIT_TESTS
+
+#include "catch/catch.hpp"
+
+#include "Raytracing/Scene.h"
+#include "Raytracing/Ray.h"
+#include "Raytracing/Intersection.h"
+#include "Math/Vector3.h"
+#include "Math/Solver.h"
+#include "Math/Polynomial.h"
+#include "Utils/Log.h"
+#include "App.h"
+
+using namespace Raycer;
+
+TEST_CASE("Torus functionality", "[torus]")
+{
+	std::mt19937 generator(9127);
+	std::uniform_real_distribution<double> randomPosition(-2.0, 2.0);
+	std::uniform_real_distribution<double> randomRadius(0.1, 0.4);
+
+	for (uint64_t torusIndex = 0; torusIndex < 10; ++torusIndex)
+	{
+		Scene scene;
+
+		Torus torus;
+		torus.id = 1;
+		torus.position = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator));
+		torus.normal = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)).normalized();
+		torus.outerRadius = 1.0;
+		torus.innerRadius = randomRadius(generator);
+
+		scene.primitives.toruses.push_back(torus);
+		scene.initialize();
+
+		const Torus& sceneTorus = scene.primitives.toruses[0];
+
+		// distance to the ring along the cross-section
+		auto isInside = [&](const Vector3& point)
+		{
+			Vector3 positionToPoint = point - torus.position;
+			double height = positionToPoint.dot(torus.normal);
+			double radial = (positionToPoint - height * torus.normal).length() - torus.outerRadius;
+
+			return (radial * radial + height * height) < (torus.innerRadius * torus.innerRadius);
+		};
+
+		for (uint64_t i = 0; i < 200; ++i)
+		{
+			// rays from far away and from the hole
+			Ray ray;
+			ray.origin = torus.position + Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * ((i % 2 == 0) ? 50.0 : 0.2);
+			ray.direction = (torus.position + Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 0.5 - ray.origin).normalized();
+			ray.precalculate();
+
+			Intersection torusIntersection;
+			scene.intersect(ray, torusIntersection);
+
+			// march to the first change of the inside state and bisect it
+			bool originIsInside = isInside(ray.origin);
+			double stepSize = 0.0005;
+			double referenceDistance = -1.0;
+			double beginDistance = std::max(0.0, (ray.origin - torus.position).length() - 2.0);
+
+			for (double t = beginDistance + stepSize; t < beginDistance + 5.0; t += stepSize)
+			{
+				if (isInside(ray.origin + t * ray.direction) != originIsInside)
+				{
+					double t0 = t - stepSize;
+					double t1 = t;
+
+					for (uint64_t j = 0; j < 50; ++j)
+					{
+						double tm = (t0 + t1) / 2.0;
+
+						if (isInside(ray.origin + tm * ray.direction) != originIsInside)
+							t1 = tm;
+						else
+							t0 = tm;
+					}
+
+					referenceDistance = t1;
+					break;
+				}
+			}
+
+			REQUIRE(torusIntersection.wasFound == (referenceDistance >= 0.0));
+
+			if (torusIntersection.wasFound)
+			{
+				REQUIRE(torusIntersection.distance == Approx(referenceDistance).epsilon(1.0e-6));
+
+				// the normal points away from the ring
+				Vector3 positionToIp = torusIntersection.position - torus.position;
+				Vector3 ring = (positionToIp - positionToIp.dot(torus.normal) * torus.normal).normalized() * torus.outerRadius;
+				Vector3 expectedNormal = (positionToIp - ring).normalized();
+
+				REQUIRE(torusIntersection.normal.dot(expectedNormal) == Approx(1.0));
+				REQUIRE(sceneTorus.getAABB().getMin().x <= torusIntersection.position.x + 1.0e-9);
+				REQUIRE(sceneTorus.getAABB().getMax().y >= torusIntersection.position.y - 1.0e-9);
+			}
+		}
+	}
+}
+
+TEST_CASE("Torus quartic benchmark", "[torus][.]")
+{
+	std::mt19937 generator(4441);
+	std::uniform_real_distribution<double> randomPosition(-2.0, 2.0);
+
+	double outerRadius2 = 1.0;
+	double innerRadius2 = 0.25 * 0.25;
+
+	// coefficients of the torus quartic for random rays through the bounds
+	std::vector<std::array<double, 5>> equations(100000);
+
+	for (std::array<double, 5>& coefficients : equations)
+	{
+		Vector3 origin = Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)).normalized() * 1.5;
+		Vector3 direction = (Vector3(randomPosition(generator), randomPosition(generator), randomPosition(generator)) * 0.5 - origin).normalized();
+
+		double alpha = direction.dot(direction);
+		double beta = 2.0 * origin.dot(direction);
+		double gamma = origin.dot(origin) - innerRadius2 - outerRadius2;
+
+		coefficients[0] = alpha * alpha;
+		coefficients[1] = 2.0 * alpha * beta;
+		coefficients[2] = beta * beta + 2.0 * alpha * gamma + 4.0 * outerRadius2 * direction.z * direction.z;
+		coefficients[3] = 2.0 * beta * gamma + 8.0 * outerRadius2 * origin.z * direction.z;
+		coefficients[4] = gamma * gamma + 4.0 * outerRadius2 * origin.z * origin.z - 4.0 * outerRadius2 * innerRadius2;
+	}
+
+	uint64_t polynomialHits = 0;
+	uint64_t quarticHits = 0;
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	for (const std::array<double, 5>& coefficients : equations)
+	{
+		Polynomial<5> polynomial(coefficients.data());
+		double t;
+
+		if (polynomial.findSmallestPositiveRealRoot(t, 32, 0.0001, 0.01))
+			polynomialHits++;
+	}
+
+	auto polynomialTime = std::chrono::high_resolution_clock::now() - startTime;
+	startTime = std::chrono::high_resolution_clock::now();
+
+	for (const std::array<double, 5>& coefficients : equations)
+	{
+		QuarticResult result = Solver::findQuarticRoots(coefficients[0], coefficients[1], coefficients[2], coefficients[3], coefficients[4]);
+
+		if (result.rootCount > 0 && result.roots[result.rootCount - 1] > 0.0)
+			quarticHits++;
+	}
+
+	auto quarticTime = std::chrono::high_resolution_clock::now() - startTime;
+
+	App::getLog().logInfo("Torus quartic (equations: %d, polynomial: %d ms, hits: %d, closed form: %d ms, hits: %d)",
+		equations.size(),
+		std::chrono::duration_cast<std::chrono::milliseconds>(polynomialTime).count(),
+		polynomialHits,
+		std::chrono::duration_cast<std::chrono::milliseconds>(quarticTime).count(),
+		quarticHits);
+
+	REQUIRE(quarticHits > 0);
+}
+
+#endif
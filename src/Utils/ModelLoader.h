@@ -8,6 +8,7 @@
 #include "cereal/cereal.hpp"
 
 #include "Raytracing/Primitives/Triangle.h"
+#include "Raytracing/Primitives/TriangleMesh.h"
 #include "Raytracing/Primitives/PrimitiveGroup.h"
 #include "Raytracing/Primitives/Instance.h"
 #include "Raytracing/Textures/ImageTexture.h"
@@ -36,6 +37,7 @@ namespace Raycer
 		bool enableCombinedGroup = false;
 		bool enableCombinedGroupInstance = false;
 		bool invisibleTriangles = false;
+		bool enableTriangleMeshes = false; // emit indexed triangle meshes instead of separate triangles
 		bool invisibleGroups = false;
 		bool invisibleCombinedGroup = false;
 		bool ignoreMaterials = false;
@@ -72,6 +74,7 @@ namespace Raycer
 				CEREAL_NVP(translate),
 				CEREAL_NVP(baseMaterial),
 				CEREAL_NVP(invisibleTriangles),
+				CEREAL_NVP(enableTriangleMeshes),
 				CEREAL_NVP(ignoreMaterials),
 				CEREAL_NVP(enableGroups),
 				CEREAL_NVP(enableGroupsInstances),
@@ -87,6 +90,7 @@ namespace Raycer
 	struct ModelLoaderResult
 	{
 		std::vector<Triangle> triangles;
+		std::vector<TriangleMesh> triangleMeshes;
 		std::vector<Material> materials;
 		std::vector<ImageTexture> textures;
 		std::vector<PrimitiveGroup> groups;
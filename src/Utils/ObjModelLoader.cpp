@@ -32,6 +32,39 @@ namespace
 		return StringUtils::parseDouble(result);
 	}
 
+	// mesh that the faces are currently added to, a new one is started for each group and material change
+	struct ObjMeshState
+	{
+		bool startNewMesh = true;
+		bool hasMissingNormals = false;
+		bool hasTexcoords = false;
+		std::map<std::array<uint64_t, 3>, uint32_t> vertexMap; // (vertex, texcoord, normal) -> mesh vertex
+	};
+
+	void finishMesh(ModelLoaderResult& result, ObjMeshState& meshState)
+	{
+		if (result.triangleMeshes.empty())
+			return;
+
+		TriangleMesh& triangleMesh = result.triangleMeshes.back();
+
+		// faces without normals use the face normal
+		if (meshState.hasMissingNormals)
+		{
+			std::vector<float>().swap(triangleMesh.normalsX);
+			std::vector<float>().swap(triangleMesh.normalsY);
+			std::vector<float>().swap(triangleMesh.normalsZ);
+		}
+
+		if (!meshState.hasTexcoords)
+		{
+			std::vector<float>().swap(triangleMesh.texcoordsU);
+			std::vector<float>().swap(triangleMesh.texcoordsV);
+		}
+
+		meshState = ObjMeshState();
+	}
+
 	void processMaterialFile(const std::string& objFileDirectory, const std::string& mtlFilePath, const ModelLoaderInfo& info, ModelLoaderResult& result, std::map<std::string, uint64_t>& materialsMap, uint64_t& currentId)
 	{
 		std::string absoluteMtlFilePath = getAbsolutePath(objFileDirectory, mtlFilePath);
@@ -212,7 +245,7 @@ namespace
 			result.materials.push_back(currentMaterial);
 	}
 
-	void processFace(const std::string& line, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& texcoords, const ModelLoaderInfo& info, ModelLoaderResult& result, PrimitiveGroup& combinedGroup, uint64_t& currentId, uint64_t currentMaterialId)
+	void processFace(const std::string& line, std::vector<Vector3>& vertices, std::vector<Vector3>& normals, std::vector<Vector2>& texcoords, const ModelLoaderInfo& info, ModelLoaderResult& result, PrimitiveGroup& combinedGroup, ObjMeshState& meshState, uint64_t& currentId, uint64_t currentMaterialId)
 	{
 		Log& log = App::getLog();
 
@@ -301,6 +334,62 @@ namespace
 			return;
 		}
 
+		if (info.enableTriangleMeshes)
+		{
+			if (meshState.startNewMesh)
+			{
+				finishMesh(result, meshState);
+				meshState.startNewMesh = false;
+
+				TriangleMesh triangleMesh;
+				triangleMesh.id = ++currentId;
+				triangleMesh.materialId = currentMaterialId;
+				triangleMesh.invisible = info.invisibleTriangles;
+
+				if (info.enableGroups && result.groups.size() > 0)
+					result.groups.back().primitiveIds.push_back(triangleMesh.id);
+
+				if (info.enableCombinedGroup)
+					combinedGroup.primitiveIds.push_back(triangleMesh.id);
+
+				result.triangleMeshes.push_back(triangleMesh);
+			}
+
+			TriangleMesh& triangleMesh = result.triangleMeshes.back();
+			std::vector<uint32_t> meshIndices;
+
+			if (!hasNormals)
+				meshState.hasMissingNormals = true;
+
+			if (hasTexcoords)
+				meshState.hasTexcoords = true;
+
+			for (uint64_t i = 0; i < vertexIndices.size(); ++i)
+			{
+				std::array<uint64_t, 3> key = { { vertexIndices[i], hasTexcoords ? texcoordIndices[i] : 0, hasNormals ? normalIndices[i] : 0 } };
+				auto it = meshState.vertexMap.find(key);
+
+				if (it != meshState.vertexMap.end())
+				{
+					meshIndices.push_back(it->second);
+					continue;
+				}
+
+				Vector3 normal = hasNormals ? normals[normalIndices[i]] : Vector3();
+				Vector2 texcoord = hasTexcoords ? texcoords[texcoordIndices[i]] : Vector2();
+				uint32_t meshIndex = triangleMesh.addVertex(vertices[vertexIndices[i]], normal, texcoord);
+
+				meshState.vertexMap[key] = meshIndex;
+				meshIndices.push_back(meshIndex);
+			}
+
+			// triangulate
+			for (uint64_t i = 2; i < meshIndices.size(); ++i)
+				triangleMesh.addTriangle(meshIndices[0], meshIndices[i - 1], meshIndices[i]);
+
+			return;
+		}
+
 		// triangulate
 		for (uint64_t i = 2; i < vertexIndices.size(); ++i)
 		{
@@ -379,6 +468,7 @@ ModelLoaderResult ModelLoader::readObjFile(const ModelLoaderInfo& info)
 	std::vector<Vector3> vertices;
 	std::vector<Vector3> normals;
 	std::vector<Vector2> texcoords;
+	ObjMeshState meshState;
 
 	FILE* file = fopen(info.modelFilePath.c_str(), "r");
 
@@ -410,6 +500,7 @@ ModelLoaderResult ModelLoader::readObjFile(const ModelLoaderInfo& info)
 			result.groups.push_back(PrimitiveGroup());
 			result.groups.back().id = ++currentId;
 			result.groups.back().invisible = info.invisibleGroups;
+			meshState.startNewMesh = true;
 
 			if (info.enableGroupsInstances)
 			{
@@ -421,6 +512,7 @@ ModelLoaderResult ModelLoader::readObjFile(const ModelLoaderInfo& info)
 		else if (part == "usemtl" && !info.ignoreMaterials) // select material
 		{
 			StringUtils::readUntilSpace(line, lineIndex, part);
+			meshState.startNewMesh = true;
 
 			if (materialsMap.count(part))
 				currentMaterialId = materialsMap[part];
@@ -460,10 +552,11 @@ ModelLoaderResult ModelLoader::readObjFile(const ModelLoaderInfo& info)
 			texcoords.push_back(texcoord);
 		}
 		else if (part == "f") // face
-			processFace(line.substr(lineIndex), vertices, normals, texcoords, info, result, combinedGroup, currentId, currentMaterialId);
+			processFace(line.substr(lineIndex), vertices, normals, texcoords, info, result, combinedGroup, meshState, currentId, currentMaterialId);
 	}
 
 	fclose(file);
+	finishMesh(result, meshState);
 
 	if (info.enableCombinedGroup)
 	{
@@ -476,7 +569,7 @@ ModelLoaderResult ModelLoader::readObjFile(const ModelLoaderInfo& info)
 	auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
 	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsedTime).count();
 
-	log.logInfo("OBJ file reading finished (time: %d ms, groups: %s, triangles: %s, materials: %s, textures: %s)", milliseconds, result.groups.size(), result.triangles.size(), result.materials.size(), result.textures.size());
+	log.logInfo("OBJ file reading finished (time: %d ms, groups: %s, triangles: %s, triangle meshes: %s, materials: %s, textures: %s)", milliseconds, result.groups.size(), result.triangles.size(), result.triangleMeshes.size(), result.materials.size(), result.textures.size());
 
 	return result;
 }
@@ -497,6 +497,51 @@ namespace
 			}
 		}
 	}
+
+	// vertices are shared as is, missing normals are left empty and the face normals are used
+	void createTriangleMesh(const std::vector<Vector3>& vertices, const std::vector<Vector2>& texcoords, const std::vector<Vector3>& normals, const std::vector<std::vector<uint64_t>>& faces, const ModelLoaderInfo& info, ModelLoaderResult& result, PrimitiveGroup& combinedGroup)
+	{
+		Log& log = App::getLog();
+
+		TriangleMesh triangleMesh;
+		triangleMesh.id = info.idStartOffset + 1;
+		triangleMesh.materialId = info.defaultMaterialId;
+		triangleMesh.invisible = info.invisibleTriangles;
+
+		if (info.enableCombinedGroup)
+			combinedGroup.primitiveIds.push_back(triangleMesh.id);
+
+		for (const Vector3& vertex : vertices)
+			triangleMesh.addVertex(vertex);
+
+		for (const Vector3& normal : normals)
+		{
+			triangleMesh.normalsX.push_back(float(normal.x));
+			triangleMesh.normalsY.push_back(float(normal.y));
+			triangleMesh.normalsZ.push_back(float(normal.z));
+		}
+
+		for (const Vector2& texcoord : texcoords)
+		{
+			triangleMesh.texcoordsU.push_back(float(texcoord.x));
+			triangleMesh.texcoordsV.push_back(float(texcoord.y));
+		}
+
+		for (const std::vector<uint64_t>& face : faces)
+		{
+			if (face.size() < 3)
+			{
+				log.logWarning("Too few vertices (%s) in a face", face.size());
+				continue;
+			}
+
+			// triangulate
+			for (uint64_t i = 2; i < face.size(); ++i)
+				triangleMesh.addTriangle(uint32_t(face[0]), uint32_t(face[i - 1]), uint32_t(face[i]));
+		}
+
+		result.triangleMeshes.push_back(triangleMesh);
+	}
 }
 
 ModelLoaderResult ModelLoader::readPlyFile(const ModelLoaderInfo& info)
@@ -541,7 +586,11 @@ ModelLoaderResult ModelLoader::readPlyFile(const ModelLoaderInfo& info)
 	combinedGroupInstance.primitiveId = combinedGroup.id;
 
 	ModelLoaderResult result;
-	unpackAndTriangulate(header, vertices, texcoords, normals, faces, info, result, combinedGroup);
+
+	if (info.enableTriangleMeshes)
+		createTriangleMesh(vertices, texcoords, normals, faces, info, result, combinedGroup);
+	else
+		unpackAndTriangulate(header, vertices, texcoords, normals, faces, info, result, combinedGroup);
 
 	if (info.enableCombinedGroup)
 	{
@@ -554,7 +603,7 @@ ModelLoaderResult ModelLoader::readPlyFile(const ModelLoaderInfo& info)
 	auto elapsedTime = std::chrono::high_resolution_clock::now() - startTime;
 	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(elapsedTime).count();
 
-	log.logInfo("PLY file reading finished (time: %d ms, groups: %s, triangles: %s, materials: %s, textures: %s)", milliseconds, result.groups.size(), result.triangles.size(), result.materials.size(), result.textures.size());
+	log.logInfo("PLY file reading finished (time: %d ms, groups: %s, triangles: %s, triangle meshes: %s, materials: %s, textures: %s)", milliseconds, result.groups.size(), result.triangles.size(), result.triangleMeshes.size(), result.materials.size(), result.textures.size());
 
 	return result;
 }
@@ -0,0 +1,88 @@
+// Copyright © 2015 Mikko Ronkainen <firstname@mikkoronkainen.com>
+// License: MIT, see the LICENSE file.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Raycer
+{
+	class ScratchBufferStats
+	{
+	public:
+
+		// scratch buffers created or grown, stays constant after the buffers have warmed up
+		// other heap allocations on the same path are not counted
+		static uint64_t getGrowthCount()
+		{
+			return growthCount().load();
+		}
+
+	protected:
+
+		static std::atomic<uint64_t>& growthCount()
+		{
+			static std::atomic<uint64_t> count(0);
+			return count;
+		}
+	};
+
+	// per-thread vector that keeps its capacity between uses, so the intersection path does not allocate per ray
+	// the buffers are stacked, a scope nested inside another one (instance inside a CSG etc.) gets a buffer of its own
+	template <typename T>
+	class ScratchBuffer : public ScratchBufferStats
+	{
+	public:
+
+		ScratchBuffer()
+		{
+			std::vector<std::unique_ptr<std::vector<T>>>& buffers = getBuffers();
+			uint64_t& depth = getDepth();
+
+			if (depth == buffers.size())
+			{
+				buffers.push_back(std::make_unique<std::vector<T>>());
+				++growthCount();
+			}
+
+			buffer = buffers[depth++].get();
+			buffer->clear();
+			initialCapacity = buffer->capacity();
+		}
+
+		~ScratchBuffer()
+		{
+			if (buffer->capacity() != initialCapacity)
+				++growthCount();
+
+			--getDepth();
+		}
+
+		ScratchBuffer(const ScratchBuffer&) = delete;
+		ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+
+		std::vector<T>& get()
+		{
+			return *buffer;
+		}
+
+	private:
+
+		static std::vector<std::unique_ptr<std::vector<T>>>& getBuffers()
+		{
+			static thread_local std::vector<std::unique_ptr<std::vector<T>>> buffers;
+			return buffers;
+		}
+
+		static uint64_t& getDepth()
+		{
+			static thread_local uint64_t depth = 0;
+			return depth;
+		}
+
+		std::vector<T>* buffer = nullptr;
+		uint64_t initialCapacity = 0;
+	};
+}
@@ -24,9 +24,11 @@
 #include <string>
 #include <sstream>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <omp.h>
+#include <xmmintrin.h>
 
 #include <boost/align/aligned_allocator.hpp>
 #include <boost/asio.hpp>